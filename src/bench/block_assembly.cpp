@@ -0,0 +1,416 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "chain/branchtxdb.h"
+#include "chain/chainparams.h"
+#include "coding/base58.h"
+#include "coding/hash.h"
+#include "consensus/consensus.h"
+#include "consensus/tx_verify.h"
+#include "consensus/validation.h"
+#include "io/fs.h"
+#include "key/keystore.h"
+#include "key/pubkey.h"
+#include "mining/miner.h"
+#include "misc/pow.h"
+#include "misc/random.h"
+#include "primitives/block.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "smartcontract/contractdb.h"
+#include "smartcontract/smartcontract.h"
+#include "thread/scheduler.h"
+#include "transaction/txdb.h"
+#include "transaction/txmempool.h"
+#include "utils/util.h"
+#include "validation/validation.h"
+#include "validation/validationinterface.h"
+
+#include <assert.h>
+
+static const int HOT_CONTRACT_NUM = 4;
+static const MCAmount BENCH_TX_FEE = 10000;
+
+static const char* benchContract =
+    "function init()\n"
+    "    PersistentData = {}\n"
+    "    PersistentData.total = 0\n"
+    "end\n"
+    "function transfer(to, n)\n"
+    "    PersistentData.total = PersistentData.total + n\n"
+    "end\n";
+
+static MCContractID RandContractID(FastRandomContext& rng)
+{
+    uint256 seed = rng.rand256();
+    return MCContractID(Hash160(seed.begin(), seed.end()));
+}
+
+// 按块中常见的比例构造交易：普通转账(部分花费块内前面的交易)、合约发布、合约调用链、
+// 跨链第二步交易以及举报/证明交易。nConflictPercent为合约调用落在少数热点合约上的比例，
+// 调用同一合约的交易必须在同一组内执行
+static std::vector<MCTransactionRef> MakeBlockTxs(size_t nTx, int nConflictPercent)
+{
+    FastRandomContext rng(true);
+    std::vector<MCContractID> hotContracts;
+    for (int i = 0; i < HOT_CONTRACT_NUM; ++i)
+        hotContracts.push_back(RandContractID(rng));
+
+    std::vector<MCTransactionRef> vtx;
+    vtx.push_back(nullptr); // coinbase is not init when grouping
+    uint256 lastCallHash;
+    while (vtx.size() < nTx) {
+        MCMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = MCOutPoint(rng.rand256(), 0);
+        tx.vin[0].scriptSig = MCScript() << std::vector<unsigned char>(72, 0x01) << std::vector<unsigned char>(33, 0x02);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = 1 * COIN;
+        tx.vout[1].nValue = 1 * COIN;
+
+        int kind = rng.randrange(10);
+        if (kind < 4) {
+            if (vtx.size() > 1 && rng.randbool())
+                tx.vin[0].prevout = MCOutPoint(vtx[1 + rng.randrange(vtx.size() - 1)]->GetHash(), 1);
+        }
+        else if (kind < 8) {
+            tx.nVersion = kind == 4 ? MCTransaction::PUBLISH_CONTRACT_VERSION : MCTransaction::CALL_CONTRACT_VERSION;
+            tx.pContractData.reset(new ContractData);
+            if (tx.nVersion == MCTransaction::CALL_CONTRACT_VERSION && (int)rng.randrange(100) < nConflictPercent)
+                tx.pContractData->address = hotContracts[rng.randrange(HOT_CONTRACT_NUM)];
+            else
+                tx.pContractData->address = RandContractID(rng);
+            tx.pContractData->codeOrFunc = kind == 4 ? std::string(2048, 'c') : "transfer";
+            tx.pContractData->args = "[\"a\",1]";
+            // 连续调用时花费上一笔调用的找零
+            if (tx.nVersion == MCTransaction::CALL_CONTRACT_VERSION && !lastCallHash.IsNull() && rng.randbool())
+                tx.vin[0].prevout = MCOutPoint(lastCallHash, 1);
+        }
+        else if (kind == 8) {
+            tx.nVersion = MCTransaction::TRANS_BRANCH_VERSION_S2;
+            tx.fromBranchId = "main";
+            tx.fromTx = rng.randbytes(250);
+            tx.inAmount = 1 * COIN;
+        }
+        else if (rng.randbool()) {
+            tx.nVersion = MCTransaction::REPORT_CHEAT;
+            tx.pReportData.reset(new ReportData);
+            tx.pReportData->reporttype = ReportType::REPORT_TX;
+            tx.pReportData->reportedBranchId = rng.rand256();
+            tx.pReportData->reportedBlockHash = rng.rand256();
+            tx.pReportData->reportedTxHash = rng.rand256();
+            tx.pPMT.reset(new MCSpvProof());
+        }
+        else {
+            tx.nVersion = MCTransaction::PROVE;
+            tx.pProveData.reset(new ProveData);
+            tx.pProveData->provetype = ReportType::REPORT_MERKLETREE;
+            tx.pProveData->vtxData = rng.randbytes(500);
+            tx.pProveData->branchId = rng.rand256();
+            tx.pProveData->blockHash = rng.rand256();
+            tx.pProveData->txHash = rng.rand256();
+        }
+
+        MCTransactionRef ptx = MakeTransactionRef(std::move(tx));
+        if (ptx->nVersion == MCTransaction::CALL_CONTRACT_VERSION)
+            lastCallHash = ptx->GetHash();
+        vtx.push_back(ptx);
+    }
+    return vtx;
+}
+
+static void GroupBlockTxs(benchmark::State& state, size_t nTx, int nConflictPercent)
+{
+    std::vector<MCTransactionRef> vtx = MakeBlockTxs(nTx, nConflictPercent);
+    std::vector<const MCTxMemPoolEntry*> entries(vtx.size(), nullptr);
+
+    while (state.KeepRunning()) {
+        std::vector<std::vector<int>> groups = BlockAssembler::GroupBlockTransactions(vtx, 1, entries, MAX_GROUP_NUM);
+        assert(!groups.empty());
+        (void)groups;
+    }
+}
+
+/**
+ * 与TestChain100Setup相同的regtest环境：临时数据目录、链状态、合约数据库与内存池。
+ * 挖出COINBASE_MATURITY个块后把第一个coinbase拆成任何人可花费的输出，再用这些输出构造nTx笔内存池交易：
+ * 约六成为合约调用，其中nConflictPercent的调用落在少数热点合约上，其余为普通转账(部分花费前一笔转账)。
+ */
+class BlockAssemblySetup
+{
+public:
+    BlockAssemblySetup(size_t nTx, int nConflictPercent);
+    ~BlockAssemblySetup();
+
+    std::unique_ptr<MCBlockTemplate> CreateNewBlock(ContractContext& contractContext);
+
+private:
+    ECCVerifyHandle verifyHandle;
+    fs::path pathTemp;
+    MCScheduler scheduler;
+    MCBasicKeyStore keystore;
+    MCKey coinbaseKey;
+    MCKey senderKey;
+    MCScript scriptPubKey;
+
+    MCBlock MineBlock();
+    void PublishContracts(const std::vector<MCContractID>& contractIds);
+    void AddToMempool(MCMutableTransaction& tx, MCAmount nFee, bool fSpendsCoinbase);
+};
+
+BlockAssemblySetup::BlockAssemblySetup(size_t nTx, int nConflictPercent)
+{
+    ECC_Stop(); // SelectParams creates the genesis block with its own ECC_Start/ECC_Stop pair
+    gArgs.ForceSetArg("-powtargetspacing", "1");
+    SelectParams(MCBaseChainParams::REGTEST);
+    ECC_Start();
+    SignatureCoinbaseTransactionPF = &SignatureCoinbaseTransaction;
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    ClearDatadirCache();
+    pathTemp = fs::temp_directory_path() / strprintf("bench_magnachain_%lu_%i", (unsigned long)GetTime(), (int)GetRandInt(100000));
+    fs::create_directories(pathTemp);
+    gArgs.ForceSetArg("-datadir", pathTemp.string());
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
+    pblocktree = new MCBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new MCCoinsViewDB(1 << 23, true);
+    pcoinsTip = new MCCoinsViewCache(pcoinsdbview);
+    pcoinListDb = new CoinListDB(pcoinsdbview->GetDb());
+    mpContractDb = new ContractDataDB(GetDataDir() / "contract", 1 << 23, false, false);
+    pBranchChainTxRecordsDb = new BranchChainTxRecordsDb(GetDataDir() / "branchchaintx", 1 << 23, false, false);
+    pCoinAmountDB = new CoinAmountDB();
+    pCoinAmountCache = new CoinAmountCache(pCoinAmountDB);
+    const MCChainParams& chainparams = Params();
+    bool ret = LoadGenesisBlock(chainparams);
+    assert(ret);
+    MCValidationState state;
+    ret = ActivateBestChain(state, chainparams);
+    assert(ret);
+    (void)ret;
+
+    coinbaseKey.MakeNewKey(true);
+    senderKey.MakeNewKey(true);
+    keystore.AddKey(coinbaseKey);
+    keystore.AddKey(senderKey);
+    scriptPubKey = MCScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    MCTransactionRef coinbaseTx = MineBlock().vtx[0];
+    for (int i = 1; i < COINBASE_MATURITY; ++i)
+        MineBlock();
+
+    // 把成熟的coinbase拆成nTx个输出，随下一个块上链
+    MCScript anyoneCanSpend = MCScript() << OP_TRUE;
+    MCMutableTransaction splitTx;
+    splitTx.vin.resize(1);
+    splitTx.vin[0].prevout = MCOutPoint(coinbaseTx->GetHash(), 0);
+    MCAmount nOutValue = (coinbaseTx->vout[0].nValue - BENCH_TX_FEE) / nTx;
+    splitTx.vout.resize(nTx, MCTxOut(nOutValue, anyoneCanSpend));
+    ret = SignSignature(keystore, *coinbaseTx, splitTx, 0, SIGHASH_ALL);
+    assert(ret);
+    uint256 splitHash = splitTx.GetHash();
+    AddToMempool(splitTx, coinbaseTx->vout[0].nValue - nOutValue * nTx, true);
+    MineBlock();
+
+    FastRandomContext rng(true);
+    std::vector<MCContractID> contractIds;
+    for (int i = 0; i < HOT_CONTRACT_NUM; ++i)
+        contractIds.push_back(RandContractID(rng));
+
+    std::vector<MCMutableTransaction> txs;
+    int nLastTransfer = -1;
+    for (size_t i = 0; i < nTx; ++i) {
+        MCMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = MCOutPoint(splitHash, i);
+        MCAmount nValueIn = nOutValue;
+        if (rng.randrange(10) < 6) {
+            tx.nVersion = MCTransaction::CALL_CONTRACT_VERSION;
+            tx.pContractData.reset(new ContractData);
+            if ((int)rng.randrange(100) < nConflictPercent)
+                tx.pContractData->address = contractIds[rng.randrange(HOT_CONTRACT_NUM)];
+            else {
+                tx.pContractData->address = RandContractID(rng);
+                contractIds.push_back(tx.pContractData->address);
+            }
+            tx.pContractData->sender = senderKey.GetPubKey();
+            tx.pContractData->codeOrFunc = "transfer";
+            tx.pContractData->args = "[\"a\",1]";
+        }
+        else {
+            // 花费前一笔转账的输出，构成内存池中的交易链
+            if (nLastTransfer >= 0 && txs[nLastTransfer].vout[0].nValue > 2 * BENCH_TX_FEE && rng.randbool()) {
+                tx.vin[0].prevout = MCOutPoint(txs[nLastTransfer].GetHash(), 0);
+                nValueIn = txs[nLastTransfer].vout[0].nValue;
+            }
+            nLastTransfer = txs.size();
+        }
+        tx.vout.resize(1, MCTxOut(nValueIn - BENCH_TX_FEE, anyoneCanSpend));
+        if (tx.IsSmartContract()) {
+            MCTransaction txConst(tx);
+            MCScript contractSig;
+            ret = SignContract(&keystore, &txConst, contractSig);
+            assert(ret);
+            tx.pContractData->signature = contractSig;
+        }
+        txs.push_back(tx);
+    }
+
+    PublishContracts(contractIds);
+    for (MCMutableTransaction& tx : txs)
+        AddToMempool(tx, BENCH_TX_FEE, false);
+}
+
+BlockAssemblySetup::~BlockAssemblySetup()
+{
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    mempool.Clear();
+    UnloadBlockIndex();
+    delete pcoinListDb;
+    delete pcoinsTip;
+    delete mpContractDb;
+    delete pBranchChainTxRecordsDb;
+    delete pcoinsdbview;
+    delete pblocktree;
+    delete pCoinAmountCache;
+    delete pCoinAmountDB;
+    pcoinListDb = nullptr;
+    pcoinsTip = nullptr;
+    mpContractDb = nullptr;
+    pBranchChainTxRecordsDb = nullptr;
+    pcoinsdbview = nullptr;
+    pblocktree = nullptr;
+    pCoinAmountCache = nullptr;
+    pCoinAmountDB = nullptr;
+    SetMockTime(0);
+    fs::remove_all(pathTemp);
+    ClearDatadirCache();
+}
+
+std::unique_ptr<MCBlockTemplate> BlockAssemblySetup::CreateNewBlock(ContractContext& contractContext)
+{
+    return BlockAssembler(Params()).CreateNewBlock(scriptPubKey, &contractContext, true, &keystore);
+}
+
+// 与TestChain100Setup::CreateAndProcessBlock一致，打包内存池中的交易并接入链
+MCBlock BlockAssemblySetup::MineBlock()
+{
+    const MCChainParams& chainparams = Params();
+    ContractContext contractContext;
+    std::unique_ptr<MCBlockTemplate> pblocktemplate = CreateNewBlock(contractContext);
+    assert(pblocktemplate != nullptr);
+    MCBlock& block = pblocktemplate->block;
+
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()))
+        ++block.nNonce;
+
+    std::shared_ptr<MCBlock> shared_pblock = std::make_shared<MCBlock>(block);
+    bool ret = ProcessNewBlock(chainparams, shared_pblock, &contractContext, true, nullptr);
+    assert(ret);
+    (void)ret;
+    SetMockTime(GetTime() + chainparams.GetConsensus().nPowTargetSpacing + 10000);
+    return block;
+}
+
+// 在当前块上直接写入已发布的合约，内存池中的调用交易从这里读取合约代码与数据
+void BlockAssemblySetup::PublishContracts(const std::vector<MCContractID>& contractIds)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MagnaChainAddress senderAddr(senderKey.GetPubKey().GetID());
+    for (const MCContractID& contractId : contractIds) {
+        if (context.data.count(contractId) > 0)
+            continue;
+        MagnaChainAddress contractAddr(contractId);
+        std::string rawCode = benchContract;
+        UniValue ret(UniValue::VARR);
+        sls.Initialize(true, chainActive.Tip()->GetBlockTime(), chainActive.Height() + 1, 0, senderAddr, &context, nullptr, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
+        bool success = PublishContract(&sls, contractAddr, rawCode, ret, false);
+        assert(success);
+        (void)success;
+        context.Commit();
+    }
+    bool ret = mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context);
+    assert(ret);
+    (void)ret;
+}
+
+void BlockAssemblySetup::AddToMempool(MCMutableTransaction& tx, MCAmount nFee, bool fSpendsCoinbase)
+{
+    LockPoints lp;
+    LOCK(mempool.cs);
+    mempool.AddUnchecked(tx.GetHash(), MCTxMemPoolEntry(MakeTransactionRef(tx), nFee, GetTime(), chainActive.Height(), fSpendsCoinbase, 4, lp));
+}
+
+// 打包内存池中的交易：选择、分组、TestBlockValidity以及执行区块中的合约
+static void AssembleBlock(benchmark::State& state, size_t nTx, int nConflictPercent)
+{
+    BlockAssemblySetup setup(nTx, nConflictPercent);
+    while (state.KeepRunning()) {
+        ContractContext contractContext;
+        std::unique_ptr<MCBlockTemplate> pblocktemplate = setup.CreateNewBlock(contractContext);
+        assert(pblocktemplate != nullptr);
+    }
+}
+
+// 只执行打包好的区块中的合约(组内预执行后按顺序提交)
+static void ExecuteBlockContracts(benchmark::State& state, size_t nTx, int nConflictPercent)
+{
+    BlockAssemblySetup setup(nTx, nConflictPercent);
+    ContractContext templateContext;
+    std::unique_ptr<MCBlockTemplate> pblocktemplate = setup.CreateNewBlock(templateContext);
+    assert(pblocktemplate != nullptr);
+    while (state.KeepRunning()) {
+        ContractContext contractContext;
+        CoinAmountCache coinAmountCache(pCoinAmountDB);
+        bool ret = mpContractDb->RunBlockContract(&pblocktemplate->block, &contractContext, &coinAmountCache);
+        assert(ret);
+        (void)ret;
+    }
+}
+
+static void GroupBlockTxs1000(benchmark::State& state) { GroupBlockTxs(state, 1000, 0); }
+static void GroupBlockTxs1000Conflict20(benchmark::State& state) { GroupBlockTxs(state, 1000, 20); }
+static void GroupBlockTxs1000Conflict80(benchmark::State& state) { GroupBlockTxs(state, 1000, 80); }
+static void GroupBlockTxs5000(benchmark::State& state) { GroupBlockTxs(state, 5000, 0); }
+static void GroupBlockTxs5000Conflict20(benchmark::State& state) { GroupBlockTxs(state, 5000, 20); }
+static void GroupBlockTxs5000Conflict80(benchmark::State& state) { GroupBlockTxs(state, 5000, 80); }
+
+static void CreateNewBlock500(benchmark::State& state) { AssembleBlock(state, 500, 0); }
+static void CreateNewBlock500Conflict20(benchmark::State& state) { AssembleBlock(state, 500, 20); }
+static void CreateNewBlock500Conflict80(benchmark::State& state) { AssembleBlock(state, 500, 80); }
+static void CreateNewBlock2000(benchmark::State& state) { AssembleBlock(state, 2000, 0); }
+static void CreateNewBlock2000Conflict20(benchmark::State& state) { AssembleBlock(state, 2000, 20); }
+static void CreateNewBlock2000Conflict80(benchmark::State& state) { AssembleBlock(state, 2000, 80); }
+static void RunBlockContract500(benchmark::State& state) { ExecuteBlockContracts(state, 500, 0); }
+static void RunBlockContract500Conflict20(benchmark::State& state) { ExecuteBlockContracts(state, 500, 20); }
+static void RunBlockContract500Conflict80(benchmark::State& state) { ExecuteBlockContracts(state, 500, 80); }
+static void RunBlockContract2000(benchmark::State& state) { ExecuteBlockContracts(state, 2000, 0); }
+static void RunBlockContract2000Conflict20(benchmark::State& state) { ExecuteBlockContracts(state, 2000, 20); }
+static void RunBlockContract2000Conflict80(benchmark::State& state) { ExecuteBlockContracts(state, 2000, 80); }
+
+BENCHMARK(GroupBlockTxs1000);
+BENCHMARK(GroupBlockTxs1000Conflict20);
+BENCHMARK(GroupBlockTxs1000Conflict80);
+BENCHMARK(GroupBlockTxs5000);
+BENCHMARK(GroupBlockTxs5000Conflict20);
+BENCHMARK(GroupBlockTxs5000Conflict80);
+BENCHMARK(CreateNewBlock500);
+BENCHMARK(CreateNewBlock500Conflict20);
+BENCHMARK(CreateNewBlock500Conflict80);
+BENCHMARK(CreateNewBlock2000);
+BENCHMARK(CreateNewBlock2000Conflict20);
+BENCHMARK(CreateNewBlock2000Conflict80);
+BENCHMARK(RunBlockContract500);
+BENCHMARK(RunBlockContract500Conflict20);
+BENCHMARK(RunBlockContract500Conflict80);
+BENCHMARK(RunBlockContract2000);
+BENCHMARK(RunBlockContract2000Conflict20);
+BENCHMARK(RunBlockContract2000Conflict80);
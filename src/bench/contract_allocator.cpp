@@ -0,0 +1,61 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "smartcontract/smartcontract.h"
+
+extern "C"
+{
+#include "lua/lstate.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+#include <assert.h>
+
+// 分配密集的脚本：每次执行创建大量小表和字符串
+static const char* allocScript =
+    "local t = {}\n"
+    "for i = 1, 2000 do t[i] = { i, tostring(i) } end\n";
+
+// 与ReleaseLuaState一致，每次执行后做一次完整GC
+static void RunAllocScript(benchmark::State& state, lua_State* L, ContractAllocator* allocator)
+{
+    luaL_openlibs(L);
+    int ret = luaL_loadstring(L, allocScript);
+    assert(ret == 0);
+    (void)ret;
+
+    while (state.KeepRunning()) {
+        lua_pushvalue(L, -1);
+        ret = lua_pcall(L, 0, 0, 0);
+        assert(ret == 0);
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        if (allocator != nullptr)
+            allocator->Trim();
+    }
+    lua_close(L);
+}
+
+static void LuaAllocSystem(benchmark::State& state)
+{
+    RunAllocScript(state, luaL_newstate(), nullptr);
+}
+
+static void LuaAllocContract(benchmark::State& state)
+{
+    ContractAllocator allocator;
+    RunAllocScript(state, lua_newstate(ContractAllocator::Alloc, &allocator), nullptr);
+}
+
+// 每次执行后都归还空闲页，衡量Trim的开销
+static void LuaAllocContractTrim(benchmark::State& state)
+{
+    ContractAllocator allocator;
+    RunAllocScript(state, lua_newstate(ContractAllocator::Alloc, &allocator), &allocator);
+}
+
+BENCHMARK(LuaAllocSystem);
+BENCHMARK(LuaAllocContract);
+BENCHMARK(LuaAllocContractTrim);
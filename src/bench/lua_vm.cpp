@@ -0,0 +1,75 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+extern "C"
+{
+#include "lua/lstate.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+#include <assert.h>
+
+// 与合约执行一致：开启gas计量，运行循环密集型脚本
+static void RunLuaScript(benchmark::State& state, const char* script)
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    int ret = luaL_loadstring(L, script);
+    assert(ret == 0);
+    (void)ret;
+
+    while (state.KeepRunning()) {
+        lua_pushvalue(L, -1);
+        L->limit_on = 1;
+        L->limit_instruction = 100000000;
+        ret = lua_pcall(L, 0, 0, 0);
+        assert(ret == 0);
+        L->limit_on = 0;
+    }
+    lua_close(L);
+}
+
+static void LuaVMNumericLoop(benchmark::State& state)
+{
+    RunLuaScript(state,
+        "local s = 0\n"
+        "for i = 1, 100000 do\n"
+        "  if i % 3 == 0 then s = s + i else s = s - 1 end\n"
+        "end\n");
+}
+
+static void LuaVMWhileLoop(benchmark::State& state)
+{
+    RunLuaScript(state,
+        "local i, s = 0, 0\n"
+        "while i < 100000 do\n"
+        "  i = i + 1\n"
+        "  if i > 50000 and s < 1000000 then s = s + 2 end\n"
+        "end\n");
+}
+
+static void LuaVMTableLoop(benchmark::State& state)
+{
+    RunLuaScript(state,
+        "local t = {}\n"
+        "for i = 1, 5000 do t[i] = i * 2 end\n"
+        "local s = 0\n"
+        "for k, v in ipairs(t) do s = s + v end\n");
+}
+
+static void LuaVMFunctionCall(benchmark::State& state)
+{
+    RunLuaScript(state,
+        "local function add(a, b) return a + b end\n"
+        "local s = 0\n"
+        "for i = 1, 50000 do s = add(s, i) end\n");
+}
+
+BENCHMARK(LuaVMNumericLoop);
+BENCHMARK(LuaVMWhileLoop);
+BENCHMARK(LuaVMTableLoop);
+BENCHMARK(LuaVMFunctionCall);
@@ -17,8 +17,11 @@
 #include "utils/utilstrencodings.h"
 
 #include <stdio.h>
+#include <condition_variable>
+#include <mutex>
 
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/keyvalq_struct.h>
 #include "support/events.h"
 
@@ -40,8 +43,15 @@
 #include "misc/timedata.h"
 #include "smartcontract/smartcontract.h"
 #include "transaction/txmempool.h"
+#include "chain/branchsendqueue.h"
+#include "misc/cuckoocache.h"
+#include "misc/random.h"
+#include "script/sigcache.h"
 
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT = 900;
+static const int RPC_CONNECT_TIMEOUT = 10;          // 新连接建立TCP连接的超时(秒)，超时后视为对端不可用
+static const int MAX_RPC_CONNECTIONS_PER_HOST = 4;  // 每个对端同时进行的请求数上限
+static const int64_t RPC_HOST_DOWN_BACKOFF = 5;     // 连接失败后该时间(秒)内的请求直接失败，不再等待连接
 
 //
 // Exception thrown on connection error.  This error is used to determine
@@ -60,11 +70,13 @@ public:
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
-	HTTPReply() : status(0), error(-1) {}
+	HTTPReply() : status(0), error(-1), base(nullptr), fTimedOut(false) {}
 
 	int status;
 	int error;
 	std::string body;
+	struct event_base* base;    // 持久连接空闲时仍有读事件，完成后需要主动退出事件循环
+	bool fTimedOut;             // 超过请求的总时限仍未收到回复
 };
 
 const char *http_errorstring2(int code)
@@ -92,6 +104,8 @@ const char *http_errorstring2(int code)
 static void http_request_done(struct evhttp_request *req, void *ctx)
 {
 	HTTPReply *reply = static_cast<HTTPReply*>(ctx);
+	if (reply->base)
+		event_base_loopbreak(reply->base);
 
 	if (req == nullptr) {
 		/* If req is nullptr, it means an error occurred while connecting: the
@@ -122,39 +136,171 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const std::string& host, const int port, const std::string& strMethod, const UniValue& params, 
-	const std::string& strRPCUserColonPass, const std::string& rpcwallet/*=""*/)
+/** 跨链RPC的持久连接，同一时刻只被一个调用使用 */
+struct RPCConnection
 {
-	// Obtain event base
-	raii_event_base base = obtain_event_base();
+	raii_event_base base;
+	raii_evhttp_connection evcon;
+	bool fConnected = false;    // 连接建立前使用RPC_CONNECT_TIMEOUT，建立后改为本次请求等待回复的超时
+	int nTimeout = DEFAULT_HTTP_CLIENT_TIMEOUT;
+};
 
-	// Synchronously look up hostname
-	raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-	evhttp_connection_set_timeout(evcon.get(), DEFAULT_HTTP_CLIENT_TIMEOUT);
+// libevent 2.1没有单独的连接超时接口，连接建立前后共用evcon的超时。
+// evhttp在TCP连接建立后才把请求写入bufferevent的输出缓冲，以此作为连接建立的通知，再放宽为等待回复的超时
+static void rpc_connected_cb(struct evbuffer*, const struct evbuffer_cb_info* info, void* arg)
+{
+	RPCConnection* conn = static_cast<RPCConnection*>(arg);
+	if (conn->fConnected || info->n_added == 0)
+		return;
+	conn->fConnected = true;
+	evhttp_connection_set_timeout(conn->evcon.get(), conn->nTimeout);
+}
 
-	HTTPReply response;
+// 整个请求的时限，对端持续缓慢发送数据时evhttp的空闲超时不会触发
+static void rpc_deadline_cb(evutil_socket_t, short, void* arg)
+{
+	HTTPReply* reply = static_cast<HTTPReply*>(arg);
+	reply->fTimedOut = true;
+	event_base_loopbreak(reply->base);
+}
+
+/**
+ * 同一对端(ip:port)的连接池。连接保持keep-alive复用，并发请求数不超过MAX_RPC_CONNECTIONS_PER_HOST，
+ * 超出时等待其他请求完成；连接失败后RPC_HOST_DOWN_BACKOFF秒内的请求直接失败。
+ */
+class RPCConnectionPool
+{
+public:
+	RPCConnectionPool(const std::string& hostIn, int portIn) : host(hostIn), port(portIn) {}
+
+	std::unique_ptr<RPCConnection> Acquire(bool& fReused)
+	{
+		std::unique_lock<std::mutex> lock(cs);
+		cond.wait(lock, [this] { return nActive < MAX_RPC_CONNECTIONS_PER_HOST; });
+		if (GetTime() < nDownUntil)
+			throw MCConnectionFailed(strprintf("couldn't connect to server %s:%d recently, retry later", host, port));
+		++nActive;
+		fReused = !vIdle.empty();
+		if (fReused) {
+			std::unique_ptr<RPCConnection> conn = std::move(vIdle.back());
+			vIdle.pop_back();
+			return conn;
+		}
+		lock.unlock();
+
+		std::unique_ptr<RPCConnection> conn(new RPCConnection);
+		try {
+			conn->base = obtain_event_base();
+			// Synchronously look up hostname
+			conn->evcon = obtain_evhttp_connection_base(conn->base.get(), host, port);
+		}
+		catch (...) {
+			Release(nullptr);
+			throw;
+		}
+		evhttp_connection_set_timeout(conn->evcon.get(), RPC_CONNECT_TIMEOUT);
+		return conn;
+	}
+
+	// conn为空表示连接已失效，直接丢弃
+	void Release(std::unique_ptr<RPCConnection> conn)
+	{
+		{
+			std::lock_guard<std::mutex> lock(cs);
+			--nActive;
+			if (conn)
+				vIdle.push_back(std::move(conn));
+		}
+		cond.notify_one();
+	}
+
+	void MarkDown()
+	{
+		std::lock_guard<std::mutex> lock(cs);
+		nDownUntil = GetTime() + RPC_HOST_DOWN_BACKOFF;
+		vIdle.clear();
+	}
+
+private:
+	const std::string host;
+	const int port;
+	std::mutex cs;
+	std::condition_variable cond;
+	std::vector<std::unique_ptr<RPCConnection>> vIdle;
+	int nActive = 0;
+	int64_t nDownUntil = 0;
+};
+
+static RPCConnectionPool& GetRPCConnectionPool(const std::string& host, int port)
+{
+	static std::mutex csPools;
+	static std::map<std::pair<std::string, int>, std::unique_ptr<RPCConnectionPool>> mapPools;
+
+	std::lock_guard<std::mutex> lock(csPools);
+	std::unique_ptr<RPCConnectionPool>& pool = mapPools[std::make_pair(host, port)];
+	if (!pool)
+		pool.reset(new RPCConnectionPool(host, port));
+	return *pool;
+}
+
+static void SendRPCRequest(RPCConnection& conn, const std::string& host, const std::string& strRequest,
+	const std::string& strRPCUserColonPass, const std::string& endpoint, int nTimeout, HTTPReply& response)
+{
+	response.base = conn.base.get();
+	conn.nTimeout = nTimeout;
+	struct evbuffer_cb_entry* connectedCb = nullptr;
+	if (conn.fConnected) {
+		evhttp_connection_set_timeout(conn.evcon.get(), nTimeout);
+	}
+	else {
+		struct bufferevent* bev = evhttp_connection_get_bufferevent(conn.evcon.get());
+		if (bev == nullptr)
+			throw std::runtime_error("create http connection failed");
+		connectedCb = evbuffer_add_cb(bufferevent_get_output(bev), rpc_connected_cb, &conn);
+	}
 	raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
 	if (req == nullptr)
 		throw std::runtime_error("create http request failed");
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
 	evhttp_request_set_error_cb(req.get(), http_error_cb);
 #endif
-    
+
 	struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
 	assert(output_headers);
 	evhttp_add_header(output_headers, "Host", host.c_str());
-	evhttp_add_header(output_headers, "Connection", "close");
+	evhttp_add_header(output_headers, "Connection", "keep-alive");
 	evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
 
 	// Attach request data
-    std::string strRequest = JSONRPCRequestObj(strMethod, params, 1).write() + "\n";
 	struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
 	assert(output_buffer);
 	evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
 
+	int r = evhttp_make_request(conn.evcon.get(), req.get(), EVHTTP_REQ_POST, endpoint.c_str());
+	req.release(); // ownership moved to evcon in above call
+	if (r != 0) {
+		throw MCConnectionFailed("send http request failed");
+	}
+
+	raii_event deadline = obtain_event(conn.base.get(), -1, 0, rpc_deadline_cb, &response);
+	struct timeval tv = { (conn.fConnected ? 0 : RPC_CONNECT_TIMEOUT) + nTimeout, 0 };
+	event_add(deadline.get(), &tv);
+
+	event_base_dispatch(conn.base.get());
+
+	if (connectedCb) {
+		struct bufferevent* bev = evhttp_connection_get_bufferevent(conn.evcon.get());
+		evbuffer_remove_cb_entry(bufferevent_get_output(bev), connectedCb);
+	}
+}
+
+// 发送请求并解析返回的json，单个请求返回对象，批量请求返回数组
+static UniValue PostRPCRequest(const std::string& host, const int port, const std::string& strRequest,
+	const std::string& strRPCUserColonPass, const std::string& rpcwallet, int nTimeout)
+{
 	// check if we should use a special wallet endpoint
 	std::string endpoint = "/";
-    std::string walletName = rpcwallet;
+	std::string walletName = rpcwallet;
 	if (!walletName.empty()) {
 		char *encodedURI = evhttp_uriencode(walletName.c_str(), walletName.size(), false);
 		if (encodedURI) {
@@ -165,13 +311,36 @@ UniValue CallRPC(const std::string& host, const int port, const std::string& str
 			throw MCConnectionFailed("uri-encode failed");
 		}
 	}
-	int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, endpoint.c_str());
-	req.release(); // ownership moved to evcon in above call
-	if (r != 0) {
-		throw MCConnectionFailed("send http request failed");
-	}
 
-	event_base_dispatch(base.get());
+	RPCConnectionPool& pool = GetRPCConnectionPool(host, port);
+	HTTPReply response;
+	for (int nAttempt = 0; ; ++nAttempt) {
+		bool fReused = false;
+		std::unique_ptr<RPCConnection> conn = pool.Acquire(fReused);
+		response = HTTPReply();
+		try {
+			SendRPCRequest(*conn, host, strRequest, strRPCUserColonPass, endpoint, nTimeout, response);
+		}
+		catch (...) {
+			pool.Release(nullptr);
+			throw;
+		}
+		if (response.status != 0) {
+			pool.Release(std::move(conn));
+			break;
+		}
+		// 超时的请求仍挂在连接上，丢弃连接；对端只是处理慢，不重试也不标记为不可用
+		if (response.fTimedOut) {
+			pool.Release(nullptr);
+			throw MCConnectionFailed(strprintf("no reply from server %s:%d within %d seconds", host, port, nTimeout));
+		}
+		pool.Release(nullptr);
+		// 空闲的连接可能已被对端关闭，用新连接重试一次
+		if (fReused && nAttempt == 0)
+			continue;
+		pool.MarkDown();
+		break;
+	}
 
 	if (response.status == 0)
 		throw MCConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring2(response.error), response.error));
@@ -186,6 +355,14 @@ UniValue CallRPC(const std::string& host, const int port, const std::string& str
 	UniValue valReply(UniValue::VSTR);
 	if (!valReply.read(response.body))
 		throw std::runtime_error("couldn't parse reply from server");
+	return valReply;
+}
+
+UniValue CallRPC(const std::string& host, const int port, const std::string& strMethod, const UniValue& params, 
+	const std::string& strRPCUserColonPass, const std::string& rpcwallet/*=""*/)
+{
+	std::string strRequest = JSONRPCRequestObj(strMethod, params, 1).write() + "\n";
+	UniValue valReply = PostRPCRequest(host, port, strRequest, strRPCUserColonPass, rpcwallet, DEFAULT_HTTP_CLIENT_TIMEOUT);
 	const UniValue& reply = valReply.get_obj();
 	if (reply.empty())
 		throw std::runtime_error("expected reply to have result, error and id properties");
@@ -193,6 +370,18 @@ UniValue CallRPC(const std::string& host, const int port, const std::string& str
 	return reply;
 }
 
+UniValue CallRPCBatch(MCRPCConfig& rpccfg, const UniValue& requests, int nTimeout)
+{
+	if (rpccfg.strRPCUserColonPass.empty() && rpccfg.getcookiefail > 0) {
+		rpccfg.InitUserColonPass(true);
+	}
+
+	UniValue replies = PostRPCRequest(rpccfg.strIp, rpccfg.iPort, requests.write() + "\n", rpccfg.strRPCUserColonPass, rpccfg.strWallet, nTimeout);
+	if (!replies.isArray())
+		throw std::runtime_error("expected batch reply to be an array");
+	return replies;
+}
+
 UniValue CallRPC(MCRPCConfig& rpccfg, const std::string& strMethod, const UniValue& params)
 {
     try {
@@ -698,8 +887,66 @@ int CheckSpvProof(const uint256& merkleRoot, MCPartialMerkleTree& pmt, const uin
     return vIndex[0];
 }
 
+namespace {
+/**
+ * 验证通过的spv证明缓存，同一笔交易的证明在进入内存池和打包进块时、
+ * 以及多笔证明交易引用同一个支链交易时不用重复计算merkle路径。
+ * 条目为SHA256(nonce || merkleRoot || txid || SerializeHash(pmt))，包含证明本身，
+ * 保证命中缓存时的结果与重新验证一致。
+ */
+class SpvProofCache
+{
+private:
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_spvcache;
+
+public:
+    static const size_t CACHE_BYTES = 4 << 20;
+
+    SpvProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup_bytes(CACHE_BYTES);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& merkleRoot, const MCPartialMerkleTree& pmt, const uint256& txhash)
+    {
+        const uint256 pmtHash = SerializeHash(pmt);
+        CSHA256().Write(nonce.begin(), 32).Write(merkleRoot.begin(), 32).Write(txhash.begin(), 32).Write(pmtHash.begin(), 32).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spvcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_spvcache);
+        setValid.insert(entry);
+    }
+};
+
+static SpvProofCache spvProofCache;
+} // namespace
+
+bool CheckSpvProofWithCache(const uint256& merkleRoot, MCPartialMerkleTree& pmt, const uint256& querytxhash)
+{
+    uint256 entry;
+    spvProofCache.ComputeEntry(entry, merkleRoot, pmt, querytxhash);
+    if (spvProofCache.Get(entry))
+        return true;
+    if (CheckSpvProof(merkleRoot, pmt, querytxhash) < 0)
+        return false;
+    spvProofCache.Set(entry);
+    return true;
+}
+
 // 跨链交易从发起链广播到目标链 
-bool BranchChainTransStep2(const MCTransactionRef& tx, const MCBlock &block, std::string* pStrErrorMsg)
+bool BranchChainTransStep2(const MCTransactionRef& tx, const MCBlock &block, std::string* pStrErrorMsg, bool fAsync)
 {
 	if (!tx->IsPregnantTx())
 	{
@@ -738,6 +985,11 @@ bool BranchChainTransStep2(const MCTransactionRef& tx, const MCBlock &block, std
 	UniValue params(UniValue::VARR);
 	params.push_back(strTxHexData);
 
+	if (fAsync && g_branchSendQueue) {
+		g_branchSendQueue->Push(strToChainId, strMethod, params);
+		return true;
+	}
+
 	UniValue reply = CallRPC(chainrpccfg, strMethod, params);
 
 	const UniValue& result = find_value(reply, "result");
@@ -772,11 +1024,11 @@ void ProcessBlockBranchChain()
 					const MCTransactionRef& tx = block.vtx[i];
 					if (tx->IsBranchChainTransStep1() || tx->IsMortgage())
 					{
-						BranchChainTransStep2(tx, block, nullptr);
+						BranchChainTransStep2(tx, block, nullptr, true);
 					}
                     if (tx->IsRedeemMortgageStatement())
                     {
-                        ReqMainChainRedeemMortgage(tx, block);
+                        ReqMainChainRedeemMortgage(tx, block, nullptr, true);
                     }
 				}
 			}
@@ -938,7 +1190,7 @@ bool CheckBranchTransaction(const MCTransaction& txBranchChainStep2, MCValidatio
 #define SetStrErr(strMsg) {if (pStrErr) *pStrErr = (strMsg);}
 //提交侧链区块头
 //call in branch chain
-bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlock, std::string *pStrErr, bool onlySendMy)
+bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlock, std::string *pStrErr, bool onlySendMy, bool fAsync)
 {
     SetStrErr("Unknow error\n");
     if (Params().IsMainChain() || pBlock == nullptr) {
@@ -1005,6 +1257,12 @@ bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlock, std::str
     MCTransactionRef tx = MakeTransactionRef(std::move(mtx));
     params.push_back(EncodeHexTx(*tx, RPCSerializationFlags()));
 
+    if (fAsync && g_branchSendQueue) {
+        g_branchSendQueue->Push(MCBaseChainParams::MAIN, strMethod, params);
+        SetStrErr("");
+        return true;
+    }
+
     UniValue reply = CallRPC(branchrpccfg, strMethod, params);
 
     const UniValue& result = find_value(reply, "result");
@@ -1030,8 +1288,8 @@ bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlock, std::str
     return true;
 }
 
-extern bool CheckBlockHeaderWork(const MCBranchBlockInfo& block, MCValidationState& state, const MCChainParams &params, BranchData& branchdata, BranchCache* pBranchCache);
-extern bool BranchContextualCheckBlockHeader(const MCBlockHeader& block, MCValidationState& state, const MCChainParams& params, BranchData &branchdata, 
+extern bool CheckBlockHeaderWork(const MCBranchBlockInfo& block, MCValidationState& state, const MCChainParams &params, const BranchData& branchdata, BranchCache* pBranchCache);
+extern bool BranchContextualCheckBlockHeader(const MCBlockHeader& block, MCValidationState& state, const MCChainParams& params, const BranchData &branchdata, 
     int64_t nAdjustedTime, BranchCache* pBranchCache);
 
 bool CheckBranchBlockInfoTx(const MCTransaction& tx, MCValidationState& state, BranchCache* pBranchCache)
@@ -1059,7 +1317,7 @@ bool CheckBranchBlockInfoTx(const MCTransaction& tx, MCValidationState& state, B
         return state.DoS(100, false, REJECT_DUPLICATE, "branch block info duplicate");
     }
 
-    BranchData branchdata = pBranchCache->GetBranchData(tx.pBranchBlockData->branchID);
+    const BranchData& branchdata = pBranchCache->GetBranchDataView(tx.pBranchBlockData->branchID);
     //ContextualCheckBlockHeader
     const MCChainParams& bparams = BranchParams(tx.pBranchBlockData->branchID);
     if (!BranchContextualCheckBlockHeader(blockheader, state, bparams, branchdata, GetAdjustedTime(), pBranchCache)) {
@@ -1075,7 +1333,7 @@ bool CheckBranchBlockInfoTx(const MCTransaction& tx, MCValidationState& state, B
 }
 
 // 如果是自己的交易则,向自己的主链发起赎回请求,把抵押币解锁
-bool ReqMainChainRedeemMortgage(const MCTransactionRef& tx, const MCBlock& block, std::string *pStrErr)
+bool ReqMainChainRedeemMortgage(const MCTransactionRef& tx, const MCBlock& block, std::string *pStrErr, bool fAsync)
 {
     SetStrErr("Unknow error");
     if (tx->IsRedeemMortgageStatement() == false) {
@@ -1109,6 +1367,12 @@ bool ReqMainChainRedeemMortgage(const MCTransactionRef& tx, const MCBlock& block
         return false;
     }
 
+    if (fAsync && g_branchSendQueue) {
+        g_branchSendQueue->Push(MCBaseChainParams::MAIN, strMethod, params);
+        SetStrErr("");
+        return true;
+    }
+
     UniValue reply = CallRPC(branchrpccfg, strMethod, params);
 
     const UniValue& result = find_value(reply, "result");
@@ -1169,7 +1433,7 @@ bool CheckBranchDuplicateTx(const MCTransaction& tx, MCValidationState& state, B
         if (pBranchCache && pBranchCache->HasInCache(tx))
             return state.DoS(0, false, REJECT_DUPLICATE, "branch block info duplicate");
 
-        BranchData branchdata = g_pBranchDb->GetBranchData(tx.pBranchBlockData->branchID);
+        const BranchData& branchdata = g_pBranchDb->GetBranchDataView(tx.pBranchBlockData->branchID);
         MCBlockHeader blockheader;
         tx.pBranchBlockData->GetBlockHeader(blockheader);
         if (branchdata.mapHeads.count(blockheader.GetHash())) {
@@ -1212,9 +1476,9 @@ bool CheckBranchDuplicateTx(const MCTransaction& tx, MCValidationState& state, B
     return true;
 }
 
-bool CheckReportTxCommonly(const MCTransaction& tx, MCValidationState& state, BranchData& branchdata)
+bool CheckReportTxCommonly(const MCTransaction& tx, MCValidationState& state, const BranchData& branchdata)
 {
-    BranchBlockData* pBlockData = branchdata.GetBranchBlockData(tx.pReportData->reportedBlockHash);
+    const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(tx.pReportData->reportedBlockHash);
     if (pBlockData == nullptr)
         return state.DoS(0, false, REJECT_INVALID, "CheckReportCheatTx Can not found block data in mapHeads");
     if (branchdata.Height() < pBlockData->nHeight)
@@ -1231,15 +1495,15 @@ bool CheckReportCheatTx(const MCTransaction& tx, MCValidationState& state, Branc
         const uint256 reportedBranchId = tx.pReportData->reportedBranchId;
         if (!pBranchCache->HasBranchData(reportedBranchId))
             return state.DoS(100, false, REJECT_INVALID, "CheckReportCheatTx branchid error");
-        BranchData branchdata = pBranchCache->GetBranchData(reportedBranchId);
+        const BranchData& branchdata = pBranchCache->GetBranchDataView(reportedBranchId);
 
         if (tx.pReportData->reporttype == ReportType::REPORT_TX || tx.pReportData->reporttype == ReportType::REPORT_COINBASE)
         {
             MCSpvProof spvProof(*tx.pPMT);
-            BranchBlockData* pBlockData = branchdata.GetBranchBlockData(spvProof.blockhash);
+            const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(spvProof.blockhash);
             if (pBlockData == nullptr)
                 return state.DoS(100, false, REJECT_INVALID, "pBlockData == nullptr");
-            if (CheckSpvProof(pBlockData->header.hashMerkleRoot, spvProof.pmt, tx.pReportData->reportedTxHash) < 0)
+            if (!CheckSpvProofWithCache(pBlockData->header.hashMerkleRoot, spvProof.pmt, tx.pReportData->reportedTxHash))
                 return state.DoS(100, false, REJECT_INVALID, "CheckSpvProof fail");;
             if (!CheckReportTxCommonly(tx, state, branchdata))
                 return state.DoS(100, false, REJECT_INVALID, "CheckReportTxCommonly fail");;
@@ -1260,8 +1524,58 @@ bool CheckReportCheatTx(const MCTransaction& tx, MCValidationState& state, Branc
     return true;
 }
 
-bool CheckTransactionProveWithProveData(const MCTransactionRef &pProveTx, MCValidationState& state, 
-    const std::vector<ProveDataItem>& vectProveData, BranchData& branchData, MCAmount& fee, bool jumpFrist)
+namespace {
+/**
+ * 证明数据项的验证。一个证明交易的多个输入以及一个块内的多笔交易经常引用同一笔支链交易，
+ * 相同的证明数据项只反序列化和做spv验证一次。
+ */
+class ProveItemChecker
+{
+public:
+    explicit ProveItemChecker(const BranchData& branchDataIn) : branchData(branchDataIn) {}
+
+    // 返回证明的交易，验证失败时返回nullptr并设置state
+    MCTransactionRef Check(const ProveDataItem& provDataItem, MCValidationState& state)
+    {
+        const uint256 itemHash = SerializeHash(provDataItem);
+        auto it = mapChecked.find(itemHash);
+        if (it != mapChecked.end())
+            return it->second;
+
+        if (branchData.mapHeads.count(provDataItem.blockHash) == 0) {
+            state.DoS(0, false, REJECT_INVALID, "proveitem's block not exist");
+            return nullptr;
+        }
+
+        MCTransactionRef pTx;
+        MCDataStream cds(provDataItem.tx, SER_NETWORK, INIT_PROTO_VERSION);
+        cds >> (pTx);
+
+        MCSpvProof spvProof(provDataItem.pCSP);
+        const BranchBlockData* pBlockData = branchData.GetBranchBlockData(spvProof.blockhash);
+        if (pBlockData == nullptr) {
+            state.DoS(0, false, REJECT_INVALID, "pBlockData == nullptr");
+            return nullptr;
+        }
+        if (!CheckSpvProofWithCache(pBlockData->header.hashMerkleRoot, spvProof.pmt, pTx->GetHash())) {
+            state.DoS(0, false, REJECT_INVALID, "Check Prove ReportTx spv check fail");
+            return nullptr;
+        }
+
+        mapChecked[itemHash] = pTx;
+        return pTx;
+    }
+
+private:
+    const BranchData& branchData;
+    std::map<uint256, MCTransactionRef> mapChecked;
+};
+} // namespace
+
+// 签名检查放入vChecks由调用者统一执行，txdata的生命周期要覆盖vChecks的执行
+static bool CheckTransactionProveWithProveData(const MCTransactionRef &pProveTx, MCValidationState& state, 
+    const std::vector<ProveDataItem>& vectProveData, ProveItemChecker& itemChecker, MCAmount& fee, bool jumpFrist,
+    PrecomputedTransactionData& txdata, std::vector<CScriptCheck>& vChecks)
 {
     if (pProveTx->IsCoinBase()) {
         return state.DoS(0, false, REJECT_INVALID, "CheckProveReportTx Prove tx can not a coinbase transaction");
@@ -1277,20 +1591,9 @@ bool CheckTransactionProveWithProveData(const MCTransactionRef &pProveTx, MCVali
     MCScript contractScript = GetScriptForDestination(pProveTx->pContractData->address);
     for (size_t i = 0; i < pProveTx->vin.size(); ++i)
     {
-        const ProveDataItem& provDataItem = vectProveData[i + baseIndex];
-        if (branchData.mapHeads.count(provDataItem.blockHash) == 0)
-            return state.DoS(0, false, REJECT_INVALID, "proveitem's block not exist");
-
-        MCTransactionRef pTx;
-        MCDataStream cds(provDataItem.tx, SER_NETWORK, INIT_PROTO_VERSION);
-        cds >> (pTx);
-
-        MCSpvProof spvProof(provDataItem.pCSP);
-        BranchBlockData* pBlockData = branchData.GetBranchBlockData(spvProof.blockhash);
-        if (pBlockData == nullptr)
-            return state.DoS(0, false, REJECT_INVALID, "pBlockData == nullptr");
-        if (CheckSpvProof(pBlockData->header.hashMerkleRoot, spvProof.pmt, pTx->GetHash()) < 0)
-            return state.DoS(0, false, REJECT_INVALID, "Check Prove ReportTx spv check fail");
+        MCTransactionRef pTx = itemChecker.Check(vectProveData[i + baseIndex], state);
+        if (pTx == nullptr)
+            return false;
 
         const MCOutPoint& outpoint = pProveTx->vin[i].prevout;
         if (pTx->GetHash() != outpoint.hash)
@@ -1310,26 +1613,16 @@ bool CheckTransactionProveWithProveData(const MCTransactionRef &pProveTx, MCVali
             nContractIn += amount;
         }
 
+        //智能合约转币不用签名的
+        if (pProveTx->IsCallContract()) {
+            MCContractID kDestKey;
+            if (scriptPubKey.GetContractAddr(kDestKey) && kDestKey == pProveTx->pContractData->address)
+                continue;
+        }
+
         bool fCacheResults = false;
         unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY | SCRIPT_VERIFY_CHECKSEQUENCEVERIFY | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_NULLDUMMY;
-
-        PrecomputedTransactionData txdata(*pProveTx);
-        CScriptCheck check(scriptPubKey, amount, *pProveTx, i, flags, fCacheResults, &txdata);
-        if (!check()) {
-            bool checkok = true;
-            if (pProveTx->IsCallContract()){//智能合约转币不用签名的
-                checkok = false;
-                MCContractID kDestKey;
-                if (!scriptPubKey.GetContractAddr(kDestKey)) {
-                    return state.DoS(0, false, REJECT_NONSTANDARD, "check smartcontract sign fail, contract addr fail");
-                }
-                if (kDestKey != pProveTx->pContractData->address)
-                    return state.DoS(0, false, REJECT_INVALID, "check smartcontract sign fail, contract addr error");
-                checkok = true;
-            }
-            if (!checkok)
-                return state.DoS(0, false, REJECT_INVALID, "CheckProveReportTx scriptcheck fail");
-        }
+        vChecks.emplace_back(scriptPubKey, amount, *pProveTx, i, flags, fCacheResults, &txdata);
     }
 
     //check input >= output value
@@ -1423,21 +1716,26 @@ bool CheckProveReportTx(const MCTransaction& tx, MCValidationState& state, Branc
         return state.DoS(0, false, REJECT_INVALID, "Prove tx data error, first tx's hasdid is not eq proved txid");
 
     // spv check
-    BranchData branchData = pBranchCache->GetBranchData(branchId);
+    const BranchData& branchData = pBranchCache->GetBranchDataView(branchId);
     MCSpvProof spvProof(vectProveData[0].pCSP);
-    BranchBlockData* pBlockData = branchData.GetBranchBlockData(spvProof.blockhash);
+    const BranchBlockData* pBlockData = branchData.GetBranchBlockData(spvProof.blockhash);
     if (pBlockData == nullptr)
         return state.DoS(0, false, REJECT_INVALID, "pBlockData == nullptr");
-    if (CheckSpvProof(pBlockData->header.hashMerkleRoot, spvProof.pmt, pProveTx->GetHash()) < 0)
+    if (!CheckSpvProofWithCache(pBlockData->header.hashMerkleRoot, spvProof.pmt, pProveTx->GetHash()))
         return state.DoS(0, false, REJECT_INVALID, "Check Prove ReportTx spv check fail");
 
     //check input/output/sign
     MCAmount fee;
-    if (!CheckTransactionProveWithProveData(pProveTx, state, vectProveData, branchData, fee, true))
+    ProveItemChecker itemChecker(branchData);
+    PrecomputedTransactionData txdata(*pProveTx);
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckTransactionProveWithProveData(pProveTx, state, vectProveData, itemChecker, fee, true, txdata, vChecks))
         return false;
+    if (!RunScriptChecks(vChecks))
+        return state.DoS(0, false, REJECT_INVALID, "CheckProveReportTx scriptcheck fail");
 
     if (pProveTx->IsSmartContract()) {
-        BranchBlockData* pPrevBlockData = branchData.GetBranchBlockData(pBlockData->header.hashPrevBlock);
+        const BranchBlockData* pPrevBlockData = branchData.GetBranchBlockData(pBlockData->header.hashPrevBlock);
         if (!CheckProveSmartContract(tx.pProveData, pProveTx, pBlockData, pPrevBlockData)) {
             return state.DoS(0, false, REJECT_INVALID, "CheckProveSmartContract fail");
         }
@@ -1459,11 +1757,12 @@ bool CheckProveCoinbaseTx(const MCTransaction& tx, MCValidationState& state, Bra
         return state.DoS(0, false, REJECT_INVALID, "prove coinbase tx no branchid data");
     }
 
-    BranchData branchData = pBranchCache->GetBranchData(branchId);
-    if (branchData.mapHeads.count(tx.pProveData->blockHash) == 0){
+    const BranchData& branchData = pBranchCache->GetBranchDataView(branchId);
+    const BranchBlockData* pBranchBlockData = branchData.GetBranchBlockData(tx.pProveData->blockHash);
+    if (pBranchBlockData == nullptr){
         return state.DoS(0, false, REJECT_INVALID, "prove coinbase tx no block data");
     }
-    BranchBlockData& branchblockdata = branchData.mapHeads[tx.pProveData->blockHash];
+    const BranchBlockData& branchblockdata = *pBranchBlockData;
 
     std::vector<MCTransactionRef> vtx;
     MCDataStream cds(tx.pProveData->vtxData, SER_NETWORK, INIT_PROTO_VERSION);
@@ -1493,17 +1792,25 @@ bool CheckProveCoinbaseTx(const MCTransaction& tx, MCValidationState& state, Bra
     }
 
     // check tx and collect input/output, calc fees
+    // 先做spv和金额检查并收集所有签名检查，最后一起交给脚本验证线程
     MCAmount totalFee = 0;
+    ProveItemChecker itemChecker(branchData);
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(vtx.size()); // vChecks保存了txdata元素的指针，不能重新分配
+    std::vector<CScriptCheck> vChecks;
     for (int i = 2; i < vtx.size(); i++){
         const MCTransactionRef& toProveTx = vtx[i];
         const std::vector<ProveDataItem>& vectProveData = tx.pProveData->vecBlockTxProve[i - 2];
 
         MCAmount fee;
-        if (!CheckTransactionProveWithProveData(toProveTx, state, vectProveData, branchData, fee, false)) {
+        txdata.emplace_back(*toProveTx);
+        if (!CheckTransactionProveWithProveData(toProveTx, state, vectProveData, itemChecker, fee, false, txdata.back(), vChecks)) {
             return false;
         }
         totalFee += fee;
     }
+    if (!RunScriptChecks(vChecks))
+        return state.DoS(0, false, REJECT_INVALID, "CheckProveReportTx scriptcheck fail");
 
     //目前设计支链是不产生块奖励，只有收取手续费
     if (vtx[0]->GetValueOut() != totalFee){
@@ -1521,10 +1828,10 @@ bool CheckProveContractData(const MCTransaction& tx, MCValidationState& state, B
     const uint256& branchId = tx.pReportData->reportedBranchId;
     if (!pBranchCache->HasBranchData(branchId))
         return state.DoS(0, false, REJECT_INVALID, "prove coinbase tx no branchid data");
-    BranchData branchData = pBranchCache->GetBranchData(branchId);
+    const BranchData& branchData = pBranchCache->GetBranchDataView(branchId);
 
     // 先验证被举报交易及对应合约数据属于指定区块
-    BranchBlockData* pReportedBlockData = branchData.GetBranchBlockData(tx.pReportData->reportedBlockHash);
+    const BranchBlockData* pReportedBlockData = branchData.GetBranchBlockData(tx.pReportData->reportedBlockHash);
     if (pReportedBlockData == nullptr)
         return state.DoS(0, false, REJECT_INVALID, "Get branch reported block data fail");
 
@@ -1534,7 +1841,7 @@ bool CheckProveContractData(const MCTransaction& tx, MCValidationState& state, B
         return false;
 
     // 再验证替换的交易数据是否属于指定区块
-    BranchBlockData* pProveBlockData = branchData.GetBranchBlockData(tx.pReportData->contractData->proveSpvProof.blockhash);
+    const BranchBlockData* pProveBlockData = branchData.GetBranchBlockData(tx.pReportData->contractData->proveSpvProof.blockhash);
     if (pProveBlockData == nullptr)
         return state.DoS(0, false, REJECT_INVALID, "prove coinbase tx no block data");
 
@@ -1553,7 +1860,9 @@ bool CheckProveContractData(const MCTransaction& tx, MCValidationState& state, B
     for (auto& item : tx.pReportData->contractData->proveContractData) {
         auto it = tx.pReportData->contractData->reportedContractPrevData.items.find(item.first);
         if (it != tx.pReportData->contractData->reportedContractPrevData.items.end()) {
-            BranchBlockData& targetBlockData = branchData.mapHeads[it->second.blockHash];
+            static const BranchBlockData emptyBlockData;
+            const BranchBlockData* pTargetBlockData = branchData.GetBranchBlockData(it->second.blockHash);
+            const BranchBlockData& targetBlockData = pTargetBlockData ? *pTargetBlockData : emptyBlockData;
             const BranchBlockData* subAncestorBlockData = branchData.GetAncestor(pReportedBlockData, targetBlockData.nHeight);
             if (subAncestorBlockData->mBlockHash != targetBlockData.mBlockHash)
                 return true;
@@ -1631,15 +1940,17 @@ bool CheckReportRewardTransaction(const MCTransaction& tx, MCValidationState& st
     if (!pBranchCache->HasBranchData(reportbranchid))
         return false;
 
-    BranchData branchdata = pBranchCache->GetBranchData(reportbranchid);
-    if (!branchdata.mapHeads.count(reportblockhash))// best chain check? 1. no, 作弊过，但是数据在分叉上，也可以举报。带来麻烦是，矿工需要监控自己挖出来的分叉有没有监控。  
+    const BranchData& branchdata = pBranchCache->GetBranchDataView(reportbranchid);
+    const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(reportblockhash);
+    if (pBlockData == nullptr)// best chain check? 1. no, 作弊过，但是数据在分叉上，也可以举报。带来麻烦是，矿工需要监控自己挖出来的分叉有没有监控。  
         return false;
 
     // 从stake交易取出prevout(抵押币)
-    BranchBlockData blockdata = branchdata.mapHeads[reportblockhash];
+    const BranchBlockData& blockdata = *pBlockData;
     //检查举报有没有被证明
     uint256 reportFlagHash = GetReportTxHashKey(*ptxReport);
-    if (blockdata.mapReportStatus.count(reportFlagHash) == 0 || blockdata.mapReportStatus[reportFlagHash] == RP_FLAG_PROVED) {
+    auto rpit = blockdata.mapReportStatus.find(reportFlagHash);
+    if (rpit == blockdata.mapReportStatus.end() || rpit->second == RP_FLAG_PROVED) {
         return false;
     }
     
@@ -68,11 +68,15 @@ UniValue CallRPC(const std::string& host, const int port, const std::string& str
 	const std::string& strRPCUserColonPass, const std::string& rpcwallet = "");
 
 UniValue CallRPC(MCRPCConfig& rpccfg, const std::string& strMethod, const UniValue& params);
+/** 发送JSON-RPC批量请求，返回各请求的回复数组，连接、超时(nTimeout秒)或解析失败时抛出异常 */
+UniValue CallRPCBatch(MCRPCConfig& rpccfg, const UniValue& requests, int nTimeout);
 
 void ProcessBlockBranchChain();
 
 MCSpvProof* NewSpvProof(const MCBlock &block, const std::set<uint256>& txids);
 int CheckSpvProof(const uint256& merkleRoot, MCPartialMerkleTree& pmt, const uint256 &querytxhash);
+// 与CheckSpvProof相同，但不返回交易位置，验证通过的结果会被缓存
+bool CheckSpvProofWithCache(const uint256& merkleRoot, MCPartialMerkleTree& pmt, const uint256& querytxhash);
 bool CheckBranchTransaction(const MCTransaction& tx, MCValidationState &state, const bool fVerifingDB, const MCTransactionRef& pFromTx);
 
 MCAmount GetBranchChainCreateTxOut(const MCTransaction& tx);
@@ -86,9 +90,10 @@ bool GetMortgageMineData(const MCScript& scriptPubKey, uint256* pBranchHash = nu
 bool GetMortgageCoinData(const MCScript& scriptPubKey, uint256* pFromTxid = nullptr, MCKeyID *pKeyID = nullptr, int64_t *pnHeight = nullptr);
 bool GetRedeemSriptData(const MCScript& scriptPubKey, uint256* pFromTxid);
 
-bool BranchChainTransStep2(const MCTransactionRef& tx, const MCBlock &block, std::string* pStrErrorMsg);
+// fAsync为true时请求放入跨链提交队列由后台线程发送，不等待对方的回复
+bool BranchChainTransStep2(const MCTransactionRef& tx, const MCBlock &block, std::string* pStrErrorMsg, bool fAsync = false);
 
-bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlockHeader, std::string *pStrErr, bool onlySendMy = true);
+bool SendBranchBlockHeader(const std::shared_ptr<const MCBlock> pBlockHeader, std::string *pStrErr, bool onlySendMy = true, bool fAsync = false);
 bool CheckBranchBlockInfoTx(const MCTransaction& tx, MCValidationState& state, BranchCache* pBranchCache);
 bool CheckBranchDuplicateTx(const MCTransaction& tx, MCValidationState& state, BranchCache* pBranchCache);
 
@@ -102,5 +107,5 @@ bool CheckLockMortgageMineCoinTx(const MCTransaction& tx, MCValidationState& sta
 bool CheckUnlockMortgageMineCoinTx(const MCTransaction& tx, MCValidationState& state);
 bool CheckProveContractData(const MCTransaction& tx, MCValidationState& state, BranchCache *pBranchCache);
 
-bool ReqMainChainRedeemMortgage(const MCTransactionRef& tx, const MCBlock& block, std::string *pStrErr = nullptr);
+bool ReqMainChainRedeemMortgage(const MCTransactionRef& tx, const MCBlock& block, std::string *pStrErr = nullptr, bool fAsync = false);
 #endif //  BRANCHCHAIN_H
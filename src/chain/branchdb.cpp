@@ -21,6 +21,14 @@
 #include "chain/chain.h"
 #include "chain/branchchain.h"
 
+static const char DB_BRANCH_VERSION = 'V';
+static const char DB_BRANCH_INFO = 'B';     // branchid -> vecChainActive的长度
+static const char DB_BRANCH_HEAD = 'h';     // (branchid, blockhash) -> BranchBlockData
+static const char DB_BRANCH_ACTIVE = 'a';   // (branchid, height) -> blockhash
+static const char DB_BRANCH_SNAPSHOT = 's'; // (branchid, main blockhash) -> branch tip
+
+static const int BRANCH_DB_VERSION = 1;
+
 BranchDb* g_pBranchDb = nullptr;
 
 BranchCache* g_pBranchDataMemCache = nullptr;
@@ -62,13 +70,17 @@ void BranchData::InitBranchGenesisBlockData(const uint256 &branchid)
     if (mapHeads.count(genesisblock.GetHash()))
         return;
 
-    BranchBlockData& blockdata = mapHeads[genesisblock.GetHash()];
+    auto it = mapHeads.emplace(genesisblock.GetHash(), BranchBlockData()).first;
+    BranchBlockData& blockdata = it->second;
     blockdata.header = genesisblock.GetBlockHeader();
     blockdata.nHeight = 0;
     blockdata.pStakeTx = MakeTransactionRef();
     blockdata.nChainWork = GetBlockProof(genesisblock.nBits);
     //LogPrintf("bBlockData.deadstatus = %d InitBranchGenesisBlockData\n", blockdata.deadstatus);
     blockdata.deadstatus = BranchBlockData::eLive;
+    setDirtyHeads.insert(genesisblock.GetHash());
+    LinkBlock(it);
+    UpdateTipCandidate(genesisblock.GetHash());
 
     vecChainActive.push_back(blockdata.header.GetHash());
 }
@@ -76,6 +88,7 @@ void BranchData::InitBranchGenesisBlockData(const uint256 &branchid)
 void BranchData::SnapshotBlockTip(const uint256& mainBlockHash)
 {
     mapSnapshotBlockTip[mainBlockHash] = vecChainActive.back();
+    setDirtySnapshots.insert(mainBlockHash);
 
     //prune snapshot data
     if (mapSnapshotBlockTip.size() > 200)
@@ -89,6 +102,7 @@ void BranchData::SnapshotBlockTip(const uint256& mainBlockHash)
                 oldest = mit;
             }
         }
+        setDirtySnapshots.insert(oldest->first);
         mapSnapshotBlockTip.erase(oldest);
     }
 }
@@ -112,7 +126,7 @@ void BranchData::RecoverTip(const uint256& mainBlockHash)
     }
 }
 
-uint256 BranchData::TipHash(void)
+uint256 BranchData::TipHash(void) const
 {
     if (vecChainActive.size() == 0)
     {
@@ -121,29 +135,30 @@ uint256 BranchData::TipHash(void)
     return vecChainActive.back();
 }
 
-int32_t BranchData::Height(void)
+int32_t BranchData::Height(void) const
 {
     return vecChainActive.size() - 1;
 }
 
-bool BranchData::IsBlockInBestChain(const uint256& blockhash)
+bool BranchData::IsBlockInBestChain(const uint256& blockhash) const
 {
-    if (!mapHeads.count(blockhash)){
+    const BranchBlockData* pBlockData = GetBranchBlockData(blockhash);
+    if (pBlockData == nullptr){
         return false;
     }
-    uint32_t height = mapHeads[blockhash].nHeight;
+    uint32_t height = pBlockData->nHeight;
     if (height >= vecChainActive.size()){
         return false;
     }
     return vecChainActive[height] == blockhash;
 }
 
-int BranchData::GetBlockMinedHeight(const uint256& blockhash)
+int BranchData::GetBlockMinedHeight(const uint256& blockhash) const
 {
     if (!IsBlockInBestChain(blockhash)){
         return 0;
     }
-    uint32_t height = mapHeads[blockhash].nHeight;
+    uint32_t height = GetBranchBlockData(blockhash)->nHeight;
     return Height() - height;
 }
 
@@ -155,6 +170,14 @@ BranchBlockData* BranchData::GetBranchBlockData(const uint256& blockHash)
     return &(it->second);
 }
 
+const BranchBlockData* BranchData::GetBranchBlockData(const uint256& blockHash) const
+{
+    auto it = mapHeads.find(blockHash);
+    if (it == mapHeads.end())
+        return nullptr;
+    return &(it->second);
+}
+
 void BranchData::AddNewBlockData(BranchBlockData& blockdata)
 {
     const uint256 newTipHash = blockdata.header.GetHash();
@@ -163,6 +186,7 @@ void BranchData::AddNewBlockData(BranchBlockData& blockdata)
     //update parent's son hashs
     if (mapHeads.count(hashPrevBlock)) {
         mapHeads[hashPrevBlock].vecSonHashs.push_back(newTipHash);
+        setDirtyHeads.insert(hashPrevBlock);
 
         //继承hashPrevBlock的死亡属性
         if (mapHeads[hashPrevBlock].deadstatus)
@@ -170,7 +194,15 @@ void BranchData::AddNewBlockData(BranchBlockData& blockdata)
     }
 
     //add new block head data
-    mapHeads[newTipHash] = blockdata;
+    auto it = mapHeads.find(newTipHash);
+    if (it == mapHeads.end())
+        it = mapHeads.emplace(newTipHash, blockdata).first;
+    else
+        it->second = blockdata;
+    setDirtyHeads.insert(newTipHash);
+    LinkBlock(it);
+    UpdateTipCandidate(newTipHash);
+    UpdateTipCandidate(hashPrevBlock);
     if (!blockdata.deadstatus)
     {
         if (vecChainActive.back() == blockdata.header.hashPrevBlock)
@@ -209,77 +241,169 @@ void BranchData::ActivateBestChain(const uint256 &bestTipHash)
         forkHash = mapHeads[forkHash].header.hashPrevBlock;
         vecChainActive.pop_back();
     }
+    MarkActiveDirty();
     vecChainActive.insert(vecChainActive.end(), forkChain.rbegin(), forkChain.rend());
 }
 
 void BranchData::RemoveBlock(const uint256& blockhash)
 {
-    mapHeads.erase(blockhash);
+    auto it = mapHeads.find(blockhash);
+    if (it == mapHeads.end())
+        return;
+
+    // 还有子块时子孙的pprev/pskip可能指向被删除的块
+    bool fHasSon = false;
+    for (const uint256& sonhash : it->second.vecSonHashs)
+        fHasSon = fHasSon || mapHeads.count(sonhash) > 0;
+
+    const uint256 hashPrevBlock = it->second.header.hashPrevBlock;
+    setTipCandidates.erase(std::make_pair(it->second.nChainWork, blockhash));
+    mapHeads.erase(it);
+    setDirtyHeads.insert(blockhash);
+    UpdateTipCandidate(hashPrevBlock);
+    if (fHasSon)
+        BuildLinks();
 
     if (vecChainActive.back() == blockhash)
     {
         vecChainActive.pop_back();
+        MarkActiveDirty();
     }
 }
 
-const BranchBlockData* BranchData::GetAncestor(BranchBlockData* pBlock, int height)
+const BranchBlockData* BranchData::GetAncestor(const BranchBlockData* pBlock, int height) const
 {
     if (pBlock == nullptr)
         return nullptr;
 
-    int delta = pBlock->nHeight - height;
-    if (delta <= 0)
+    if (pBlock->nHeight - height <= 0)
         return pBlock;
+    if (height < 0)
+        return nullptr;
 
-    BranchBlockData* cur = pBlock;
-    for (int i = 0; i < delta; ++i) {
-        auto it = mapHeads.find(cur->header.hashPrevBlock);
-        if (it != mapHeads.end())
-            cur = &(it->second);
-        else
+    // 在active chain上的块直接按高度取
+    const uint256* phashBlock = pBlock->link.phashBlock;
+    if (phashBlock != nullptr && (size_t)pBlock->nHeight < vecChainActive.size() && vecChainActive[pBlock->nHeight] == *phashBlock)
+        return GetBranchBlockData(vecChainActive[height]);
+
+    const BranchBlockData* pWalk = pBlock;
+    while (pWalk->nHeight > height) {
+        if (!pWalk->link.fLinked) {
+            // 没有索引的块(如复制出来的数据)逐个查找
+            auto it = mapHeads.find(pWalk->header.hashPrevBlock);
+            if (it == mapHeads.end())
+                return nullptr;
+            pWalk = &(it->second);
+            continue;
+        }
+        int heightWalk = pWalk->nHeight;
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        if (pWalk->link.pskip != nullptr &&
+            (heightSkip == height ||
+             (heightSkip > height && !(heightSkipPrev < heightSkip - 2 &&
+                                       heightSkipPrev >= height)))) {
+            // Only follow pskip if pprev->pskip isn't better than pskip->pprev.
+            pWalk = pWalk->link.pskip;
+        } else if (pWalk->link.pprev != nullptr) {
+            pWalk = pWalk->link.pprev;
+        } else {
             return nullptr;
+        }
     }
 
-    return cur;
+    return pWalk;
+}
+
+void BranchData::LinkBlock(MAPBRANCH_HEADERS::iterator it)
+{
+    BranchBlockData& block = it->second;
+    block.link = BranchBlockLink();
+    block.link.phashBlock = &(it->first);
+
+    auto mi = mapHeads.find(block.header.hashPrevBlock);
+    if (mi == mapHeads.end()) {
+        block.link.fLinked = true;
+        return;
+    }
+    // 父块没有索引时不建立，GetAncestor会逐个查找
+    if (!mi->second.link.fLinked)
+        return;
+    block.link.pprev = &(mi->second);
+    block.link.pskip = const_cast<BranchBlockData*>(GetAncestor(block.link.pprev, GetSkipHeight(block.nHeight)));
+    block.link.fLinked = true;
+}
+
+void BranchData::BuildLinks()
+{
+    std::vector<MAPBRANCH_HEADERS::iterator> vBlocks;
+    vBlocks.reserve(mapHeads.size());
+    for (auto it = mapHeads.begin(); it != mapHeads.end(); ++it) {
+        it->second.link = BranchBlockLink();
+        vBlocks.push_back(it);
+    }
+    std::sort(vBlocks.begin(), vBlocks.end(), [](const MAPBRANCH_HEADERS::iterator& a, const MAPBRANCH_HEADERS::iterator& b) {
+        return a->second.nHeight < b->second.nHeight;
+    });
+    for (const auto& it : vBlocks)
+        LinkBlock(it);
 }
 
 void BranchData::UpdateDeadStatus(const uint256& blockId, bool &fStatusChange){
-    if (!mapHeads.count(blockId)){
+    auto it = mapHeads.find(blockId);
+    if (it == mapHeads.end()){
         return;//assert
     }
-    if (mapHeads[blockId].deadstatus & BranchBlockData::eDeadSelf){
+    BranchBlockData& blockdata = it->second;
+    if (blockdata.deadstatus & BranchBlockData::eDeadSelf){
         return;//alread dead
     }
-    mapHeads[blockId].deadstatus = mapHeads[blockId].deadstatus | BranchBlockData::eDeadSelf;
+    blockdata.deadstatus = blockdata.deadstatus | BranchBlockData::eDeadSelf;
+    setDirtyHeads.insert(blockId);
     fStatusChange = true;
+    UpdateTipCandidate(blockId);
+    UpdateTipCandidate(blockdata.header.hashPrevBlock);
     // dead transmit
-    for (const uint256 sonhash : mapHeads[blockId].vecSonHashs){
+    for (const uint256 sonhash : blockdata.vecSonHashs){
         DeadTransmit(sonhash);
     }
 }
 
 void BranchData::DeadTransmit(const uint256& blockId)
 {
-    mapHeads[blockId].deadstatus = mapHeads[blockId].deadstatus | BranchBlockData::eDeadInherit;
-    // 
-    if (mapHeads[blockId].deadstatus & BranchBlockData::eDeadSelf){
-        return;// 如何子block中有被举报死掉的块，它下面的应该不用递归了，没bug的话它的后代应该是dead的。
-    }
-    for (const uint256 sonhash : mapHeads[blockId].vecSonHashs) {
-        DeadTransmit(sonhash);
+    // 用栈代替递归，分支很深时递归会栈溢出
+    std::vector<uint256> vStack(1, blockId);
+    while (!vStack.empty()) {
+        const uint256 hash = vStack.back();
+        vStack.pop_back();
+        auto it = mapHeads.find(hash);
+        if (it == mapHeads.end())
+            continue;
+        BranchBlockData& blockdata = it->second;
+        blockdata.deadstatus = blockdata.deadstatus | BranchBlockData::eDeadInherit;
+        setDirtyHeads.insert(hash);
+        UpdateTipCandidate(hash);
+        if (blockdata.deadstatus & BranchBlockData::eDeadSelf){
+            continue;// 如何子block中有被举报死掉的块，它下面的应该不用递归了，没bug的话它的后代应该是dead的。
+        }
+        vStack.insert(vStack.end(), blockdata.vecSonHashs.begin(), blockdata.vecSonHashs.end());
     }
 }
 
 void BranchData::UpdateRebornStatus(const uint256& blockId, bool &fStatusChange)
 {
-    if (!mapHeads[blockId].IsDead())//all prove, is time to reborn
+    BranchBlockData& blockdata = mapHeads[blockId];
+    if (!blockdata.IsDead())//all prove, is time to reborn
     {
         //移除dead self的状态
-        mapHeads[blockId].deadstatus = mapHeads[blockId].deadstatus & (~BranchBlockData::eDeadSelf);
+        blockdata.deadstatus = blockdata.deadstatus & (~BranchBlockData::eDeadSelf);
+        setDirtyHeads.insert(blockId);
         fStatusChange = true;
+        UpdateTipCandidate(blockId);
+        UpdateTipCandidate(blockdata.header.hashPrevBlock);
     }
-    if (!mapHeads[blockId].deadstatus){
-        for (const uint256 sonhash : mapHeads[blockId].vecSonHashs) {
+    if (!blockdata.deadstatus){
+        for (const uint256 sonhash : blockdata.vecSonHashs) {
             RebornTransmit(sonhash);
         }
     }
@@ -287,14 +411,53 @@ void BranchData::UpdateRebornStatus(const uint256& blockId, bool &fStatusChange)
 
 void BranchData::RebornTransmit(const uint256& blockId)
 {
-    //移除dead inherit状态
-    mapHeads[blockId].deadstatus = mapHeads[blockId].deadstatus & (~BranchBlockData::eDeadInherit);
-    if (mapHeads[blockId].deadstatus) {
-        return;
+    std::vector<uint256> vStack(1, blockId);
+    while (!vStack.empty()) {
+        const uint256 hash = vStack.back();
+        vStack.pop_back();
+        auto it = mapHeads.find(hash);
+        if (it == mapHeads.end())
+            continue;
+        //移除dead inherit状态
+        BranchBlockData& blockdata = it->second;
+        blockdata.deadstatus = blockdata.deadstatus & (~BranchBlockData::eDeadInherit);
+        setDirtyHeads.insert(hash);
+        UpdateTipCandidate(hash);
+        UpdateTipCandidate(blockdata.header.hashPrevBlock);
+        if (blockdata.deadstatus) {
+            continue;
+        }
+        vStack.insert(vStack.end(), blockdata.vecSonHashs.begin(), blockdata.vecSonHashs.end());
     }
-    for (const uint256 sonhash : mapHeads[blockId].vecSonHashs) {
-        RebornTransmit(sonhash);
+}
+
+void BranchData::UpdateTipCandidate(const uint256& blockhash)
+{
+    auto it = mapHeads.find(blockhash);
+    if (it == mapHeads.end())
+        return;
+
+    const BranchBlockData& blockdata = it->second;
+    bool fCandidate = !blockdata.deadstatus;
+    for (const uint256& sonhash : blockdata.vecSonHashs) {
+        if (!fCandidate)
+            break;
+        auto mi = mapHeads.find(sonhash);
+        if (mi != mapHeads.end() && !mi->second.deadstatus)
+            fCandidate = false;
     }
+
+    if (fCandidate)
+        setTipCandidates.insert(std::make_pair(blockdata.nChainWork, blockhash));
+    else
+        setTipCandidates.erase(std::make_pair(blockdata.nChainWork, blockhash));
+}
+
+void BranchData::BuildTipCandidates()
+{
+    setTipCandidates.clear();
+    for (const auto& mi : mapHeads)
+        UpdateTipCandidate(mi.first);
 }
 
 uint256 BranchData::FindBestTipBlock()
@@ -302,27 +465,54 @@ uint256 BranchData::FindBestTipBlock()
     if (vecChainActive.size() <= 0)
         return uint256();
 
-    const uint256& genesisBlockId = vecChainActive[0];
-    uint256 mostworkblock = genesisBlockId;
-    FindBestBlock(genesisBlockId, mostworkblock);
-    return mostworkblock;
+    if (setTipCandidates.empty())
+        return vecChainActive[0];
+
+    // 工作量相同时与从创世块深度优先遍历的结果一致，取遍历中最先遇到的块
+    auto it = setTipCandidates.begin();
+    const arith_uint256& bestWork = it->first;
+    const uint256* pBestTip = &(it->second);
+    for (++it; it != setTipCandidates.end() && it->first == bestWork; ++it) {
+        if (IsBeforeInSearchOrder(it->second, *pBestTip))
+            pBestTip = &(it->second);
+    }
+    return *pBestTip;
 }
 
-void BranchData::FindBestBlock(const uint256& blockhash, uint256& mostworkblock)
+bool BranchData::IsBeforeInSearchOrder(const uint256& hashA, const uint256& hashB) const
 {
-    BranchBlockData& blockdata = mapHeads[blockhash];
-    if (blockdata.deadstatus)
-    {
-        return;
-    }
-    if (blockdata.nChainWork > mapHeads[mostworkblock].nChainWork)
-    {
-        mostworkblock = blockhash;
+    const BranchBlockData* pA = GetBranchBlockData(hashA);
+    const BranchBlockData* pB = GetBranchBlockData(hashB);
+    if (pA == nullptr || pB == nullptr)
+        return hashA < hashB;
+
+    // 祖先先于子孙被遍历
+    const BranchBlockData* pWalkA = GetAncestor(pA, std::min(pA->nHeight, pB->nHeight));
+    const BranchBlockData* pWalkB = GetAncestor(pB, std::min(pA->nHeight, pB->nHeight));
+    if (pWalkA == nullptr || pWalkB == nullptr)
+        return hashA < hashB;
+    if (pWalkA == pWalkB)
+        return pA->nHeight < pB->nHeight;
+
+    // 找到分叉点，按两条分支在分叉点vecSonHashs中的先后比较
+    while (pWalkA->header.hashPrevBlock != pWalkB->header.hashPrevBlock) {
+        pWalkA = GetBranchBlockData(pWalkA->header.hashPrevBlock);
+        pWalkB = GetBranchBlockData(pWalkB->header.hashPrevBlock);
+        if (pWalkA == nullptr || pWalkB == nullptr)
+            return hashA < hashB;
     }
-    for (const uint256& sonblockid : blockdata.vecSonHashs)
-    {
-        FindBestBlock(sonblockid, mostworkblock);
+    const BranchBlockData* pFork = GetBranchBlockData(pWalkA->header.hashPrevBlock);
+    if (pFork == nullptr)
+        return hashA < hashB;
+    const uint256 sonA = pWalkA->header.GetHash();
+    const uint256 sonB = pWalkB->header.GetHash();
+    for (const uint256& sonhash : pFork->vecSonHashs) {
+        if (sonhash == sonA)
+            return true;
+        if (sonhash == sonB)
+            return false;
     }
+    return hashA < hashB;
 }
 
 bool BrandchDataView::HasBranchData(const uint256& branchHash) const
@@ -341,6 +531,11 @@ BranchData BrandchDataView::GetBranchData(const uint256& branchHash)
 {
     return BranchData();
 }
+const BranchData& BrandchDataView::GetBranchDataView(const uint256& branchHash)
+{
+    static const BranchData emptyData = BranchData();
+    return emptyData;
+}
 VBRANCH_CHAIN BrandchDataView::GetActiveChain(const uint256& branchHash)
 {
     VBRANCH_CHAIN vect;
@@ -361,22 +556,22 @@ uint16_t BrandchDataView::GetTxReportState(const uint256& rpBranchId, const uint
 
 uint256 BranchDataProcesser::GetBranchTipHash(const uint256& branchid)
 {
-    if (!HasBranchData(branchid))
+    BranchData* pBranchData = FindBranchData(branchid);
+    if (pBranchData == nullptr)
     {
         return uint256();
     }
-    BranchData& branchdata = mapBranchsData[branchid];
-    return branchdata.TipHash();
+    return pBranchData->TipHash();
 }
 
 uint32_t BranchDataProcesser::GetBranchHeight(const uint256& branchid)
 {
-    if (!HasBranchData(branchid))
+    BranchData* pBranchData = FindBranchData(branchid);
+    if (pBranchData == nullptr)
     {
         return 0;
     }
-    BranchData& branchdata = mapBranchsData[branchid];
-    return branchdata.Height();
+    return pBranchData->Height();
 }
 
 bool BranchDataProcesser::HasBranchData(const uint256& branchHash) const
@@ -386,6 +581,12 @@ bool BranchDataProcesser::HasBranchData(const uint256& branchHash) const
 
 BranchData BranchDataProcesser::GetBranchData(const uint256& branchHash)
 {
+    return GetBranchDataView(branchHash);
+}
+
+const BranchData& BranchDataProcesser::GetBranchDataView(const uint256& branchHash)
+{
+    FindBranchData(branchHash);
     BranchData& branchdata = mapBranchsData[branchHash];
     branchdata.InitBranchGenesisBlockData(branchHash);
     return branchdata;
@@ -393,37 +594,39 @@ BranchData BranchDataProcesser::GetBranchData(const uint256& branchHash)
 
 VBRANCH_CHAIN BranchDataProcesser::GetActiveChain(const uint256& branchHash)
 {
-    if (!HasBranchData(branchHash))
+    BranchData* pBranchData = FindBranchData(branchHash);
+    if (pBranchData == nullptr)
     {
         VBRANCH_CHAIN vect;
         return vect;
     }
-    return mapBranchsData[branchHash].vecChainActive;
+    return pBranchData->vecChainActive;
 }
 
 bool BranchDataProcesser::IsBlockInActiveChain(const uint256& branchHash, const uint256& blockHash)
 {
-    if (!HasBranchData(branchHash))
+    BranchData* pBranchData = FindBranchData(branchHash);
+    if (pBranchData == nullptr)
         return false;
 
-    BranchData& branchdata = mapBranchsData[branchHash];
-    return branchdata.IsBlockInBestChain(blockHash);
+    return pBranchData->IsBlockInBestChain(blockHash);
 }
 
 int BranchDataProcesser::GetBranchBlockMinedHeight(const uint256& branchHash, const uint256& blockHash)
 {
-    if (!HasBranchData(branchHash))
+    BranchData* pBranchData = FindBranchData(branchHash);
+    if (pBranchData == nullptr)
         return 0;
 
-    BranchData& branchdata = mapBranchsData[branchHash];
-    return branchdata.GetBlockMinedHeight(blockHash);
+    return pBranchData->GetBlockMinedHeight(blockHash);
 }
 uint16_t BranchDataProcesser::GetTxReportState(const uint256& rpBranchId, const uint256& rpBlockId, const uint256& flagHash)
 {
-    if (!HasBranchData(rpBranchId))
+    BranchData* pBranchData = FindBranchData(rpBranchId);
+    if (pBranchData == nullptr)
         return RP_INVALID;
 
-    BranchData& branchdata = mapBranchsData[rpBranchId];
+    BranchData& branchdata = *pBranchData;
     if (branchdata.mapHeads.count(rpBlockId) == 0)
         return RP_INVALID;
 
@@ -526,6 +729,7 @@ void BranchDataProcesser::AddBlockInfoTxData(MCTransactionRef &transaction, cons
     //bBlockData.deadstatus = BranchBlockData::eLive;
 
     uint256 branchHash = transaction->pBranchBlockData->branchID;
+    FindBranchData(branchHash);
     BranchData& bData = mapBranchsData[branchHash];
     bData.InitBranchGenesisBlockData(branchHash);
 
@@ -549,6 +753,7 @@ void BranchDataProcesser::DelBlockInfoTxData(MCTransactionRef &transaction, cons
 
     uint256 bBlockHash = bBlockData.header.GetHash();
     uint256 branchHash = transaction->pBranchBlockData->branchID;
+    FindBranchData(branchHash);
     BranchData& bData = mapBranchsData[branchHash];
 
     bData.RemoveBlock(bBlockHash);
@@ -563,10 +768,11 @@ bool BranchDataProcesser::AddReportTxData(MCTransactionRef &tx, std::set<uint256
     //-----------
     const uint256& rpBranchId = tx->pReportData->reportedBranchId;
     const uint256& rpBlockId = tx->pReportData->reportedBlockHash;
-    if (mapBranchsData.count(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
+    if (FindBranchData(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
         BranchData& branchdata = mapBranchsData[rpBranchId];
         if (branchdata.mapHeads.count(rpBlockId)) {
             branchdata.mapHeads[rpBlockId].mapReportStatus[reportFlagHash] = RP_FLAG_REPORTED;
+            branchdata.setDirtyHeads.insert(rpBlockId);
             //update dead status, dead transmit
             bool deadchanged = false;
             branchdata.UpdateDeadStatus(rpBlockId, deadchanged);
@@ -588,11 +794,12 @@ bool BranchDataProcesser::AddProveTxData(MCTransactionRef &tx, std::set<uint256>
     //-----------
     const uint256& rpBranchId = tx->pProveData->branchId;
     const uint256& rpBlockId = tx->pProveData->blockHash;
-    if (mapBranchsData.count(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
+    if (FindBranchData(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
         BranchData& branchdata = mapBranchsData[rpBranchId];
         if (branchdata.mapHeads.count(rpBlockId)) {
             //assert branchdata.mapHeads[rpBlockId].mapReportStatus[proveFlagHash] == RP_FLAG_REPORTED
             branchdata.mapHeads[rpBlockId].mapReportStatus[proveFlagHash] = RP_FLAG_PROVED;
+            branchdata.setDirtyHeads.insert(rpBlockId);
             //update dead status, reborn transmit
             bool deadchanged = false;
             branchdata.UpdateRebornStatus(rpBlockId, deadchanged);
@@ -614,10 +821,11 @@ bool BranchDataProcesser::DelReportTxData(MCTransactionRef &tx, std::set<uint256
     //-----------
     const uint256& rpBranchId = tx->pReportData->reportedBranchId;
     const uint256& rpBlockId = tx->pReportData->reportedBlockHash;
-    if (mapBranchsData.count(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
+    if (FindBranchData(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
         BranchData& branchdata = mapBranchsData[rpBranchId];
         if (branchdata.mapHeads.count(rpBlockId)) {
             branchdata.mapHeads[rpBlockId].mapReportStatus.erase(reportFlagHash);
+            branchdata.setDirtyHeads.insert(rpBlockId);
             //update dead status, 检查是否可以移除死亡状态
             bool deadchanged = false;
             branchdata.UpdateRebornStatus(rpBlockId, deadchanged);
@@ -642,10 +850,11 @@ bool BranchDataProcesser::DelProveTxData(MCTransactionRef &tx, std::set<uint256>
     //-----------
     const uint256& rpBranchId = tx->pProveData->branchId;
     const uint256& rpBlockId = tx->pProveData->blockHash;
-    if (mapBranchsData.count(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
+    if (FindBranchData(rpBranchId)) {// ok, we must assert(mapBranchsData.count(rpBranchId));
         BranchData& branchdata = mapBranchsData[rpBranchId];
         if (branchdata.mapHeads.count(rpBlockId)) {
             branchdata.mapHeads[rpBlockId].mapReportStatus[proveFlagHash] = RP_FLAG_REPORTED;
+            branchdata.setDirtyHeads.insert(rpBlockId);
             //update dead status, 检查是否需要reborn to dead.
             bool deadchanged = false;
             branchdata.UpdateDeadStatus(rpBlockId, deadchanged);
@@ -670,6 +879,14 @@ bool BranchDataProcesser::WriteModifyToDB(const std::set<uint256>& modifyBranch)
     return true;
 }
 
+BranchData* BranchDataProcesser::FindBranchData(const uint256& branchId)
+{
+    auto it = mapBranchsData.find(branchId);
+    if (it == mapBranchsData.end())
+        return nullptr;
+    return &(it->second);
+}
+
 bool BranchCache::HasInCache(const MCTransaction& tx)
 {
     if (tx.IsSyncBranchInfo())
@@ -756,6 +973,11 @@ bool BranchCache::HasBranchData(const uint256& branchHash) const
 }
 
 BranchData BranchCache::GetBranchData(const uint256& branchHash)
+{
+    return GetBranchDataView(branchHash);
+}
+
+const BranchData& BranchCache::GetBranchDataView(const uint256& branchHash)
 {
     // try get local data
     if (mapBranchsData.count(branchHash))
@@ -765,7 +987,7 @@ BranchData BranchCache::GetBranchData(const uint256& branchHash)
     // try get db data
     if (readonly_db && readonly_db->HasBranchData(branchHash))
     {
-        return readonly_db->GetBranchData(branchHash);
+        return readonly_db->GetBranchDataView(branchHash);
     }
 
     BranchData& branchdata = mapBranchsData[branchHash];
@@ -887,14 +1109,13 @@ std::vector<uint256> BranchCache::GetAncestorsBlocksHash(const MCTransaction& tx
     //uint256 blockHash = blockData.header.GetHash();
     const uint256& branchHash = tx.pBranchBlockData->branchID;
 
-    bool bgotdata = FetchDataFromSource(branchHash);
-    
+    // 只有本地(内存池)的块才需要返回，不用复制readonly_db的数据
     if (mapBranchsData.count(branchHash))
     {
-        std::shared_ptr<BranchData> pReadOnlyDbData = nullptr;
+        const BranchData* pReadOnlyDbData = nullptr;
         if (readonly_db && readonly_db->HasBranchData(branchHash))
         {
-            pReadOnlyDbData = std::make_shared<BranchData>(readonly_db->GetBranchData(branchHash));
+            pReadOnlyDbData = &readonly_db->GetBranchDataView(branchHash);
         }
 
         BranchData& branchdata = mapBranchsData[branchHash];
@@ -915,7 +1136,7 @@ std::vector<uint256> BranchCache::GetAncestorsBlocksHash(const MCTransaction& tx
 
 const BranchBlockData* BranchCache::GetBranchBlockData(const uint256 &branchhash, const uint256 &blockhash)
 {
-    bool bgotdata = FetchDataFromSource(branchhash);
+    // 只找本地加入的块，readonly_db的数据由调用者自己查
     if (mapBranchsData.count(branchhash)){
         if (mapBranchsData[branchhash].mapHeads.count(blockhash)){
             if (mapBranchsData[branchhash].mapHeads[blockhash].flags == BranchBlockData::eADD)
@@ -997,6 +1218,9 @@ bool BranchCache::DelProveTxData(MCTransactionRef &tx, std::set<uint256> &broken
 BranchDb::BranchDb(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
     : db(path, nCacheSize, fMemory, fWipe, true)
 {
+    int nVersion = 0;
+    if (!db.Read(DB_BRANCH_VERSION, nVersion))
+        UpgradeOldFormat();
 }
 
 void BranchDb::LoadData()
@@ -1006,20 +1230,127 @@ void BranchDb::LoadData()
         //LogPrintf("===== 2-branch db load data: %s \n", Params().GetBranchId());  
         return;
     }
+    // 启动时加载全部支链，之后的读取路径(包括不持有cs_main的rpc)不会修改mapBranchsData
+    std::vector<uint256> vBranchIds;
+    std::unique_ptr<MCDBIterator> it(db.NewIterator());
+    for (it->Seek(std::make_pair(DB_BRANCH_INFO, uint256())); it->Valid(); it->Next()) {
+        std::pair<char, uint256> key;
+        if (!it->GetKey(key) || key.first != DB_BRANCH_INFO)
+            break;
+        if (!mapBranchsData.count(key.second))
+            vBranchIds.push_back(key.second);
+    }
+    it.reset();
+
+    for (const uint256& branchId : vBranchIds) {
+        if (!ReadBranchData(branchId, mapBranchsData[branchId]))
+            LogPrintf("%s: read branch %s data fail\n", __func__, branchId.GetHex());
+    }
+}
+
+// 旧格式每条支链整个BranchData是一条记录，key是branchid。没有版本记录的db是旧格式或新建的
+void BranchDb::UpgradeOldFormat()
+{
+    std::vector<uint256> vOldKeys;
     std::unique_ptr<MCDBIterator> it(db.NewIterator());
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
         uint256 keyHash;
-
-        if (it->GetKey(keyHash))
+        BranchData data;
+        if (it->GetKey(keyHash) && it->GetValue(data))
         {
-            BranchData data;
-            if (it->GetValue(data))
-            {
-                mapBranchsData[keyHash] = data;
-                //LogPrintf("===== 3-branch db load data: %s \n", branchHash.GetHex());
-            }
+            vOldKeys.push_back(keyHash);
+            for (const auto& mi : data.mapHeads)
+                data.setDirtyHeads.insert(mi.first);
+            for (const auto& mi : data.mapSnapshotBlockTip)
+                data.setDirtySnapshots.insert(mi.first);
+            BranchData& bData = mapBranchsData[keyHash];
+            bData = data;
+            bData.BuildLinks();
+            bData.BuildTipCandidates();
         }
     }
+    it.reset();
+
+    MCDBBatch batch(db);
+    for (const uint256& branchId : vOldKeys)
+    {
+        batch.Erase(branchId);
+        WriteBranchData(batch, branchId, mapBranchsData[branchId]);
+    }
+    batch.Write(DB_BRANCH_VERSION, BRANCH_DB_VERSION);
+    db.WriteBatch(batch, true);
+    if (!vOldKeys.empty())
+        LogPrintf("%s: upgraded %u branches\n", __func__, vOldKeys.size());
+}
+
+bool BranchDb::ReadBranchData(const uint256& branchId, BranchData& bData)
+{
+    uint32_t nActiveSize = 0;
+    if (!db.Read(std::make_pair(DB_BRANCH_INFO, branchId), nActiveSize))
+        return false;
+
+    std::unique_ptr<MCDBIterator> it(db.NewIterator());
+    for (it->Seek(std::make_pair(DB_BRANCH_HEAD, std::make_pair(branchId, uint256()))); it->Valid(); it->Next()) {
+        std::pair<char, std::pair<uint256, uint256>> key;
+        if (!it->GetKey(key) || key.first != DB_BRANCH_HEAD || key.second.first != branchId)
+            break;
+        if (!it->GetValue(bData.mapHeads[key.second.second]))
+            return false;
+    }
+
+    for (it->Seek(std::make_pair(DB_BRANCH_SNAPSHOT, std::make_pair(branchId, uint256()))); it->Valid(); it->Next()) {
+        std::pair<char, std::pair<uint256, uint256>> key;
+        if (!it->GetKey(key) || key.first != DB_BRANCH_SNAPSHOT || key.second.first != branchId)
+            break;
+        if (!it->GetValue(bData.mapSnapshotBlockTip[key.second.second]))
+            return false;
+    }
+
+    bData.vecChainActive.resize(nActiveSize);
+    for (uint32_t i = 0; i < nActiveSize; ++i) {
+        if (!db.Read(std::make_pair(DB_BRANCH_ACTIVE, std::make_pair(branchId, i)), bData.vecChainActive[i]))
+            return false;
+    }
+    bData.nActiveDbSize = nActiveSize;
+    bData.nActiveDirtyHeight = nActiveSize;
+    bData.BuildLinks();
+    bData.BuildTipCandidates();
+    return true;
+}
+
+void BranchDb::WriteBranchData(MCDBBatch& batch, const uint256& branchId, BranchData& bData)
+{
+    for (const uint256& blockHash : bData.setDirtyHeads)
+    {
+        const auto key = std::make_pair(DB_BRANCH_HEAD, std::make_pair(branchId, blockHash));
+        auto mi = bData.mapHeads.find(blockHash);
+        if (mi != bData.mapHeads.end())
+            batch.Write(key, mi->second);
+        else
+            batch.Erase(key);
+    }
+    for (const uint256& mainBlockHash : bData.setDirtySnapshots)
+    {
+        const auto key = std::make_pair(DB_BRANCH_SNAPSHOT, std::make_pair(branchId, mainBlockHash));
+        auto mi = bData.mapSnapshotBlockTip.find(mainBlockHash);
+        if (mi != bData.mapSnapshotBlockTip.end())
+            batch.Write(key, mi->second);
+        else
+            batch.Erase(key);
+    }
+
+    const uint32_t nActiveSize = bData.vecChainActive.size();
+    for (uint32_t i = bData.nActiveDirtyHeight; i < nActiveSize; ++i)
+        batch.Write(std::make_pair(DB_BRANCH_ACTIVE, std::make_pair(branchId, i)), bData.vecChainActive[i]);
+    for (uint32_t i = nActiveSize; i < bData.nActiveDbSize; ++i)
+        batch.Erase(std::make_pair(DB_BRANCH_ACTIVE, std::make_pair(branchId, i)));
+    if (bData.nActiveDbSize != nActiveSize || bData.nActiveDirtyHeight < nActiveSize)
+        batch.Write(std::make_pair(DB_BRANCH_INFO, branchId), nActiveSize);
+
+    bData.setDirtyHeads.clear();
+    bData.setDirtySnapshots.clear();
+    bData.nActiveDbSize = nActiveSize;
+    bData.nActiveDirtyHeight = nActiveSize;
 }
 
 bool BranchDb::WriteModifyToDB(const std::set<uint256>& modifyBranch)
@@ -1027,8 +1358,9 @@ bool BranchDb::WriteModifyToDB(const std::set<uint256>& modifyBranch)
     MCDBBatch batch(db);
     for (const uint256& branchHash : modifyBranch)
     {
-        BranchData& bData = mapBranchsData[branchHash];
-        batch.Write(branchHash, bData);
+        BranchData* pBranchData = FindBranchData(branchHash);
+        if (pBranchData != nullptr)
+            WriteBranchData(batch, branchHash, *pBranchData);
     }
     bool retdb = db.WriteBatch(batch);
     return retdb;
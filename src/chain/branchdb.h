@@ -8,7 +8,9 @@
 #include "chain.h"
 #include "io/dbwrapper.h"
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -18,6 +20,28 @@ const uint16_t RP_INVALID = 0;
 const uint16_t RP_FLAG_REPORTED = 1;//被举报了
 const uint16_t RP_FLAG_PROVED = 2;//已证明
 
+class BranchBlockData;
+
+// memory only, 块在所属mapHeads内的索引(参考MCBlockIndex的pprev/pskip)。
+// 指针只在同一个mapHeads内有效，所以复制时清空
+struct BranchBlockLink
+{
+    bool fLinked = false;
+    BranchBlockData* pprev = nullptr;
+    BranchBlockData* pskip = nullptr;
+    const uint256* phashBlock = nullptr;
+
+    BranchBlockLink() {}
+    BranchBlockLink(const BranchBlockLink&) {}
+    BranchBlockLink& operator=(const BranchBlockLink&)
+    {
+        fLinked = false;
+        pprev = pskip = nullptr;
+        phashBlock = nullptr;
+        return *this;
+    }
+};
+
 class BranchBlockData
 {
 public:
@@ -73,11 +97,24 @@ public:
         //eOriginal,
     };
     unsigned char flags; // memory only
+    BranchBlockLink link;
 };
 
 typedef std::vector<uint256> VBRANCH_CHAIN;
 typedef std::map<uint256, BranchBlockData> MAPBRANCH_HEADERS;
 typedef std::map<uint256, uint256> MAP_MAINBLOCK_BRANCHTIP;
+
+// 工作量大的在前，工作量相同时按hash排序(只为集合有序，选tip时另按遍历顺序比较)
+struct BranchTipWorkComparator
+{
+    bool operator()(const std::pair<arith_uint256, uint256>& a, const std::pair<arith_uint256, uint256>& b) const
+    {
+        if (a.first != b.first)
+            return a.first > b.first;
+        return a.second < b.second;
+    }
+};
+typedef std::set<std::pair<arith_uint256, uint256>, BranchTipWorkComparator> SET_BRANCH_TIP_CANDIDATES;
 //
 class BranchData
 {
@@ -87,11 +124,16 @@ public:
     MAP_MAINBLOCK_BRANCHTIP mapSnapshotBlockTip; // record connected main block, each branch tip
 
     BranchBlockData* GetBranchBlockData(const uint256& blockHash);
+    const BranchBlockData* GetBranchBlockData(const uint256& blockHash) const;
     void AddNewBlockData(BranchBlockData& blockdata);
     void ActivateBestChain(const uint256 &bestTipHash);
     void RemoveBlock(const uint256& blockhash);
 
-    const BranchBlockData* GetAncestor(BranchBlockData* pBlock, int height);
+    const BranchBlockData* GetAncestor(const BranchBlockData* pBlock, int height) const;
+    // 重建全部块的pprev/pskip，从db加载后调用
+    void BuildLinks();
+    // 重建setTipCandidates，从db加载后调用
+    void BuildTipCandidates();
 
     //
     void UpdateDeadStatus(const uint256& blockId, bool &fStatusChange);
@@ -116,10 +158,10 @@ public:
     void SnapshotBlockTip(const uint256& mainBlockHash);
     void RecoverTip(const uint256& mainBlockHash);
 
-    uint256 TipHash(void);
-    int32_t Height(void);
-    bool IsBlockInBestChain(const uint256& blockhash);
-    int GetBlockMinedHeight(const uint256& blockhash);
+    uint256 TipHash(void) const;
+    int32_t Height(void) const;
+    bool IsBlockInBestChain(const uint256& blockhash) const;
+    int GetBlockMinedHeight(const uint256& blockhash) const;
 
     enum {
         eADD,
@@ -128,8 +170,21 @@ public:
         eOriginal,
     };
     unsigned char flags; // memory only, cache data use it
+
+    // memory only, 自上次写db后修改过的数据，BranchDb只写这些记录
+    std::set<uint256> setDirtyHeads;        // 修改或删除过的块
+    std::set<uint256> setDirtySnapshots;    // 修改或删除过的快照
+    size_t nActiveDirtyHeight = 0;          // vecChainActive从该高度起有修改
+    size_t nActiveDbSize = 0;               // db中vecChainActive的长度
+
+    // memory only, 没有活着的子块的活块(类似setBlockIndexCandidates)，FindBestTipBlock从这里取
+    SET_BRANCH_TIP_CANDIDATES setTipCandidates;
 private:
-    void FindBestBlock(const uint256& blockhash, uint256& mostworkblock);
+    void UpdateTipCandidate(const uint256& blockhash);
+    // hashA在从创世块按vecSonHashs深度优先遍历时是否先于hashB被访问
+    bool IsBeforeInSearchOrder(const uint256& hashA, const uint256& hashB) const;
+    void LinkBlock(MAPBRANCH_HEADERS::iterator it);
+    void MarkActiveDirty() { nActiveDirtyHeight = std::min(nActiveDirtyHeight, vecChainActive.size()); }
 };
 
 typedef std::map<uint256, BranchData> MAPBRANCHS_DATA;
@@ -143,6 +198,9 @@ public:
     virtual uint256 GetBranchTipHash(const uint256& branchid);
     virtual uint32_t GetBranchHeight(const uint256& branchid);
     virtual BranchData GetBranchData(const uint256& branchHash);
+    // 只读访问，不复制数据。返回的引用指向数据源内部的BranchData，连接或断开块时会被修改，
+    // 调用者须持有cs_main直到不再使用该引用；不持有cs_main的路径使用GetBranchData取得副本
+    virtual const BranchData& GetBranchDataView(const uint256& branchHash);
     virtual VBRANCH_CHAIN GetActiveChain(const uint256& branchHash);
     virtual bool IsBlockInActiveChain(const uint256& branchHash, const uint256& blockHash);
     virtual int GetBranchBlockMinedHeight(const uint256& branchHash, const uint256& blockHash);
@@ -159,6 +217,7 @@ public:
     uint32_t GetBranchHeight(const uint256& branchid) override;
     bool HasBranchData(const uint256& branchHash) const override;
     BranchData GetBranchData(const uint256& branchHash) override;
+    const BranchData& GetBranchDataView(const uint256& branchHash) override;
     VBRANCH_CHAIN GetActiveChain(const uint256& branchHash) override;
     bool IsBlockInActiveChain(const uint256& branchHash, const uint256& blockHash) override;
     int GetBranchBlockMinedHeight(const uint256& branchHash, const uint256& blockHash) override;
@@ -179,6 +238,8 @@ protected:
     virtual bool DelProveTxData(MCTransactionRef &tx, std::set<uint256> &brokenChainBranch, std::set<uint256> &modifyBranch);
 
     virtual bool WriteModifyToDB(const std::set<uint256>& modifyBranch);
+    // 取已有的支链数据，不存在时返回nullptr
+    BranchData* FindBranchData(const uint256& branchId);
 protected:
     MAPBRANCHS_DATA mapBranchsData;
 };
@@ -186,6 +247,7 @@ protected:
 // 1、内存池的记录 2、verifydb时的那种临时db
 // 缓存操作 临时操作 当失败时可以直接丢弃 而不污染数据源
 // 优先从本地class取数据，在本地取不到的情况下再向readonly_db取
+// 读操作直接使用readonly_db的数据，只有修改支链数据时才复制到本地(copy on write)
 class BranchCache : public BranchDataProcesser
 {
 public:
@@ -213,6 +275,7 @@ public:
     uint32_t GetBranchHeight(const uint256& branchid) override;
     bool HasBranchData(const uint256& branchHash) const override;
     BranchData GetBranchData(const uint256& branchHash) override;
+    const BranchData& GetBranchDataView(const uint256& branchHash) override;
     bool IsBlockInActiveChain(const uint256& branchHash, const uint256& blockHash) override;
     int GetBranchBlockMinedHeight(const uint256& branchHash, const uint256& blockHash) override;
 
@@ -235,6 +298,8 @@ private:
 /*
  1、保证每个BranchData的mapHeads的BranchBlockData的preblock数据是存在的。
     也就是每个数据都有完整的到达创世块的链路径
+ 2、每个支链块头、active chain的每个高度、每个主链块的tip快照都是单独的记录，
+    写db时只写修改过的记录。启动时一次加载全部支链数据。
  */
 // 持久化
 class BranchDb : public BranchDataProcesser
@@ -270,6 +335,11 @@ protected:
     bool WriteModifyToDB(const std::set<uint256>& modifyBranch) override;
 protected:
     MCDBWrapper db;
+
+private:
+    bool ReadBranchData(const uint256& branchId, BranchData& bData);
+    void WriteBranchData(MCDBBatch& batch, const uint256& branchId, BranchData& bData);
+    void UpgradeOldFormat();
 };
 
 extern BranchDb* g_pBranchDb;
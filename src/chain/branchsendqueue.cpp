@@ -0,0 +1,290 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "chain/branchsendqueue.h"
+
+#include "chain/branchchain.h"
+#include "rpc/protocol.h"
+#include "utils/util.h"
+#include "utils/utiltime.h"
+
+#include <univalue.h>
+
+#include <boost/thread.hpp>
+
+std::unique_ptr<BranchSendQueue> g_branchSendQueue;
+
+// 对方已经有这个请求的数据(重复提交、已在内存池或已上链)，重发的结果也一样，视为发送成功
+static bool IsAlreadyKnown(const std::string& strErr)
+{
+    static const char* const pszKnown[] = {
+        "txn-already-in-mempool",
+        "txn-already-known",
+        "txn-already-in-records",
+        "already in block chain",
+        "branch block info duplicate",
+        "duplicate report in",
+        "duplicate prove in",
+    };
+    for (const char* psz : pszKnown) {
+        if (strErr.find(psz) != std::string::npos)
+            return true;
+    }
+    return false;
+}
+
+// 与同步调用时各函数对返回值的检查一致
+static bool CheckSendReply(const std::string& strMethod, const UniValue& reply, std::string& strErr)
+{
+    const UniValue& result = find_value(reply, "result");
+    const UniValue& errorVal = find_value(reply, "error");
+    if (!errorVal.isNull()) {
+        strErr = errorVal.write();
+        return IsAlreadyKnown(strErr);
+    }
+    if (result.isNull()) {
+        strErr = "result is null";
+        return false;
+    }
+    if (strMethod == "makebranchtransaction" && (!result.isStr() || result.get_str() != "ok")) {
+        strErr = "not return ok";
+        return false;
+    }
+    if (result.isObject()) {
+        const UniValue& commitreject = find_value(result, "commit_reject_reason");
+        if (!commitreject.isNull()) {
+            strErr = commitreject.write();
+            return IsAlreadyKnown(strErr);
+        }
+    }
+    return true;
+}
+
+// 支链区块信息需要按高度顺序提交，被拒绝时不能让后面的区块信息先发送
+static bool IsOrderedMethod(const std::string& strMethod)
+{
+    return strMethod == "submitbranchblockinfo";
+}
+
+static int64_t GetRetryInterval(int nFailures)
+{
+    return std::min<int64_t>(int64_t(1) << std::min(nFailures, 16), BranchSendQueue::MAX_RETRY_INTERVAL);
+}
+
+BranchSendQueue::BranchSendQueue(const fs::path& path, size_t nCacheSize) : db(path, nCacheSize)
+{
+    std::unique_ptr<MCDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_BRANCH_SEND_ITEM, uint64_t(0)));
+    while (pcursor->Valid()) {
+        std::pair<char, uint64_t> key;
+        if (!pcursor->GetKey(key) || key.first != DB_BRANCH_SEND_ITEM)
+            break;
+        BranchSendItem item;
+        if (pcursor->GetValue(item)) {
+            nNextSeq = std::max(nNextSeq, item.nSeq + 1);
+            mapItems[item.nSeq] = item;
+        }
+        pcursor->Next();
+    }
+    if (!mapItems.empty())
+        LogPrintf("%s: %u branch chain requests pending\n", __func__, mapItems.size());
+}
+
+void BranchSendQueue::Push(const std::string& strChainId, const std::string& strMethod, const UniValue& params)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        BranchSendItem item;
+        item.nSeq = nNextSeq++;
+        item.strChainId = strChainId;
+        item.strMethod = strMethod;
+        item.strParams = params.write();
+        item.nTimeAdded = GetTimeMillis();
+        // 在区块处理线程上不fsync：进程退出时leveldb日志已在系统缓存中，
+        // 只有系统掉电会丢失最近的几条，后台线程下一次同步写入时会一起落盘
+        db.Write(std::make_pair(DB_BRANCH_SEND_ITEM, item.nSeq), item, false);
+        mapItems[item.nSeq] = item;
+    }
+    cond.notify_one();
+}
+
+UniValue BranchSendQueue::GetInfo()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    UniValue chains(UniValue::VOBJ);
+    std::map<std::string, int> mapCount;
+    int64_t nOldest = 0;
+    for (const auto& item : mapItems) {
+        ++mapCount[item.second.strChainId];
+        if (nOldest == 0 || item.second.nTimeAdded < nOldest)
+            nOldest = item.second.nTimeAdded;
+    }
+    for (const auto& item : mapCount)
+        chains.push_back(Pair(item.first, item.second));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size", (uint64_t)mapItems.size()));
+    ret.push_back(Pair("chains", chains));
+    ret.push_back(Pair("oldest", nOldest == 0 ? 0 : (GetTimeMillis() - nOldest) / 1000));
+    ret.push_back(Pair("sent", nSent));
+    ret.push_back(Pair("failed", nFailed));
+    ret.push_back(Pair("dropped", nDropped));
+    ret.push_back(Pair("lastlatency", nLastLatency));
+    ret.push_back(Pair("avglatency", nSent == 0 ? 0 : nTotalLatency / (int64_t)nSent));
+    return ret;
+}
+
+void BranchSendQueue::Run()
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        std::map<std::string, std::vector<BranchSendItem>> mapBatches;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            const int64_t nNow = GetTime();
+            int64_t nWake = CollectBatches(nNow, mapBatches);
+            if (mapBatches.empty()) {
+                cond.timed_wait(lock, boost::posix_time::seconds(nWake - nNow));
+                continue;
+            }
+        }
+
+        // 每批之间检查中断，关闭时最多等待当前这一批的BRANCH_SEND_TIMEOUT
+        for (const auto& item : mapBatches) {
+            boost::this_thread::interruption_point();
+            SendBatch(item.first, item.second);
+        }
+    }
+}
+
+int64_t BranchSendQueue::CollectBatches(int64_t nNow, std::map<std::string, std::vector<BranchSendItem>>& mapBatches)
+{
+    int64_t nWake = nNow + MAX_RETRY_INTERVAL;
+    std::set<std::string> setBlocked;
+    std::set<std::string> setOrderBlocked;     // 有区块信息在退避的链，后面的区块信息等它先发送
+    for (const auto& item : mapItems) {
+        const BranchSendItem& entry = item.second;
+        if (setBlocked.count(entry.strChainId))
+            continue;
+        const bool fOrdered = IsOrderedMethod(entry.strMethod);
+        if (fOrdered && setOrderBlocked.count(entry.strChainId))
+            continue;
+        // 整条链在退避或本批已满时，该链后面的请求都不发送，保持入队顺序
+        int64_t nChainNext = mapChainNextTry[entry.strChainId];
+        std::vector<BranchSendItem>& batch = mapBatches[entry.strChainId];
+        if (nChainNext > nNow || batch.size() >= MAX_BATCH_SIZE) {
+            setBlocked.insert(entry.strChainId);
+            nWake = std::min(nWake, std::max(nChainNext, nNow + 1));
+            continue;
+        }
+        // 被对方拒绝过的请求单独退避，不阻塞同一条链后面的其他请求
+        if (entry.nNextTry > nNow) {
+            nWake = std::min(nWake, entry.nNextTry);
+            if (fOrdered)
+                setOrderBlocked.insert(entry.strChainId);
+            continue;
+        }
+        batch.push_back(entry);
+    }
+    for (auto it = mapBatches.begin(); it != mapBatches.end();) {
+        if (it->second.empty())
+            it = mapBatches.erase(it);
+        else
+            ++it;
+    }
+    return nWake;
+}
+
+void BranchSendQueue::SendBatch(const std::string& strChainId, const std::vector<BranchSendItem>& vItems)
+{
+    UniValue requests(UniValue::VARR);
+    for (const BranchSendItem& item : vItems) {
+        UniValue params(UniValue::VARR);
+        params.read(item.strParams);
+        requests.push_back(JSONRPCRequestObj(item.strMethod, params, UniValue(item.nSeq)));
+    }
+
+    UniValue replies;
+    try {
+        MCRPCConfig rpccfg;
+        if (!g_branchChainMan->GetRpcConfig(strChainId, rpccfg) || !rpccfg.IsValid())
+            throw std::runtime_error("can not found rpc config");
+        replies = CallRPCBatch(rpccfg, requests, BRANCH_SEND_TIMEOUT);
+    }
+    catch (const std::exception& e) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        int nFailures = ++mapChainFailures[strChainId];
+        mapChainNextTry[strChainId] = GetTime() + GetRetryInterval(nFailures);
+        LogPrint(BCLog::BRANCH, "%s: send %u requests to %s fail(%d): %s\n", __func__, vItems.size(), strChainId, nFailures, e.what());
+        return;
+    }
+
+    ProcessReplies(strChainId, vItems, replies);
+}
+
+void BranchSendQueue::ProcessReplies(const std::string& strChainId, const std::vector<BranchSendItem>& vItems, const UniValue& replies)
+{
+    std::map<uint64_t, UniValue> mapReplies;
+    for (size_t i = 0; i < replies.size(); ++i) {
+        const UniValue& id = find_value(replies[i], "id");
+        if (id.isNum())
+            mapReplies[id.get_int64()] = replies[i];
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    mapChainFailures.erase(strChainId);
+    mapChainNextTry.erase(strChainId);
+
+    const int64_t nNow = GetTime();
+    const int64_t nNowMillis = GetTimeMillis();
+    MCDBBatch batch(db);
+    for (const BranchSendItem& sent : vItems) {
+        auto mi = mapItems.find(sent.nSeq);
+        if (mi == mapItems.end())
+            continue;
+        BranchSendItem& item = mi->second;
+        const auto key = std::make_pair(DB_BRANCH_SEND_ITEM, item.nSeq);
+
+        std::string strErr = "no reply";
+        auto ri = mapReplies.find(item.nSeq);
+        if (ri != mapReplies.end() && CheckSendReply(item.strMethod, ri->second, strErr)) {
+            ++nSent;
+            nLastLatency = nNowMillis - item.nTimeAdded;
+            nTotalLatency += nLastLatency;
+            batch.Erase(key);
+            mapItems.erase(mi);
+            continue;
+        }
+
+        ++nFailed;
+        if (++item.nTries >= MAX_TRIES) {
+            ++nDropped;
+            LogPrintf("%s: drop %s to %s after %d tries: %s\n", __func__, item.strMethod, strChainId, item.nTries, strErr);
+            batch.Erase(key);
+            mapItems.erase(mi);
+            continue;
+        }
+        LogPrint(BCLog::BRANCH, "%s: %s to %s fail(%d): %s\n", __func__, item.strMethod, strChainId, item.nTries, strErr);
+        if (IsOrderedMethod(item.strMethod)) {
+            // 区块信息需要按高度提交，保持原位置退避
+            item.nNextTry = nNow + GetRetryInterval(item.nTries);
+            batch.Write(key, item);
+            continue;
+        }
+        // 移到队尾，重启后也排在之后入队的请求后面
+        BranchSendItem retry = item;
+        retry.nSeq = nNextSeq++;
+        retry.nNextTry = nNow + GetRetryInterval(retry.nTries);
+        batch.Erase(key);
+        batch.Write(std::make_pair(DB_BRANCH_SEND_ITEM, retry.nSeq), retry);
+        mapItems.erase(mi);
+        mapItems[retry.nSeq] = retry;
+    }
+    db.WriteBatch(batch, true);
+}
+
+void ThreadBranchSend()
+{
+    g_branchSendQueue->Run();
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BRANCH_SEND_QUEUE_H
+#define BRANCH_SEND_QUEUE_H
+
+#include "io/dbwrapper.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class UniValue;
+
+static const char DB_BRANCH_SEND_ITEM = 'q';
+
+/** 等待发送到其他链的一个RPC请求 */
+class BranchSendItem
+{
+public:
+    uint64_t nSeq = 0;
+    std::string strChainId;     // 目标链，"main"或支链id
+    std::string strMethod;
+    std::string strParams;      // JSON格式的参数数组
+    int64_t nTimeAdded = 0;     // 入队时间(毫秒)
+    int32_t nTries = 0;         // 对方返回错误的次数
+    int64_t nNextTry = 0;       // 下次可以发送的时间(秒)，不存盘
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nSeq);
+        READWRITE(strChainId);
+        READWRITE(strMethod);
+        READWRITE(strParams);
+        READWRITE(nTimeAdded);
+        READWRITE(nTries);
+    }
+};
+
+/**
+ * 跨链提交队列。区块处理时只把请求写入队列(leveldb持久化，重启后继续发送)，
+ * 后台线程按目标链把多个请求合并成一个JSON-RPC批量请求发送。
+ * 同一条链的请求按入队顺序发送；连接失败时整条链退避重试，不计入请求的失败次数；
+ * 对方返回错误时该请求移到队尾单独退避，不阻塞后面的请求，失败MAX_TRIES次后丢弃；
+ * 支链区块信息(submitbranchblockinfo)被拒绝时保持原位置退避，同一条链后面的区块信息等它发送成功或被丢弃；
+ * 对方表示数据已存在(重复提交、已在内存池等)时视为发送成功。
+ */
+class BranchSendQueue
+{
+public:
+    static const size_t MAX_BATCH_SIZE = 20;
+    static const int MAX_TRIES = 10;
+    static const int64_t MAX_RETRY_INTERVAL = 300;     // 秒
+    static const int BRANCH_SEND_TIMEOUT = 30;          // 等待一批请求回复的超时(秒)，也是关闭时最长的等待
+
+    BranchSendQueue(const fs::path& path, size_t nCacheSize);
+
+    void Push(const std::string& strChainId, const std::string& strMethod, const UniValue& params);
+    UniValue GetInfo();
+
+    // 后台线程的发送循环，被中断时退出
+    void Run();
+
+protected:
+    // 按链取出当前可以发送的请求，返回下次需要检查的时间(秒)。调用者需持有cs
+    int64_t CollectBatches(int64_t nNow, std::map<std::string, std::vector<BranchSendItem>>& mapBatches);
+    // 处理一批请求的返回结果：成功的移除，被拒绝的退避重试
+    void ProcessReplies(const std::string& strChainId, const std::vector<BranchSendItem>& vItems, const UniValue& replies);
+
+private:
+    void SendBatch(const std::string& strChainId, const std::vector<BranchSendItem>& vItems);
+
+    MCDBWrapper db;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::map<uint64_t, BranchSendItem> mapItems;
+    uint64_t nNextSeq = 0;
+    std::map<std::string, int> mapChainFailures;        // 各链连续连接失败的次数
+    std::map<std::string, int64_t> mapChainNextTry;     // 各链下次可以发送的时间(秒)
+
+    uint64_t nSent = 0;
+    uint64_t nFailed = 0;
+    uint64_t nDropped = 0;
+    int64_t nLastLatency = 0;
+    int64_t nTotalLatency = 0;
+};
+
+extern std::unique_ptr<BranchSendQueue> g_branchSendQueue;
+
+void ThreadBranchSend();
+
+#endif // BRANCH_SEND_QUEUE_H
@@ -185,6 +185,7 @@ public:
         strNetworkID = "main";
 		consensus.BigBoomHeight = 1000;
         consensus.BigBoomValue = 2600000 * COIN;
+        consensus.ContractKVStorageHeight = 100000000; // 键值存储模式尚未启用
         consensus.nSubsidyHalvingInterval = 210000 * 40;
         consensus.BIP34Height = 0;
         consensus.BIP34Hash = uint256();
@@ -283,6 +284,7 @@ public:
         strNetworkID = "test";
 		consensus.BigBoomHeight = 1000;
 		consensus.BigBoomValue = 2600000 * COIN;
+		consensus.ContractKVStorageHeight = 100000000;
 		consensus.nSubsidyHalvingInterval = 210000 * 20;
         consensus.BIP34Height = 0;
         consensus.BIP34Hash = uint256();
@@ -368,6 +370,7 @@ public:
         strNetworkID = "regtest";
 		consensus.BigBoomHeight = 1000;
 		consensus.BigBoomValue = 2600000 * COIN;
+		consensus.ContractKVStorageHeight = 100;
         consensus.nSubsidyHalvingInterval = 150;
         consensus.BIP34Height = 0; // BIP34 has not activated on regtest (far in the future so block v1 are not rejected in tests)
         consensus.BIP34Hash = uint256();
@@ -437,6 +440,7 @@ public:
 		strNetworkID = "branch";
 		consensus.BigBoomHeight = 0;
 		consensus.BigBoomValue = 0 * COIN;
+		consensus.ContractKVStorageHeight = 100000000;
 		consensus.nSubsidyHalvingInterval = 210000 * 20;
 		consensus.BIP34Height = 0;
 		consensus.BIP34Hash = uint256();
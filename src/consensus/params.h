@@ -67,6 +67,8 @@ struct Params {
 
 	int 	BigBoomHeight;
 	int64_t BigBoomValue;
+	/** 从该高度起发布的合约可以使用键值存储模式(PersistentData.__storage = 'kv')，按键保存的数据布局属于共识规则，除regtest外暂未启用 */
+	int 	ContractKVStorageHeight;
 };
 } // namespace Consensus
 
@@ -309,13 +309,13 @@ bool CheckTransaction(const MCTransaction& tx, MCValidationState &state, bool fC
             uint256 frombranchid = uint256S(tx.fromBranchId);
             if (!pBranchCache->HasBranchData(frombranchid))
                 return state.DoS(0, false, REJECT_INVALID, strprintf("CheckTransaction branchid error. %s", tx.fromBranchId));
-            BranchData branchdata = pBranchCache->GetBranchData(frombranchid);
+            const BranchData& branchdata = pBranchCache->GetBranchDataView(frombranchid);
 
             MCSpvProof spvProof(*tx.pPMT);
-            BranchBlockData* pBlockData = branchdata.GetBranchBlockData(spvProof.blockhash);
+            const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(spvProof.blockhash);
             if (pBlockData == nullptr)
                 return state.DoS(0, false, REJECT_INVALID, "Get transstep2 blockdata fail.");
-            if (CheckSpvProof(pBlockData->header.hashMerkleRoot, spvProof.pmt, pFromTx->GetHash()) < 0)
+            if (!CheckSpvProofWithCache(pBlockData->header.hashMerkleRoot, spvProof.pmt, pFromTx->GetHash()))
                 return state.DoS(0, false, REJECT_INVALID, "transstep2 checkSpvProof fail.");;
 
             // best chain check
@@ -70,6 +70,7 @@
 
 #include "chain/branchchain.h"
 #include "chain/branchdb.h"
+#include "chain/branchsendqueue.h"
 #include "smartcontract/contractdb.h"
 
 bool fFeeEstimatesInitialized = false;
@@ -186,6 +187,7 @@ void Shutdown()
     g_connman.reset();
 
     StopTorControl();
+    g_branchSendQueue.reset();
     if (fDumpMempoolLater && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
     }
@@ -377,6 +379,10 @@ std::string HelpMessage(HelpMessageMode mode)
                                                          "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"),
                                                  MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
+    strUsage += HelpMessageOpt("-contractdatacompress", strprintf(_("Compress contract data written to disk (default: %u)"), DEFAULT_CONTRACT_DATA_COMPRESS));
+    strUsage += HelpMessageOpt("-contractdatacache=<n>", strprintf(_("Maximum memory used to cache contract data versions in megabytes (default: %d)"), DEFAULT_CONTRACT_DATA_CACHE));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-speculativecontract", strprintf("Speculatively execute the contract transactions of a block on all threads before committing them in order (default: %u)", DEFAULT_SPECULATIVE_CONTRACT));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
@@ -1295,6 +1301,10 @@ bool AppInitMain(boost::thread_group& threadGroup, MCScheduler& scheduler)
 	g_branchChainMan = std::unique_ptr<MCBranchChainMan>(new MCBranchChainMan());
 	g_branchChainMan->Init();
 
+    // 跨链提交在后台线程发送，不阻塞区块处理
+    g_branchSendQueue.reset(new BranchSendQueue(GetDataDir() / "branchsendqueue", 1 << 20));
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "branchsend", &ThreadBranchSend));
+
     LogPrintf("Init branch chain %s\n", chainparams.GetBranchId());
 
     peerLogic.reset(new PeerLogicValidation(&connman, scheduler, &ProcessMessage, &GetLocator));
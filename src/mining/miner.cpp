@@ -48,6 +48,7 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <deque>
 #include <queue>
 #include <utility>
 #include "chain/branchchain.h"
@@ -204,10 +205,15 @@ void BlockAssembler::AddToBlock(MCTxMemPool::txiter iter, MakeBranchTxUTXO& utxo
     if ((chainparams.IsMainChain() && tx->IsBranchChainTransStep2()) || (tx->IsSmartContract() && tx->pContractData->amountOut > 0)) {
         if (utxoMaker.mapCache.count(tx->GetHash()) == 0)
             throw std::runtime_error("utxo make did not make target transaction");
-        pblock->vtx.emplace_back(utxoMaker.mapCache[tx->GetHash()]);
+        AddToBlock(iter, utxoMaker.mapCache[tx->GetHash()]);
     }
     else
-        pblock->vtx.emplace_back(tx);
+        AddToBlock(iter, tx);
+}
+
+void BlockAssembler::AddToBlock(MCTxMemPool::txiter iter, const MCTransactionRef& blockTx)
+{
+    pblock->vtx.emplace_back(blockTx);
 
     pblocktemplate->vTxFees.push_back(iter->GetFee());
     pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
@@ -278,138 +284,132 @@ void BlockAssembler::SortForBlock(const MCTxMemPool::setEntries& package, MCTxMe
     std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
 }
 
-//
-bool GroupTransactionComparer(const std::pair<uint256, int>& v1, const std::pair<uint256, int>& v2)
+// 并查集的根取组内最小的下标，合并结果与合并顺序无关
+static int FindTxGroup(std::vector<int>& parent, int i)
 {
-    if (v1.second < v2.second)
-        return true;
-    else if (v1.second > v2.second)
-        return false;
-    return v1.first < v2.first;
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
 }
 
-// 按照输入关联及关联合约地址的分组调用智能合约
-void BlockAssembler::GroupingTransaction(int offset, std::vector<const MCTxMemPoolEntry*>& blockTxEntries)
+static void UnionTxGroup(std::vector<int>& parent, int a, int b)
 {
-    typedef std::map<int, std::vector<std::pair<uint256, int>>> MAPGROUP;
-
-    MAPGROUP group2trans;
-    std::set<int> mergeGroups;
-    std::map<uint256, int> trans2group;
-    std::map<MCContractID, int> contract2group;
+    a = FindTxGroup(parent, a);
+    b = FindTxGroup(parent, b);
+    if (a != b)
+        parent[std::max(a, b)] = std::min(a, b);
+}
 
-    {
-        int groupId = 0;
-        auto& temp = group2trans[groupId];
-        for (int i = 0; i < offset; ++i) {
-            uint256 hash;
-            if (blockTxEntries[i] != nullptr) {// the offset has init with nullptr, because coinbase tx and stake tx no relative mempool entry
-                hash = blockTxEntries[i]->GetTx().GetHash();
-            }
-            else if (pblock->vtx[i] != nullptr){// coinbase is not init.
-                hash = pblock->vtx[i]->GetHash();
-            }
-            //if (!hash.IsNull()){ //where to find coinbase hash ?
-                temp.emplace_back(std::make_pair(hash, i));
-                trans2group[hash] = groupId;
-            //}
-        }
-    }
+std::vector<std::vector<int>> BlockAssembler::GroupBlockTransactions(const std::vector<MCTransactionRef>& vtx, int offset, const std::vector<const MCTxMemPoolEntry*>& blockTxEntries, size_t nMaxGroup)
+{
+    const int size = vtx.size();
+    std::vector<int> parent(size);
+    for (int i = 0; i < size; ++i)
+        parent[i] = i;
+
+    // 与RunBlockContract的检查一致：交易哈希、输入所在的交易(stake除外)、调用过的合约在不同组间不能重复
+    std::unordered_map<uint256, int, SaltedTxidHasher> hash2tx;
+    std::map<MCContractID, int> contract2tx;
+    auto linkHash = [&](const uint256& hash, int i) {
+        auto ret = hash2tx.emplace(hash, i);
+        if (!ret.second)
+            UnionTxGroup(parent, ret.first->second, i);
+    };
+    auto linkContract = [&](const MCContractID& contractId, int i) {
+        auto ret = contract2tx.emplace(contractId, i);
+        if (!ret.second)
+            UnionTxGroup(parent, ret.first->second, i);
+    };
 
-    int nextGroupId = 1;
-    for (int i = offset; i < pblock->vtx.size(); ++i) {
-        mergeGroups.clear();
-        int groupId = nextGroupId;
-        const MCTransactionRef& tx = pblock->vtx[i];
+    for (int i = 0; i < size; ++i) {
+        // coinbase、stake等区块开头的交易固定在第一组
+        if (i > 0 && i < offset)
+            UnionTxGroup(parent, 0, i);
 
-        if (trans2group.find(tx->GetHash()) != trans2group.end()) {
-            groupId = trans2group[tx->GetHash()];
-        }
+        const MCTransactionRef& tx = vtx[i];
+        if (tx == nullptr)// coinbase is not init.
+            continue;
 
-        int lastGroupId = -1;
-        for (int j = 0; j < tx->vin.size(); ++j) {
-            const MCOutPoint& preOutPoint = tx->vin[j].prevout;
-            if (preOutPoint.hash.IsNull()) {
-                continue;
-            }
-            if (trans2group.find(preOutPoint.hash) != trans2group.end()) {
-                int preTransGroupId = trans2group[preOutPoint.hash];
-                groupId = std::min(preTransGroupId, groupId);
-                if (lastGroupId != -1) {
-                    groupId = std::min(groupId, lastGroupId);
-                }
-                if (groupId != preTransGroupId) {
-                    mergeGroups.insert(preTransGroupId);
-                }
-                if (lastGroupId != -1 && groupId != lastGroupId) {
-                    mergeGroups.insert(lastGroupId);
-                }
-            }
-            else if (lastGroupId == -1 || lastGroupId == groupId) {
-                // 输入不在区块中，标记该交易与当前groupid相同
-                trans2group[preOutPoint.hash] = groupId;
-                auto& temp = group2trans[groupId];
-                temp.emplace_back(std::make_pair(preOutPoint.hash, std::numeric_limits<int>::max()));
+        linkHash(tx->GetHash(), i);
+        if (!tx->IsStake()) {
+            for (const MCTxIn& txin : tx->vin) {
+                if (!txin.prevout.hash.IsNull())
+                    linkHash(txin.prevout.hash, i);
             }
-            else {
-                groupId = std::min(lastGroupId, groupId);
-                if (groupId != lastGroupId) {
-                    mergeGroups.insert(lastGroupId);
-                }
-            }
-            lastGroupId = groupId;
         }
 
         if (tx->IsSmartContract()) {
             const MCTxMemPoolEntry* entry = blockTxEntries[i];
-            int finalGroupId = groupId;
-            for (auto& contractAddr : entry->contractData->contractAddrs) {
-                if (contract2group.find(contractAddr) != contract2group.end()) {
-                    int contractGroupId = contract2group[contractAddr];
-                    finalGroupId = std::min(contractGroupId, finalGroupId);
-                }
-                else
-                    contract2group[contractAddr] = groupId;
-            }
-
-            if (finalGroupId != groupId) {
-                mergeGroups.insert(groupId);
-                groupId = finalGroupId;
-            }
-
-            for (auto& contractAddr : entry->contractData->contractAddrs) {
-                if (contract2group.find(contractAddr) != contract2group.end()) {
-                    int contractGroupId = contract2group[contractAddr];
-                    if (finalGroupId != contractGroupId) {
-                        contract2group[contractAddr] = finalGroupId;
-                        mergeGroups.insert(contractGroupId);
-                    }
-                }
+            if (entry != nullptr && entry->contractData != nullptr) {
+                for (const MCContractID& contractAddr : entry->contractData->contractAddrs)
+                    linkContract(contractAddr, i);
             }
+            if (!tx->pContractData->address.IsNull())
+                linkContract(tx->pContractData->address, i);
         }
+    }
 
-        auto& des = group2trans[groupId];
-        for (auto item : mergeGroups) {
-            auto& src = group2trans[item];
-            for (auto& it : src) {
-                des.emplace_back(it);
-                trans2group[it.first] = groupId;
-            }
-            group2trans.erase(item);
+    // 收集各组，组内按交易原来的顺序，保证依赖的交易在前
+    std::map<int, std::vector<int>> groups;
+    std::map<int, uint64_t> groupCosts;
+    for (int i = 0; i < size; ++i) {
+        int root = FindTxGroup(parent, i);
+        groups[root].push_back(i);
+        // 交易在合约执行中的代价，与GetVirtualTransactionSize一样一条指令按一字节计
+        if (vtx[i] != nullptr) {
+            groupCosts[root] += vtx[i]->GetTotalSize();
+            if (blockTxEntries[i] != nullptr && blockTxEntries[i]->contractData != nullptr)
+                groupCosts[root] += blockTxEntries[i]->contractData->runningTimes;
         }
+    }
 
-        des.emplace_back(std::make_pair(tx->GetHash(), i));
-        trans2group[tx->GetHash()] = groupId;
-        if (tx->IsSmartContract()) {
-            if (!tx->pContractData->address.IsNull()) {
-                contract2group[tx->pContractData->address] = groupId;
-            }
-        }
+    // 按代价从大到小依次放入当前代价最小的分组，第一组固定为区块开头交易所在的组
+    std::vector<std::pair<uint64_t, int>> order;
+    for (const auto& item : groupCosts) {
+        if (item.first != 0)
+            order.emplace_back(item.second, item.first);
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
 
-        if (groupId == nextGroupId) {
-            nextGroupId++;
+    std::vector<std::vector<int>> slots(std::max<size_t>(nMaxGroup, 1));
+    std::vector<uint64_t> slotCosts(slots.size(), 0);
+    if (size > 0) {
+        slots[0] = std::move(groups[0]);
+        slotCosts[0] = groupCosts[0];
+    }
+    for (const auto& item : order) {
+        std::vector<int>& group = groups[item.second];
+        int best = -1;
+        for (int i = 0; i < slots.size(); ++i) {
+            if (slots[i].size() + group.size() > std::numeric_limits<uint16_t>::max())
+                continue;
+            if (best == -1 || slotCosts[i] < slotCosts[best])
+                best = i;
         }
+        if (best == -1)
+            throw std::runtime_error(strprintf("%s: too many associated transactions in one group", __func__));
+        slots[best].insert(slots[best].end(), group.begin(), group.end());
+        slotCosts[best] += item.first;
+    }
+
+    std::vector<std::vector<int>> result;
+    for (std::vector<int>& slot : slots) {
+        if (slot.empty())
+            continue;
+        std::sort(slot.begin(), slot.end());
+        result.emplace_back(std::move(slot));
     }
+    return result;
+}
+
+// 按照输入关联及关联合约地址的分组调用智能合约
+void BlockAssembler::GroupingTransaction(int offset, std::vector<const MCTxMemPoolEntry*>& blockTxEntries)
+{
+    std::vector<std::vector<int>> finalGroup = GroupBlockTransactions(pblock->vtx, offset, blockTxEntries, MAX_GROUP_NUM);
 
     std::vector<MCTransactionRef> vtx(pblock->vtx);
     pblock->vtx.clear();
@@ -418,77 +418,19 @@ void BlockAssembler::GroupingTransaction(int offset, std::vector<const MCTxMemPo
     std::vector<MCAmount> vTxSigOpsCost(pblocktemplate->vTxSigOpsCost);
     pblocktemplate->vTxSigOpsCost.clear();
 
-    // 限制了分组的数量
-    std::vector<MAPGROUP::iterator> finalGroup;
-    MAPGROUP::iterator iter = group2trans.begin();
-    for (; iter != group2trans.end(); ++iter) {
-        for (int i = iter->second.size() - 1; i >= 0; --i) {
-            if (iter->second[i].second == std::numeric_limits<int>::max()) {
-                iter->second.erase(iter->second.begin() + i);
-            }
-        }
-        
-        assert(iter->second.size() > 0);
-        finalGroup.emplace_back(iter);
-        if (finalGroup.size() >= MAX_GROUP_NUM) {
-            ++iter;
-            break;
-        }
-    }
-
-    if (iter != group2trans.end()) {
-        // 将超出最大分组数量的分组交易合并到现有的分组中
-        int minGroupIndex = 0;
-        int minGroupSize = iter->second.size();
-        while (iter != group2trans.end()) {
-            for (int i = iter->second.size() - 1; i >= 0; --i) {
-                if (iter->second[i].second == std::numeric_limits<int>::max()) {
-                    iter->second.erase(iter->second.begin() + i);
-                }
-            }
-
-            assert(iter->second.size() > 0);
-            if (minGroupSize + iter->second.size() > std::numeric_limits<uint16_t>::max()) {
-                return;
-            }
-
-            finalGroup[minGroupIndex]->second.insert(finalGroup[minGroupIndex]->second.end(),
-                iter->second.begin(), iter->second.end());
-            iter = group2trans.erase(iter);
-
-            minGroupIndex = 0;
-            minGroupSize = finalGroup[0]->second.size();
-            for (int i = 1; i < finalGroup.size(); ++i) {
-                size_t sz = finalGroup[i]->second.size();
-                if (sz < minGroupSize) {
-                    minGroupSize = sz;
-                    minGroupIndex = i;
-                }
-            }
-
-            if (minGroupIndex == -1 || minGroupSize <= 0 || minGroupSize > std::numeric_limits<uint16_t>::max()) {
-                return;
-            }
-        }
-    }
-
     // 将分组好的交易重新打入包中
     int total = 0;
     pblock->groupSize.clear();
     for (int i = 0; i < finalGroup.size(); ++i) {
-        assert(finalGroup[i]->second.size() > 0);
-        total += finalGroup[i]->second.size();
-        std::sort(finalGroup[i]->second.begin(), finalGroup[i]->second.end(), GroupTransactionComparer);
-        for (int j = 0; j < finalGroup[i]->second.size(); ++j) {
-            std::pair<uint256, int>& item = finalGroup[i]->second[j];
-            assert(item.second < std::numeric_limits<int>::max());
-            pblock->vtx.emplace_back(vtx[item.second]);
-            pblocktemplate->vTxFees.emplace_back(vTxFees[item.second]);
-            pblocktemplate->vTxSigOpsCost.emplace_back(vTxSigOpsCost[item.second]);
+        total += finalGroup[i].size();
+        for (int j : finalGroup[i]) {
+            pblock->vtx.emplace_back(vtx[j]);
+            pblocktemplate->vTxFees.emplace_back(vTxFees[j]);
+            pblocktemplate->vTxSigOpsCost.emplace_back(vTxSigOpsCost[j]);
         }
-        pblock->groupSize.emplace_back(finalGroup[i]->second.size());
+        pblock->groupSize.emplace_back(finalGroup[i].size());
     }
-    LogPrint(BCLog::MINING, "%s:%d %d:%d\n", __FUNCTION__, __LINE__, total, vtx.size());
+    LogPrint(BCLog::MINING, "%s:%d %d:%d groups:%d\n", __FUNCTION__, __LINE__, total, vtx.size(), finalGroup.size());
     assert(total == vtx.size());
 }
 
@@ -651,15 +593,8 @@ bool BlockAssembler::UpdateIncompleteTx(MCTxMemPool::txiter iter, MakeBranchTxUT
 // Each time through the loop, we compare the best transaction in
 // mapModifiedTxs with the next transaction in the mempool to decide what
 // transaction package to work on next.
-void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated)
+void BlockAssembler::selectPackageTxs(int offset, std::vector<const MCTxMemPoolEntry*>& blockTxEntries, int& nPackagesSelected, int& nDescendantsUpdated)
 {
-    //is in generateforbigboom block,need to pre-add coinbase tx weight first, some test will make block out of size.
-    if (nHeight <= chainparams.GetConsensus().BigBoomHeight)
-    {
-        nBlockWeight += 37000;// TODO: coinbase is not init, cannot calc size here. this value get from a true bigboom coinbase tx.
-    }
-
-    int offset = pblock->vtx.size();
     // mapModifiedTx will store sorted packages after they are modified
     // because some of their txs are already in the block
     indexed_modified_transaction_set mapModifiedTx;
@@ -681,8 +616,6 @@ void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    std::vector<const MCTxMemPoolEntry*> blockTxEntries;
-    blockTxEntries.insert(blockTxEntries.end(), offset, nullptr);
     while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
         // First try to find a new transaction in mapTx to evaluate.
         if (mi != mempool.mapTx.get<ancestor_score>().end() &&
@@ -848,6 +781,79 @@ void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpda
             break;
         }
     }
+}
+
+/**
+ * 最近一次选出的交易包。挖矿时每个抵押币都要组装一次区块，getblocktemplate也会反复组装，
+ * tip和交易池没有变化时选出的交易相同，直接按原顺序放入区块，省去计算祖先、制作跨链及合约转出交易UTXO的开销。
+ * 交易池的nTransactionsUpdated在加入、移除交易及调整优先级时都会变化，缓存的迭代器在其不变时有效。
+ * 只在持有cs_main和mempool.cs时访问
+ */
+struct PackageSelection
+{
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated = 0;
+    int offset = -1;
+    int64_t nLockTimeCutoff = 0;
+    bool fIncludeWitness = false;
+    size_t nBlockMaxWeight = 0;
+    MCFeeRate blockMinFeeRate;
+    int64_t nMaxTxNum = 0;
+    std::vector<MCTxMemPool::txiter> entries;
+    std::vector<MCTransactionRef> vtx;  // 放入区块的交易，跨链及合约转出交易为制作UTXO后的交易
+    int nPackagesSelected = 0;
+    int nDescendantsUpdated = 0;
+};
+static PackageSelection gLastPackageSelection;
+
+void BlockAssembler::addPackageTxs(int& nPackagesSelected, int& nDescendantsUpdated)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    //is in generateforbigboom block,need to pre-add coinbase tx weight first, some test will make block out of size.
+    if (nHeight <= chainparams.GetConsensus().BigBoomHeight)
+    {
+        nBlockWeight += 37000;// TODO: coinbase is not init, cannot calc size here. this value get from a true bigboom coinbase tx.
+    }
+
+    int offset = pblock->vtx.size();
+    std::vector<const MCTxMemPoolEntry*> blockTxEntries;
+    blockTxEntries.insert(blockTxEntries.end(), offset, nullptr);
+
+    PackageSelection& last = gLastPackageSelection;
+    const uint256 hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    const int64_t nMaxTxNum = gArgs.GetArg("-maxtxnuminblock", std::numeric_limits<int64_t>::max());
+    if (last.hashPrevBlock == hashPrevBlock && last.nTransactionsUpdated == nTransactionsUpdated && last.offset == offset &&
+        last.nLockTimeCutoff == nLockTimeCutoff && last.fIncludeWitness == fIncludeWitness && last.nBlockMaxWeight == nBlockMaxWeight &&
+        last.blockMinFeeRate == blockMinFeeRate && last.nMaxTxNum == nMaxTxNum) {
+        for (size_t i = 0; i < last.entries.size(); ++i) {
+            AddToBlock(last.entries[i], last.vtx[i]);
+            blockTxEntries.emplace_back(&*last.entries[i]);
+        }
+        nPackagesSelected = last.nPackagesSelected;
+        nDescendantsUpdated = last.nDescendantsUpdated;
+        LogPrint(BCLog::MINING, "%s: reuse %u selected txs\n", __func__, last.entries.size());
+    }
+    else {
+        selectPackageTxs(offset, blockTxEntries, nPackagesSelected, nDescendantsUpdated);
+
+        last.hashPrevBlock = hashPrevBlock;
+        last.nTransactionsUpdated = nTransactionsUpdated;
+        last.offset = offset;
+        last.nLockTimeCutoff = nLockTimeCutoff;
+        last.fIncludeWitness = fIncludeWitness;
+        last.nBlockMaxWeight = nBlockMaxWeight;
+        last.blockMinFeeRate = blockMinFeeRate;
+        last.nMaxTxNum = nMaxTxNum;
+        last.entries.clear();
+        last.vtx.assign(pblock->vtx.begin() + offset, pblock->vtx.end());
+        for (size_t i = offset; i < blockTxEntries.size(); ++i)
+            last.entries.push_back(mempool.mapTx.find(blockTxEntries[i]->GetTx().GetHash()));
+        last.nPackagesSelected = nPackagesSelected;
+        last.nDescendantsUpdated = nDescendantsUpdated;
+    }
 
     // 默认使用分片重新排列交易
     bool grouping = gArgs.GetBoolArg("-grouping", true);
@@ -885,7 +891,16 @@ void static GenerateSleep()
 	boost::this_thread::interruption_point();
 }
 
-void static MagnaChainMiner(const MCChainParams& chainparams)
+static MCCriticalSection cs_stakeMinerStats;
+static std::vector<std::shared_ptr<StakeMinerStats>> vStakeMinerStats;
+
+// 按outpoint把候选币固定分到各挖矿线程，钱包快照变化时分片不变
+static int GetStakeOutputShard(const MCOutput& out, int nShards)
+{
+    return (out.tx->GetHash().GetCheapHash() + out.i) % nShards;
+}
+
+void static MagnaChainMiner(const MCChainParams& chainparams, int nThreadIndex, int nThreads, std::shared_ptr<StakeMinerStats> pStats)
 {
     LogPrintf("MagnaChainMiner started\n");
 	RenameThread("magnachain-miner");
@@ -901,12 +916,15 @@ void static MagnaChainMiner(const MCChainParams& chainparams)
 			{
 				assert(pwallet != nullptr);
 
-				LOCK2(cs_main, pwallet->cs_wallet);
-
-                if (Params().IsMainChain())
-                    pwallet->AvailableCoins(vecOutputs, nullptr, false);
-                else
-                    pwallet->AvailableMortgageCoins(vecOutputs, false);
+                // 钱包维护的候选币快照，未变化时不需要持有cs_main重新扫描钱包
+                pwallet->AvailableStakeCoins(vecOutputs);
+                // 各线程只计算自己分片的kernel，命中的线程负责组块，避免重复计算和重复组块
+                if (nThreads > 1) {
+                    vecOutputs.erase(std::remove_if(vecOutputs.begin(), vecOutputs.end(), [&](const MCOutput& out) {
+                        return GetStakeOutputShard(out, nThreads) != nThreadIndex;
+                    }), vecOutputs.end());
+                }
+                pStats->nOutputs = vecOutputs.size();
 				//for (const MCOutput& out : vecOutputs) {
 				//	MCTxDestination address;
 				//	const MCScript& scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
@@ -927,7 +945,14 @@ void static MagnaChainMiner(const MCChainParams& chainparams)
             //BOOST_FOREACH(const MCTxDestination& addr, setAddress) {
 			//	vecScript.push_back(GetScriptForDestination(addr));
 			//}
-			generateBlocks(pwallet, vecOutputs, vecOutputs.size(), vecOutputs.size(), true, GenerateSleep);
+			if (vecOutputs.empty()) {
+				MilliSleep(1000);
+				continue;
+			}
+			UniValue blockHashes = generateBlocks(pwallet, vecOutputs, vecOutputs.size(), vecOutputs.size(), true, GenerateSleep, nullptr, nullptr, pStats.get());
+			// 没有输出达到难度时会很快返回，稍等再重新获取可用币，避免空转
+			if (blockHashes.empty())
+				MilliSleep(1000);
 
 			// Check for stop or if block needs to be rebuilt
 			boost::this_thread::interruption_point();
@@ -969,12 +994,35 @@ void GenerateMCs(bool fGenerate, int nThreads, const MCChainParams& chainparams)
 		minerThreads = NULL;
 	}
 
+	LOCK(cs_stakeMinerStats);
+	vStakeMinerStats.clear();
+
 	if (nThreads == 0 || !fGenerate)
 		return;
 
 	minerThreads = new boost::thread_group();
-	for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&MagnaChainMiner, boost::cref(chainparams)));
+	for (int i = 0; i < nThreads; i++) {
+        std::shared_ptr<StakeMinerStats> pStats = std::make_shared<StakeMinerStats>();
+        vStakeMinerStats.push_back(pStats);
+        minerThreads->create_thread(boost::bind(&MagnaChainMiner, boost::cref(chainparams), i, nThreads, pStats));
+    }
+}
+
+UniValue GetStakeMinerStats()
+{
+    UniValue ret(UniValue::VARR);
+    LOCK(cs_stakeMinerStats);
+    for (size_t i = 0; i < vStakeMinerStats.size(); ++i) {
+        const StakeMinerStats& stats = *vStakeMinerStats[i];
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("thread", (int)i));
+        obj.push_back(Pair("outputs", (uint64_t)stats.nOutputs));
+        obj.push_back(Pair("kernels", (uint64_t)stats.nKernels));
+        obj.push_back(Pair("hits", (uint64_t)stats.nHits));
+        obj.push_back(Pair("blocks", (uint64_t)stats.nBlocks));
+        ret.push_back(obj);
+    }
+    return ret;
 }
 
 
@@ -1136,135 +1184,113 @@ bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&
 
 static uint256 guMaxWork = uint256S("0xffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
 
-// 如有修改,同时也需修改 GetBlockHeaderWork
-uint32_t GetBlockWork(const MCBlock& block, const MCOutPoint& out, uint256& block_hash)
+////---------------------------------------------------------
+inline const BranchBlockData* GetBranchBlockData(const BranchData& branchdata, const uint256 &blockhash, const uint256 &branchhash, BranchCache *pBranchCache){
+    const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(blockhash);
+    if (pBlockData != nullptr)
+        return pBlockData;
+    if (pBranchCache)// is get data from mempool
+        return pBranchCache->GetBranchBlockData(branchhash, blockhash);
+    return nullptr;
+}
+
+StakeKernel::StakeKernel(const MCBlockIndex* pindexPrev)
+    : iAvgNonce(0), nNonceCount(0), iCheck2(2), iCheck3(3),
+    sheader(SER_GETHASH, PROTOCOL_VERSION), snum(SER_GETHASH, PROTOCOL_VERSION)
 {
-	block_hash  = guMaxWork;
-	BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
-	if (mi == mapBlockIndex.end())
+	iPrevHeight = pindexPrev->nHeight;
+	isBigBoom = iPrevHeight < Params().GetConsensus().BigBoomHeight;
+	fBranchFirstBlock = !isBigBoom && !Params().IsMainChain() && iPrevHeight == 0;
+	fComplete = true;
+
+	const MCBlockIndex* pNextIndex = pindexPrev;
+	for (int i = 0; i < MAX_ANCESTORS && pNextIndex != NULL; ++i)
 	{
-		return 0;
+		AddAncestor(i, pNextIndex->nNonce, [pNextIndex]() { return pNextIndex->GetBlockHash(); });
+		pNextIndex = pNextIndex->pprev;
 	}
-    MCBlockIndex* pPreIndex = mi->second;
-	const int iPrevHeight = pPreIndex->nHeight;
-	//const int iTop = chainActive.Height();
+	// 计算前100个区块的平均值
+	iAvgNonce /= nNonceCount;
+}
 
-	const bool isBigBoom = iPrevHeight < Params().GetConsensus().BigBoomHeight;
+StakeKernel::StakeKernel(const BranchBlockData* pPrev, const MCChainParams& params, const BranchData& branchdata, BranchCache* pBranchCache)
+    : iAvgNonce(0), nNonceCount(0), iCheck2(2), iCheck3(3),
+    sheader(SER_GETHASH, PROTOCOL_VERSION), snum(SER_GETHASH, PROTOCOL_VERSION)
+{
+	iPrevHeight = pPrev->nHeight;
+	isBigBoom = iPrevHeight < params.GetConsensus().BigBoomHeight;
+	fBranchFirstBlock = !isBigBoom && !params.IsMainChain() && iPrevHeight == 0;
+
+	const BranchBlockData* pNextIndex = pPrev;
+	const BranchBlockData* pLastIndex = pPrev;
+	int i = 0;
+	for (; i < MAX_ANCESTORS && pNextIndex != NULL; ++i)
+	{
+		AddAncestor(i, pNextIndex->header.nNonce, [pNextIndex]() { return pNextIndex->header.GetHash(); });
+		pLastIndex = pNextIndex;
+		pNextIndex = GetBranchBlockData(branchdata, pNextIndex->header.hashPrevBlock, params.GetBranchHash(), pBranchCache);
+	}
+	// 遍历到传世块或已满范围时与数据是否齐全无关
+	fComplete = i == MAX_ANCESTORS || pLastIndex->nHeight == 0;
+	iAvgNonce /= nNonceCount;
+}
 
-	const int iMatureDepth = COINBASE_MATURITY - 1;
-    MCAmount total = 0;
+MCAmount StakeKernel::GetStakeAmount(const MCOutPoint& out) const
+{
+	if (isBigBoom)
+		return 0;
 
-	// 取得矿工当前可用的UTXO
-    MCTxDestination kDest;
-	ExtractDestination(block.vtx[0]->vout[0].scriptPubKey, kDest);
+	Coin coin;
+	if (!pcoinsTip->GetCoin(out, coin))
+		return 0;
+	return GetStakeAmount(coin);
+}
 
-	if ( isBigBoom )
-		total = 0;
-    else if (!Params().IsMainChain() && iPrevHeight == 0)//侧链第2个块,即传世块后的第1个块
-    {
-        if (block.vtx.size() <= 2)
-            return 0;
-        const MCTransaction& tx = *block.vtx[1];
-        std::vector<MCTransactionRef>::const_iterator itFound = std::find_if(block.vtx.begin(), block.vtx.end(), [&tx](const MCTransactionRef& ptx) { return ptx->GetHash() == tx.vin[0].prevout.hash; });
-        if (itFound != block.vtx.end()){
-            int iRun = 1;
-            total = ((*itFound)->vout[0].nValue / COIN) * iRun;
-        }
-        else
-            return 0;
-    }
-	else {
-		Coin coin;
-		if (pcoinsTip->GetCoin(out, coin)) {
-            MCAmount v = coin.out.nValue;
-			// 计算深度时从上一次挖矿的时候开始算，同时要减去一个成熟时间
-			int iHeight = coin.nHeight;
-			iHeight += iMatureDepth;
-            if (!Params().IsMainChain() && iPrevHeight < 2*COINBASE_MATURITY) {// 侧链前 2 COINBASE_MATURITY 块的高度处理
-                iHeight = -COINBASE_MATURITY;
-                iHeight = std::min(iHeight, COINBASE_MATURITY);
-            }
-			int iRun = iPrevHeight - iHeight;
-			if (iRun > 0) {
-				total += (v / COIN) * iRun;
-			}
-		}
+MCAmount StakeKernel::GetStakeAmount(const Coin& coin) const
+{
+	if (isBigBoom)
+		return 0;
+
+	const int iMatureDepth = COINBASE_MATURITY - 1;
+	MCAmount total = 0;
+	MCAmount v = coin.out.nValue;
+	// 计算深度时从上一次挖矿的时候开始算，同时要减去一个成熟时间
+	int iHeight = coin.nHeight;
+	iHeight += iMatureDepth;
+	if (!Params().IsMainChain() && iPrevHeight < 2*COINBASE_MATURITY) {// 侧链前 2 COINBASE_MATURITY 块的高度处理
+		iHeight = -COINBASE_MATURITY;
+		iHeight = std::min(iHeight, COINBASE_MATURITY);
+	}
+	int iRun = iPrevHeight - iHeight;
+	if (iRun > 0) {
+		total += (v / COIN) * iRun;
 	}
+	return total;
+}
 
+uint32_t StakeKernel::GetWork(const MCKeyID& key, const MCOutPoint& out, MCAmount total, uint256& block_hash) const
+{
 	if (total >= std::numeric_limits<uint32_t>::max()) {
 		total = std::numeric_limits<uint32_t>::max();
 	}
-
-	// 计算前100个区块的平均值
-	{
-		MCAmount iAvg = 0;
-		MCBlockIndex *ptest = pPreIndex;
-		int i = 0;
-		for ( ;i < 100; ++i)
-		{
-			if (ptest == NULL)
-			{
-				break;
-			}
-			iAvg += ptest->nNonce;
-
-			ptest = ptest->pprev;
-		}
-		iAvg /= i;
-		if ( iAvg > 100 && total > iAvg + iAvg /20 ) {
-			total = iAvg + iAvg / 20;
-		}
-	//	LogPrintf("%s: Amount before avg: %d after change: %d,  avg: %d \n", __func__, iBeforeAvg, total, iAvg );
+	if (iAvgNonce > 100 && total > iAvgNonce + iAvgNonce / 20) {
+		total = iAvgNonce + iAvgNonce / 20;
 	}
 
-	// 计算HASH
+	// 计算HASH，复制预先写入祖先块哈希的状态
+	MCHashWriter sheaderKey(sheader);
+	MCHashWriter snumKey(snum);
+	sheaderKey << (uint160)key;
+	sheaderKey << out.hash;
+	sheaderKey << out.n;
 
-	int nType = SER_GETHASH;
-	int nVersion = PROTOCOL_VERSION;
-    MCHashWriter sheader(nType, nVersion);
-    MCHashWriter snum(nType, nVersion);
-
-	int iCheck2 = 2;
-	int iCheck3 = 3;
-    MCBlockIndex* pNextIndex = pPreIndex;
-	for (int i = 0; i < 1000; ++i)
-	{
-		if (pNextIndex == NULL)
-		{
-			break;
-		}
-		if (i == iCheck2)
-		{
-			iCheck2 *= 2;
-			sheader << pNextIndex->GetBlockHash();
-		}
-		if (i == iCheck3)
-		{
-			iCheck3 *= 3;
-			snum << pNextIndex->GetBlockHash();
-		}
-
-        pNextIndex = pNextIndex->pprev;
-	}
-
-    if (kDest.type() != typeid(MCKeyID))
-    {
-        LogPrintf("%s: Mine out key type invalid \n", __func__);
-        return 0;
-    }
-    MCKeyID kKey = boost::get<MCKeyID>(kDest);
-	sheader << (uint160)kKey;
-	sheader << out.hash;
-	sheader << out.n;
-
-	snum << (uint160)kKey;
-	block_hash = sheader.GetHash();
-	uint256 num_hash = snum.GetHash();
+	snumKey << (uint160)key;
+	block_hash = sheaderKey.GetHash();
+	uint256 num_hash = snumKey.GetHash();
 
 	// percent 
 	uint64_t iPercent = num_hash.GetCheapHash() % 100;
-    MCAmount iMount = total * iPercent / 100;
-	//LogPrintf("%s: before change work %s \n", __func__, block_hash.GetHex());
+	MCAmount iMount = total * iPercent / 100;
 
 	arith_uint256 iTmp = UintToArith256(block_hash);
 
@@ -1277,21 +1303,124 @@ uint32_t GetBlockWork(const MCBlock& block, const MCOutPoint& out, uint256& bloc
 	else {
 		if (iMount == 0) {
 			block_hash = guMaxWork;
-			LogPrintf("%s: block work To MAX WORK, Amount is 0, total %d \n", __func__, total);
 			return 0;
 		}
 	}
-//	LogPrintf("%s: block work %s , Amount:%d \n", __func__, iTmp.GetHex(), iMount);
 
 	uint32_t iComp = iTmp.GetCompact();
 	iTmp.SetCompact(iComp);
 	block_hash = ArithToUint256(iTmp);
 
-//	LogPrintf("%s: Compat block work %s \n", __func__, iTmp.GetHex());
-
 	return total;
 }
 
+/**
+ * 最近用到的上一块的工作量上下文。主链只需保留tip及少量分叉，
+ * 侧链头按(侧链, 上一块)缓存，主链同时检查多条侧链的头。先进先出淘汰
+ */
+class StakeKernelCache
+{
+public:
+    explicit StakeKernelCache(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    std::shared_ptr<const StakeKernel> Get(const uint256& key)
+    {
+        LOCK(cs);
+        auto it = mapKernel.find(key);
+        if (it == mapKernel.end())
+            return nullptr;
+        return it->second;
+    }
+
+    void Put(const uint256& key, const std::shared_ptr<const StakeKernel>& kernel)
+    {
+        LOCK(cs);
+        if (!mapKernel.emplace(key, kernel).second)
+            return;
+        queueKeys.push_back(key);
+        while (queueKeys.size() > nMaxSize) {
+            mapKernel.erase(queueKeys.front());
+            queueKeys.pop_front();
+        }
+    }
+
+private:
+    MCCriticalSection cs;
+    const size_t nMaxSize;
+    std::map<uint256, std::shared_ptr<const StakeKernel>> mapKernel;
+    std::deque<uint256> queueKeys;
+};
+
+static StakeKernelCache gStakeKernelCache(32);
+static StakeKernelCache gBranchStakeKernelCache(1024);
+
+std::shared_ptr<const StakeKernel> GetStakeKernel(const MCBlockIndex* pindexPrev)
+{
+	const uint256 hash = pindexPrev->GetBlockHash();
+	std::shared_ptr<const StakeKernel> kernel = gStakeKernelCache.Get(hash);
+	if (kernel == nullptr) {
+		kernel = std::make_shared<const StakeKernel>(pindexPrev);
+		gStakeKernelCache.Put(hash, kernel);
+	}
+	return kernel;
+}
+
+static std::shared_ptr<const StakeKernel> GetBranchStakeKernel(const BranchBlockData* pPrev, const MCChainParams& params, const BranchData& branchdata, BranchCache* pBranchCache)
+{
+	const uint256 branchHash = params.GetBranchHash();
+	const uint256 prevHash = pPrev->header.GetHash();
+	const uint256 key = Hash(branchHash.begin(), branchHash.end(), prevHash.begin(), prevHash.end());
+	std::shared_ptr<const StakeKernel> kernel = gBranchStakeKernelCache.Get(key);
+	if (kernel == nullptr) {
+		kernel = std::make_shared<const StakeKernel>(pPrev, params, branchdata, pBranchCache);
+		if (kernel->IsComplete())
+			gBranchStakeKernelCache.Put(key, kernel);
+	}
+	return kernel;
+}
+
+// 如有修改,同时也需修改 GetBlockHeaderWork
+uint32_t GetBlockWork(const MCBlock& block, const MCOutPoint& out, uint256& block_hash)
+{
+	block_hash  = guMaxWork;
+	BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+	if (mi == mapBlockIndex.end())
+	{
+		return 0;
+	}
+	std::shared_ptr<const StakeKernel> kernel = GetStakeKernel(mi->second);
+
+	MCAmount total = 0;
+	if (kernel->IsBranchFirstBlock())//侧链第2个块,即传世块后的第1个块
+	{
+		if (block.vtx.size() <= 2)
+			return 0;
+		const MCTransaction& tx = *block.vtx[1];
+		std::vector<MCTransactionRef>::const_iterator itFound = std::find_if(block.vtx.begin(), block.vtx.end(), [&tx](const MCTransactionRef& ptx) { return ptx->GetHash() == tx.vin[0].prevout.hash; });
+		if (itFound != block.vtx.end()){
+			int iRun = 1;
+			total = ((*itFound)->vout[0].nValue / COIN) * iRun;
+		}
+		else
+			return 0;
+	}
+	else
+		total = kernel->GetStakeAmount(out);
+
+	MCTxDestination kDest;
+	ExtractDestination(block.vtx[0]->vout[0].scriptPubKey, kDest);
+	if (kDest.type() != typeid(MCKeyID))
+	{
+		LogPrintf("%s: Mine out key type invalid \n", __func__);
+		return 0;
+	}
+
+	uint32_t iWork = kernel->GetWork(boost::get<MCKeyID>(kDest), out, total, block_hash);
+	if (!kernel->IsBigBoom() && block_hash == guMaxWork)
+		LogPrintf("%s: block work To MAX WORK, Amount is 0, total %d \n", __func__, total);
+	return iWork;
+}
+
 bool CheckBlockWork(const MCBlock& block, MCValidationState& state, const Consensus::Params& consensusParams)
 {
 	uint256 hash;
@@ -1325,19 +1454,10 @@ bool CheckBlockWork(const MCBlock& block, MCValidationState& state, const Consen
 	return true;
 }
 
-////---------------------------------------------------------
-inline const BranchBlockData* GetBranchBlockData(BranchData& branchdata, const uint256 &blockhash, const uint256 &branchhash, BranchCache *pBranchCache){
-    if (branchdata.mapHeads.count(blockhash))
-        return &branchdata.mapHeads[blockhash];
-    if (pBranchCache)// is get data from mempool
-        return pBranchCache->GetBranchBlockData(branchhash, blockhash);
-    return nullptr;
-}
-
 ////---------------------------------------------------------
 //主链获取侧链头工作量
 //核心算法需要和 GetBlockWork 一致
-uint32_t GetBlockHeaderWork(const MCBranchBlockInfo& block, uint256& block_hash, const MCChainParams &params, BranchData& branchdata, BranchCache *pBranchCache)
+uint32_t GetBlockHeaderWork(const MCBranchBlockInfo& block, uint256& block_hash, const MCChainParams &params, const BranchData& branchdata, BranchCache *pBranchCache)
 {
     ///// get and check data
     const MCOutPoint& out = block.prevoutStake;
@@ -1405,98 +1525,17 @@ uint32_t GetBlockHeaderWork(const MCBranchBlockInfo& block, uint256& block_hash,
         }
     }
 
-    if (total >= std::numeric_limits<uint32_t>::max()) {
-        total = std::numeric_limits<uint32_t>::max();
-    }
-
-    // 计算前100个区块的平均值
-    {
-        MCAmount iAvg = 0;
-        const BranchBlockData* ptest = pPreIndex;
-        int i = 0;
-        for (; i < 100; ++i)
-        {
-            if (ptest == NULL)
-            {
-                break;
-            }
-            iAvg += ptest->header.nNonce;
-
-            ptest = GetBranchBlockData(branchdata, ptest->header.hashPrevBlock, params.GetBranchHash(), pBranchCache);
-        }
-        iAvg /= i;
-        if (iAvg > 100 && total > iAvg + iAvg / 20) {
-            total = iAvg + iAvg / 20;
-        }
-    }
-
-    // 计算HASH
-    int nType = SER_GETHASH;
-    int nVersion = PROTOCOL_VERSION;
-    MCHashWriter sheader(nType, nVersion);
-    MCHashWriter snum(nType, nVersion);
-
-    int iCheck2 = 2;
-    int iCheck3 = 3;
-    const BranchBlockData* pNextIndex = pPreIndex;
-    for (int i = 0; i < 1000; ++i)
-    {
-        if (pNextIndex == NULL)
-        {
-            break;
-        }
-        if (i == iCheck2)
-        {
-            iCheck2 *= 2;
-            sheader << pNextIndex->header.GetHash();
-        }
-        if (i == iCheck3)
-        {
-            iCheck3 *= 3;
-            snum << pNextIndex->header.GetHash();
-        }
-
-        pNextIndex = GetBranchBlockData(branchdata, pNextIndex->header.hashPrevBlock, params.GetBranchHash(), pBranchCache);
-    }
-
-    sheader << (uint160)kKey;
-    sheader << out.hash;
-    sheader << out.n;
-
-    snum << (uint160)kKey;
-    block_hash = sheader.GetHash();
-    uint256 num_hash = snum.GetHash();
-
-    // percent 
-    uint64_t iPercent = num_hash.GetCheapHash() % 100;
-    MCAmount iMount = total * iPercent / 100;
-    arith_uint256 iTmp = UintToArith256(block_hash);
-
-    // 计算经过币龄加权之后的HASH
-    if (iMount > 1 && iMount <= total)
-        iTmp /= iMount;
-    if (isBigBoom) {
-        iTmp /= 16;
-    }
-    else {
-        if (iMount == 0) {
-            block_hash = guMaxWork;
-            LogPrintf("%s: block work To MAX WORK, Amount is 0, total %d \n", __func__, total);
-            return 0;
-        }
-    }
-
-    uint32_t iComp = iTmp.GetCompact();
-    iTmp.SetCompact(iComp);
-    block_hash = ArithToUint256(iTmp);
-
-    return total;
+    std::shared_ptr<const StakeKernel> kernel = GetBranchStakeKernel(pPreIndex, params, branchdata, pBranchCache);
+    uint32_t iWork = kernel->GetWork(kKey, out, total, block_hash);
+    if (!isBigBoom && block_hash == guMaxWork)
+        LogPrintf("%s: block work To MAX WORK, Amount is 0, total %d \n", __func__, total);
+    return iWork;
 }
 
 ////---------------------------------------------------------
 //主链检查侧链头工作量
 //核心和 CheckBlockWork 相同
-bool CheckBlockHeaderWork(const MCBranchBlockInfo& block, MCValidationState& state, const MCChainParams &params, BranchData& branchdata, BranchCache *pBranchCache)
+bool CheckBlockHeaderWork(const MCBranchBlockInfo& block, MCValidationState& state, const MCChainParams &params, const BranchData& branchdata, BranchCache *pBranchCache)
 {
     const Consensus::Params& consensusParams = params.GetConsensus();
 
@@ -1645,7 +1684,7 @@ unsigned int GetNextWorkRequired(const MCBlockIndex* pindexLast, const MCBlockHe
 }
 ////---------------------------------------------------------
 //主链上获取侧链的nextwork
-unsigned int GetBranchNextWorkRequired(const BranchBlockData* pindexLast, const MCBlockHeader* pblock, const MCChainParams& params, BranchData &branchdata, BranchCache *pBranchCache)
+unsigned int GetBranchNextWorkRequired(const BranchBlockData* pindexLast, const MCBlockHeader* pblock, const MCChainParams& params, const BranchData &branchdata, BranchCache *pBranchCache)
 {
     const Consensus::Params& consensusParams = params.GetConsensus();
     unsigned int nProofOfWorkLimit = UintToArith256(consensusParams.powLimit).GetCompact();
@@ -1705,7 +1744,7 @@ unsigned int GetBranchNextWorkRequired(const BranchBlockData* pindexLast, const
 }
 ////---------------------------------------------------------
 //主链上验证侧链
-bool BranchContextualCheckBlockHeader(const MCBlockHeader& block, MCValidationState& state, const MCChainParams& params, BranchData &branchdata, 
+bool BranchContextualCheckBlockHeader(const MCBlockHeader& block, MCValidationState& state, const MCChainParams& params, const BranchData &branchdata, 
     int64_t nAdjustedTime, BranchCache *pBranchCache)
 {
     const BranchBlockData* pindexPrev = GetBranchBlockData(branchdata, block.hashPrevBlock, params.GetBranchHash(), pBranchCache);
@@ -2100,19 +2139,21 @@ void BlockAssembler::addReportProofTx(const MCTransactionRef &ptxReport, const M
     if (!g_pBranchDb->HasBranchData(reportbranchid))
         return;
 
-    BranchData branchdata = g_pBranchDb->GetBranchData(reportbranchid);
-    if (!branchdata.mapHeads.count(reportblockhash))// best chain check?
+    const BranchData& branchdata = g_pBranchDb->GetBranchDataView(reportbranchid);
+    const BranchBlockData* pBlockData = branchdata.GetBranchBlockData(reportblockhash);
+    if (pBlockData == nullptr)// best chain check?
         return;
     
     // 从stake交易取出prevout(抵押币)
-    BranchBlockData blockdata = branchdata.mapHeads[reportblockhash];
+    const BranchBlockData& blockdata = *pBlockData;
     uint256 coinfromtxid;
     if (!GetMortgageCoinData(blockdata.pStakeTx->vout[0].scriptPubKey, &coinfromtxid))
         return;
 
     // 检查ptxReport有没有被证明
     uint256 reportFlagHash = GetReportTxHashKey(*ptxReport);
-    if (blockdata.mapReportStatus.count(reportFlagHash) == 0 || blockdata.mapReportStatus[reportFlagHash] == RP_FLAG_PROVED){
+    auto rpit = blockdata.mapReportStatus.find(reportFlagHash);
+    if (rpit == blockdata.mapReportStatus.end() || rpit->second == RP_FLAG_PROVED){
         return;
     }
 
@@ -9,6 +9,8 @@
 
 #include "primitives/block.h"
 #include "transaction/txmempool.h"
+#include "coding/hash.h"
+#include "key/pubkey.h"
 
 #include <stdint.h>
 #include <memory>
@@ -23,6 +25,9 @@ class MCBlockIndex;
 class MCChainParams;
 class MCScript;
 class MCKeyStore;
+class BranchBlockData;
+class BranchData;
+class BranchCache;
 
 namespace Consensus { struct Params; };
 
@@ -196,6 +201,14 @@ public:
     BlockAssembler(const MCChainParams& params);
     BlockAssembler(const MCChainParams& params, const Options& options);
 
+    /**
+     * Split the block transactions into at most nMaxGroup groups for parallel contract execution.
+     * Transactions sharing a tx hash, an input tx or a contract are kept in one group, the first
+     * offset transactions (coinbase, stake...) stay in the first group, and the groups are balanced
+     * by transaction size plus contract running times. Returns block indexes of each group in block order.
+     */
+    static std::vector<std::vector<int>> GroupBlockTransactions(const std::vector<MCTransactionRef>& vtx, int offset, const std::vector<const MCTxMemPoolEntry*>& blockTxEntries, size_t nMaxGroup);
+
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<MCBlockTemplate> CreateNewBlock(const MCScript& scriptPubKeyIn, ContractContext* pContractContext, bool fMineWitnessTx=true, const MCKeyStore* keystoreIn = nullptr, MCCoinsViewCache *pcoinsCache = nullptr);
 
@@ -205,6 +218,8 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(MCTxMemPool::txiter iter, MakeBranchTxUTXO& utxoMaker);
+    /** Add a tx to the block, blockTx is the tx placed in the block for the mempool entry */
+    void AddToBlock(MCTxMemPool::txiter iter, const MCTransactionRef& blockTx);
 
     void GroupingTransaction(int offset, std::vector<const MCTxMemPoolEntry*>& blockTxEntries);
 
@@ -213,6 +228,8 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
+    /** Run the package selection, reused by addPackageTxs while the tip and mempool are unchanged */
+    void selectPackageTxs(int offset, std::vector<const MCTxMemPoolEntry*>& blockTxEntries, int &nPackagesSelected, int &nDescendantsUpdated);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -243,6 +260,70 @@ private:
     bool UpdateIncompleteTx(MCTxMemPool::txiter iter, MakeBranchTxUTXO& utxoMaker);
 };
 
+/**
+ * 权益证明的工作量只与上一个块、矿工公钥和抵押的outpoint有关，与区块内容无关。
+ * 对同一个上一块预先计算前100块的nonce平均值及祖先块哈希的部分哈希状态，
+ * 每个候选输出只需再做两次SHA256结束运算。
+ * 上一块的哈希确定了全部祖先，上下文按块哈希缓存(见GetStakeKernel)，
+ * 由矿工筛选输出、CheckBlockWork和主链检查侧链头工作量共用。
+ */
+class StakeKernel
+{
+public:
+    explicit StakeKernel(const MCBlockIndex* pindexPrev);
+    // 主链上的侧链头数据，祖先不全时IsComplete()为false
+    StakeKernel(const BranchBlockData* pPrev, const MCChainParams& params, const BranchData& branchdata, BranchCache* pBranchCache);
+
+    // 侧链传世块后的首块需要读取区块内的交易计算币龄，不能预先计算
+    bool IsBranchFirstBlock() const { return fBranchFirstBlock; }
+    bool IsBigBoom() const { return isBigBoom; }
+    // 祖先已遍历完整，结果只与上一块哈希有关，可以缓存
+    bool IsComplete() const { return fComplete; }
+    // 从pcoinsTip读取抵押币计算币龄，大爆炸阶段为0
+    MCAmount GetStakeAmount(const MCOutPoint& out) const;
+    // 按已取出的抵押币计算币龄，不访问pcoinsTip
+    MCAmount GetStakeAmount(const Coin& coin) const;
+    // 返回值与区块的nNonce对应，block_hash为币龄加权后的工作量哈希
+    uint32_t GetWork(const MCKeyID& key, const MCOutPoint& out, MCAmount total, uint256& block_hash) const;
+
+    static const int MAX_ANCESTORS = 1000;  // 参与哈希的祖先范围
+    static const int NONCE_AVG_BLOCKS = 100;
+
+private:
+    int iPrevHeight;
+    bool isBigBoom;
+    bool fBranchFirstBlock;
+    bool fComplete;
+    MCAmount iAvgNonce;
+    int nNonceCount;
+    int iCheck2;
+    int iCheck3;
+    MCHashWriter sheader;   // 已写入高度差为2^k的祖先块哈希
+    MCHashWriter snum;      // 已写入高度差为3^k的祖先块哈希
+
+    // 按距离上一块从近到远依次加入祖先，i为距离，只在需要时计算块哈希
+    template <typename GetHashFunc>
+    void AddAncestor(int i, uint32_t nNonce, GetHashFunc getHash)
+    {
+        if (i < NONCE_AVG_BLOCKS) {
+            iAvgNonce += nNonce;
+            ++nNonceCount;
+        }
+        if (i == iCheck2) {
+            iCheck2 *= 2;
+            sheader << getHash();
+        }
+        if (i == iCheck3) {
+            iCheck3 *= 3;
+            snum << getHash();
+        }
+    }
+};
+
+// 取得上一块的工作量上下文，按块哈希缓存
+std::shared_ptr<const StakeKernel> GetStakeKernel(const MCBlockIndex* pindexPrev);
+uint32_t GetBlockWork(const MCBlock& block, const MCOutPoint& out, uint256& block_hash);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(MCBlock* pblock, const MCBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(MCBlockHeader* pblock, const Consensus::Params& consensusParams, const MCBlockIndex* pindexPrev);
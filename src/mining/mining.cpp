@@ -161,7 +161,79 @@ bool SignBlock(MCBlock *pblock, MCKeyStore* keystore)
 	return true;
 }
 
-UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutput, int nGenerate, uint64_t nMaxTries, bool keepScript, GenerateBlockCB pf, MCChainParams* params, MCCoinsViewCache *pcoinsCache)
+// 候选输出计算工作量所需的数据，抵押币在cs_main下从pcoinsTip取出
+struct StakeCandidate
+{
+    size_t nIndex;
+    MCKeyID keyid;
+    MCOutPoint outpoint;
+    MCAmount nTotal;
+};
+
+static const size_t STAKE_KERNELS_PER_THREAD = 2048;
+
+// 在组装区块前对所有候选输出计算权益工作量，组装区块(选交易、执行合约、签名、TestBlockValidity)代价很高，
+// 只为工作量可能满足难度的输出构建区块。工作量只与上一块有关，tip变化时重新计算。
+// 无法预先计算的输出(大爆炸阶段的预留公钥、侧链传世块后的首块、非公钥脚本)记为0，总是尝试构建。
+// cs_main只在读取抵押币时持有，哈希计算不持锁，输出很多时分给多个线程
+static void EvalStakeKernels(const std::vector<MCOutput>& vecOutput, bool fBranch, const MCBlockIndex* pindexPrev, std::vector<uint256>& vecKernelHash)
+{
+    vecKernelHash.assign(vecOutput.size(), uint256());
+
+    std::shared_ptr<const StakeKernel> kernel;
+    std::vector<StakeCandidate> vecCandidate;
+    vecCandidate.reserve(vecOutput.size());
+    {
+        LOCK(cs_main);
+        kernel = GetStakeKernel(pindexPrev);
+        if (kernel->IsBranchFirstBlock())
+            return;
+
+        for (size_t i = 0; i < vecOutput.size(); ++i) {
+            const MCOutput& out = vecOutput[i];
+            if (out.tx == nullptr)
+                continue;
+
+            const MCScript& scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
+            MCKeyID keyid;
+            if (fBranch) {
+                if (!GetMortgageCoinData(scriptPubKey, nullptr, &keyid))
+                    continue;
+            }
+            else {
+                MCTxDestination dest;
+                if (!ExtractDestination(scriptPubKey, dest) || dest.type() != typeid(MCKeyID))
+                    continue;
+                keyid = boost::get<MCKeyID>(dest);
+            }
+
+            MCOutPoint outpoint(out.tx->tx->GetHash(), out.i);
+            Coin coin;
+            MCAmount nTotal = (pcoinsTip->GetCoin(outpoint, coin) ? kernel->GetStakeAmount(coin) : 0);
+            vecCandidate.push_back({ i, keyid, outpoint, nTotal });
+        }
+    }
+
+    auto evalRange = [&kernel, &vecCandidate, &vecKernelHash](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; ++i) {
+            const StakeCandidate& candidate = vecCandidate[i];
+            kernel->GetWork(candidate.keyid, candidate.outpoint, candidate.nTotal, vecKernelHash[candidate.nIndex]);
+        }
+    };
+    size_t nThreads = std::min<size_t>(std::max(GetNumCores(), 1), vecCandidate.size() / STAKE_KERNELS_PER_THREAD);
+    if (nThreads <= 1) {
+        evalRange(0, vecCandidate.size());
+        return;
+    }
+
+    boost::thread_group threadGroup;
+    size_t nPerThread = (vecCandidate.size() + nThreads - 1) / nThreads;
+    for (size_t nBegin = 0; nBegin < vecCandidate.size(); nBegin += nPerThread)
+        threadGroup.create_thread(std::bind(evalRange, nBegin, std::min(vecCandidate.size(), nBegin + nPerThread)));
+    threadGroup.join_all();
+}
+
+UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutput, int nGenerate, uint64_t nMaxTries, bool keepScript, GenerateBlockCB pf, MCChainParams* params, MCCoinsViewCache *pcoinsCache, StakeMinerStats* pStats)
 {
 	if( vecOutput.empty() )
 		throw JSONRPCError(RPC_INTERNAL_ERROR, "no address with enough coins\n");
@@ -183,14 +255,50 @@ UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutput,
 	uint64_t nTries = 0;
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
+
+    const bool fBranch = (params && !params->IsMainChain()) || !Params().IsMainChain();
+    std::vector<uint256> vecKernelHash;
+    uint256 hashKernelTip;
+    int64_t nTargetTime = 0;
+    arith_uint256 bnTarget;
     while (nHeight < nHeightEnd && nTries < nMaxTries && !ShutdownRequested())
     {
         if (nTries != 0 && nTries % 500 == 0)
             boost::this_thread::interruption_point();
 
+        size_t nOut = nTries % vecOutput.size();
+        const MCBlockIndex* pindexPrev = nullptr;
+        {
+            LOCK(cs_main);
+            pindexPrev = chainActive.Tip();
+            // 与CreateNewBlock中UpdateTime/GetNextWorkRequired得到的难度一致
+            int64_t nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
+            if (nTime != nTargetTime || pindexPrev->GetBlockHash() != hashKernelTip) {
+                MCBlockHeader header;
+                header.nTime = nTime;
+                bnTarget.SetCompact(GetNextWorkRequired(pindexPrev, &header, Params().GetConsensus()));
+                nTargetTime = nTime;
+            }
+        }
+        // 块索引不会释放，工作量在cs_main之外计算，期间tip变化时下一次循环重新计算
+        if (pindexPrev->GetBlockHash() != hashKernelTip) {
+            int64_t nStart = GetTimeMicros();
+            EvalStakeKernels(vecOutput, fBranch, pindexPrev, vecKernelHash);
+            hashKernelTip = pindexPrev->GetBlockHash();
+            if (pStats)
+                pStats->nKernels += vecKernelHash.size();
+            LogPrint(BCLog::MINING, "%s: eval %u stake kernels at height %d: %.2fms\n", __func__, vecKernelHash.size(), pindexPrev->nHeight, 0.001 * (GetTimeMicros() - nStart));
+        }
+        if (UintToArith256(vecKernelHash[nOut]) > bnTarget) {
+            nTries++;
+            continue;
+        }
+        if (pStats)
+            ++pStats->nHits;
+
         int64_t startTime = GetTimeMillis();
         // check script pubkey
-        MCOutput& out = vecOutput[nTries % vecOutput.size()];
+        MCOutput& out = vecOutput[nOut];
         std::shared_ptr<MCReserveKey> pReserveKey = nullptr;
         MCScript scriptPubKey;
         if (out.tx == nullptr) {
@@ -206,7 +314,7 @@ UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutput,
         else {
             scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
             //get branch chain mine pubkey
-            if ((params && !params->IsMainChain()) || !Params().IsMainChain()) {
+            if (fBranch) {
                 MCKeyID keyid;
                 uint256 coinpreouthash;
                 if (!GetMortgageCoinData(scriptPubKey, &coinpreouthash, &keyid)) {
@@ -267,6 +375,8 @@ UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutput,
                 throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
             ++nHeight;
             blockHashes.push_back(pblock->GetHash().GetHex());
+            if (pStats)
+                ++pStats->nBlocks;
             if (pReserveKey)
                 pReserveKey->KeepKey();
         }
@@ -582,6 +692,15 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"stakethreads\": [          (array) Built-in miner threads started by -gen/-genproclimit\n"
+            "    {\n"
+            "      \"thread\": n,             (numeric) Thread index\n"
+            "      \"outputs\": n,            (numeric) Stake outputs in this thread's shard\n"
+            "      \"kernels\": n,            (numeric) Stake kernels evaluated\n"
+            "      \"hits\": n,               (numeric) Kernels that met the target\n"
+            "      \"blocks\": n              (numeric) Blocks accepted\n"
+            "    }, ...\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -600,6 +719,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.Size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+    obj.push_back(Pair("stakethreads",     GetStakeMinerStats()));
     return obj;
 }
 
@@ -8,15 +8,27 @@
 
 #include "script/script.h"
 
+#include <atomic>
+
 class MCKeyStore;
 class MCOutput;
 class UniValue;
 
+/** 内置挖矿线程的统计，在getmininginfo中按线程输出 */
+struct StakeMinerStats
+{
+    std::atomic<uint64_t> nOutputs{0};      // 分到本线程的候选币数
+    std::atomic<uint64_t> nKernels{0};      // 计算过的kernel数
+    std::atomic<uint64_t> nHits{0};         // 达到难度的kernel数
+    std::atomic<uint64_t> nBlocks{0};       // 被接受的块数
+};
+
 typedef void(*GenerateBlockCB)();
 /** Generate blocks (mine) */
-UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutputs, int nGenerate, uint64_t nMaxTries, bool keepScript, GenerateBlockCB pf = nullptr, MCChainParams* pp = nullptr, MCCoinsViewCache *pcoinsCache = nullptr );
+UniValue generateBlocks(MCWallet* keystoreIn, std::vector<MCOutput>& vecOutputs, int nGenerate, uint64_t nMaxTries, bool keepScript, GenerateBlockCB pf = nullptr, MCChainParams* pp = nullptr, MCCoinsViewCache *pcoinsCache = nullptr, StakeMinerStats* pStats = nullptr);
 
 void GenerateMCs(bool fGenerate, int nThreads, const MCChainParams& chainparams);
+UniValue GetStakeMinerStats();
 
 
 /** Check bounds on a command line confirm target */
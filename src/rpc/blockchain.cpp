@@ -23,6 +23,7 @@
 #include "thread/sync.h"
 #include "transaction/txdb.h"
 #include "transaction/txmempool.h"
+#include "smartcontract/contractdb.h"
 #include "utils/util.h"
 #include "utils/utilstrencodings.h"
 #include "coding/hash.h"
@@ -1434,6 +1435,42 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getcontractdbinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getcontractdbinfo\n"
+            "\nReturns details on the contract data cache and the per-block contract data flush.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"contracts\": xxxxx,          (numeric) Number of contracts in the data cache\n"
+            "  \"usage\": xxxxx,              (numeric) Estimated memory usage of the data cache\n"
+            "  \"flushes\": xxxxx,            (numeric) Number of blocks whose contract data was flushed\n"
+            "  \"lastflushcontracts\": xxxxx, (numeric) Contracts visited by the last flush\n"
+            "  \"lastflushtime\": xxxxx,      (numeric) Duration of the last flush in microseconds\n"
+            "  \"maxflushtime\": xxxxx,       (numeric) Longest flush in microseconds\n"
+            "  \"totalflushtime\": xxxxx      (numeric) Total flush time in microseconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcontractdbinfo", "")
+            + HelpExampleRpc("getcontractdbinfo", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    if (mpContractDb == nullptr)
+        return ret;
+
+    ContractFlushStats stats = mpContractDb->GetFlushStats();
+    ret.push_back(Pair("contracts", (int64_t)mpContractDb->ContractDataCount()));
+    ret.push_back(Pair("usage", (int64_t)mpContractDb->ContractDataUsage()));
+    ret.push_back(Pair("flushes", (int64_t)stats.nFlushes));
+    ret.push_back(Pair("lastflushcontracts", (int64_t)stats.nLastContracts));
+    ret.push_back(Pair("lastflushtime", stats.nLastTime));
+    ret.push_back(Pair("maxflushtime", stats.nMaxTime));
+    ret.push_back(Pair("totalflushtime", stats.nTotalTime));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1630,6 +1667,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
+    { "blockchain",         "getcontractdbinfo",      &getcontractdbinfo,      true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
@@ -40,6 +40,7 @@
 #include <sstream>
 
 #include "chain/branchdb.h"
+#include "chain/branchsendqueue.h"
 
 //创建侧链抵押金计算
 MCAmount GetCreateBranchMortgage(const MCBlock* pBlock, const MCBlockIndex* pBlockIndex)
@@ -2300,6 +2301,33 @@ UniValue getprovetxdata(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getbranchsendqueueinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+                "getbranchsendqueueinfo\n"
+                "\nReturns the state of the queue of requests waiting to be sent to other chains.\n"
+                "\nResult:\n"
+                "{\n"
+                "  \"size\": n,             (numeric) Requests in the queue\n"
+                "  \"chains\": {...},       (json object) Requests in the queue per target chain\n"
+                "  \"oldest\": n,           (numeric) Age in seconds of the oldest request\n"
+                "  \"sent\": n,             (numeric) Requests accepted by the target chain\n"
+                "  \"failed\": n,           (numeric) Requests rejected by the target chain, including retries\n"
+                "  \"dropped\": n,          (numeric) Requests dropped after too many rejections\n"
+                "  \"lastlatency\": n,      (numeric) Milliseconds from enqueue to acceptance of the last request\n"
+                "  \"avglatency\": n        (numeric) Average milliseconds from enqueue to acceptance\n"
+                "}\n"
+                "\nExamples:\n"
+                + HelpExampleCli("getbranchsendqueueinfo", "")
+                + HelpExampleRpc("getbranchsendqueueinfo", "")
+                );
+
+    if (!g_branchSendQueue)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Branch send queue is not started");
+    return g_branchSendQueue->GetInfo();
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                         actor (function)              okSafeMode
     //  --------------------- ------------------------     -----------------------       ----------
@@ -2316,6 +2344,7 @@ static const CRPCCommand commands[] =
     { "branchchain",        "submitbranchblockinfo",     &submitbranchblockinfo,       true, {"tx_hex_data"}},
     { "branchchain",        "getbranchchainheight",      &getbranchchainheight,        false,{ "branchid" } },
     { "branchchain",        "resendbranchchainblockinfo",&resendbranchchainblockinfo,  false,{ "height" } },
+    { "branchchain",        "getbranchsendqueueinfo",    &getbranchsendqueueinfo,      true, {} },
 
     { "branchchain",        "redeemmortgagecoinstatement",&redeemmortgagecoinstatement,false, {"txid", "voutindex"}},
     { "branchchain",        "redeemmortgagecoin",        &redeemmortgagecoin,          false,{ "txid", "voutindex" } },
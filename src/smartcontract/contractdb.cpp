@@ -3,6 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 
 #include "smartcontract/contractdb.h"
 #include "coding/base58.h"
@@ -93,9 +97,213 @@ void ContractContext::ClearAll()
     ClearData();
 }
 
+ContractCode::ContractCode(const std::string& rawCodeIn, std::string&& codeIn)
+    : rawCodeSize(rawCodeIn.size()), code(std::move(codeIn))
+{
+}
+
+ContractCodeCache::ContractCodeCache(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn), nSize(0)
+{
+}
+
+void ContractCodeCache::EraseEntry(std::map<MCContractID, LRU_LIST::iterator>::iterator it)
+{
+    const ContractCodeRef& entry = it->second->second;
+    nSize -= entry->code.size();
+    lruList.erase(it->second);
+    mapCode.erase(it);
+}
+
+ContractCodeRef ContractCodeCache::Get(const MCContractID& contractId, const std::string& rawCode)
+{
+    LOCK(cs);
+    auto it = mapCode.find(contractId);
+    if (it == mapCode.end())
+        return nullptr;
+
+    // 合约ID已绑定代码哈希，长度不一致说明调用方传入的代码有误，视为未命中
+    if (it->second->second->rawCodeSize != rawCode.size()) {
+        EraseEntry(it);
+        return nullptr;
+    }
+
+    lruList.splice(lruList.begin(), lruList, it->second);
+    return it->second->second;
+}
+
+ContractCodeRef ContractCodeCache::Insert(const MCContractID& contractId, const std::string& rawCode, std::string&& code)
+{
+    ContractCodeRef entry = std::make_shared<const ContractCode>(rawCode, std::move(code));
+    size_t entrySize = entry->code.size();
+
+    LOCK(cs);
+    auto it = mapCode.find(contractId);
+    if (it != mapCode.end())
+        EraseEntry(it);
+
+    if (entrySize > nMaxSize)
+        return entry;
+
+    while (nSize + entrySize > nMaxSize && !lruList.empty())
+        EraseEntry(mapCode.find(lruList.back().first));
+
+    lruList.emplace_front(contractId, entry);
+    mapCode[contractId] = lruList.begin();
+    nSize += entrySize;
+    return entry;
+}
+
+void ContractCodeCache::Erase(const MCContractID& contractId)
+{
+    LOCK(cs);
+    auto it = mapCode.find(contractId);
+    if (it != mapCode.end())
+        EraseEntry(it);
+}
+
+void ContractCodeCache::Clear()
+{
+    LOCK(cs);
+    mapCode.clear();
+    lruList.clear();
+    nSize = 0;
+}
+
+size_t ContractCodeCache::Size() const
+{
+    LOCK(cs);
+    return mapCode.size();
+}
+
+size_t ContractCodeCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nSize;
+}
+
+size_t DBContractInfo::DynamicMemoryUsage() const
+{
+    size_t usage = sizeof(DBContractInfo) + code.capacity();
+    for (const auto& item : items) {
+        usage += sizeof(item) + 4 * sizeof(void*);     // map结点
+        usage += item.second.vecBlockHash.capacity() * sizeof(uint256);
+        usage += item.second.vecBlockContractData.capacity() * sizeof(std::string);
+        for (const std::string& data : item.second.vecBlockContractData)
+            usage += data.capacity();
+        usage += item.second.vecDataDepth.capacity() * sizeof(uint16_t);
+    }
+    return usage;
+}
+
+static const size_t MIN_COMPRESS_SIZE = 128;
+
+static std::string CompressData(const std::string& buffer)
+{
+    std::string zipData;
+    boost::iostreams::filtering_ostream zout(boost::iostreams::zlib_compressor(boost::iostreams::zlib::best_speed) | boost::iostreams::back_inserter(zipData));
+    boost::iostreams::copy(boost::make_iterator_range(buffer), zout);
+    return zipData;
+}
+
+static bool DecompressData(const std::string& buffer, std::string& unzipData)
+{
+    try {
+        unzipData.clear();
+        boost::iostreams::filtering_ostream uzout(boost::iostreams::zlib_decompressor() | boost::iostreams::back_inserter(unzipData));
+        boost::iostreams::copy(boost::make_iterator_range(buffer), uzout);
+    }
+    catch (const boost::iostreams::zlib_error& e) {
+        return false;
+    }
+    return true;
+}
+
+ContractDataRecord ContractDataRecord::Encode(const std::string& data, const std::string* base, const uint256& baseBlockHash, uint16_t baseDepth, bool compress)
+{
+    ContractDataRecord record;
+    if (base != nullptr && baseDepth < MAX_CONTRACT_DATA_DELTA_DEPTH) {
+        size_t maxLen = std::min(base->size(), data.size());
+        size_t prefixLen = 0;
+        while (prefixLen < maxLen && (*base)[prefixLen] == data[prefixLen])
+            ++prefixLen;
+        size_t suffixLen = 0;
+        while (suffixLen < maxLen - prefixLen && (*base)[base->size() - 1 - suffixLen] == data[data.size() - 1 - suffixLen])
+            ++suffixLen;
+
+        // 差异不到数据的一半时才保存差异
+        size_t deltaLen = data.size() - prefixLen - suffixLen;
+        if (deltaLen * 2 < data.size()) {
+            record.flags = FLAG_DELTA;
+            record.depth = baseDepth + 1;
+            record.baseBlockHash = baseBlockHash;
+            record.prefixLen = prefixLen;
+            record.suffixLen = suffixLen;
+            record.payload = data.substr(prefixLen, deltaLen);
+        }
+    }
+    if (!(record.flags & FLAG_DELTA))
+        record.payload = data;
+
+    if (compress && record.payload.size() >= MIN_COMPRESS_SIZE) {
+        std::string zipData = CompressData(record.payload);
+        if (zipData.size() < record.payload.size()) {
+            record.flags |= FLAG_COMPRESSED;
+            record.payload = std::move(zipData);
+        }
+    }
+    return record;
+}
+
+bool ContractDataRecord::Decode(const std::string& base, std::string& data) const
+{
+    std::string content;
+    if (flags & FLAG_COMPRESSED) {
+        if (!DecompressData(payload, content))
+            return false;
+    }
+    else {
+        content = payload;
+    }
+
+    if (!(flags & FLAG_DELTA)) {
+        data = std::move(content);
+        return true;
+    }
+
+    if ((uint64_t)prefixLen + suffixLen > base.size())
+        return false;
+    std::string result;
+    result.reserve(prefixLen + content.size() + suffixLen);
+    result.append(base, 0, prefixLen);
+    result.append(content);
+    result.append(base, base.size() - suffixLen, suffixLen);
+    data = std::move(result);
+    return true;
+}
+
+// 旧格式的合约数据，整块存储
+static uint256 ContractDataKey(const MCContractID& contractId, const uint256& blockHash)
+{
+    MCHashWriter keyHash(SER_GETHASH, 0);
+    keyHash << contractId << blockHash;
+    return keyHash.GetHash();
+}
+
+static uint256 ContractRecordKey(const MCContractID& contractId, const uint256& blockHash)
+{
+    MCHashWriter keyHash(SER_GETHASH, 0);
+    keyHash << 'r' << contractId << blockHash;
+    return keyHash.GetHash();
+}
+
 ContractDataDB::ContractDataDB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
-    : db(path, nCacheSize, fMemory, fWipe, true), writeBatch(db), removeBatch(db), threadPool(boost::thread::hardware_concurrency())
+    : db(path, nCacheSize, fMemory, fWipe, true), writeBatch(db), removeBatch(db), threadPool(boost::thread::hardware_concurrency()),
+    codeCache(DEFAULT_CONTRACT_CODE_CACHE_SIZE)
 {
+    int64_t nContractDataCache = std::max<int64_t>(gArgs.GetArg("-contractdatacache", DEFAULT_CONTRACT_DATA_CACHE), 1) << 20;
+    nMaxShardUsage = nContractDataCache / CONTRACT_DATA_SHARD_NUM;
+    fCompressData = gArgs.GetBoolArg("-contractdatacompress", DEFAULT_CONTRACT_DATA_COMPRESS);
+
     for (int i = 0; i < threadPool.size(); ++i) {
         threadPool.schedule(boost::bind(InitializeThread, this));
     }
@@ -110,7 +318,7 @@ void ContractDataDB::InitializeThread(ContractDataDB* contractDB)
     boost::this_thread::sleep(boost::posix_time::milliseconds(200));
 }
 
-void ContractDataDB::ExecutiveTransactionContract(MCBlock* pBlock, SmartContractThreadData* threadData)
+SmartLuaState* ContractDataDB::GetThreadSmartLuaState()
 {
     auto it = threadId2SmartLuaState.find(boost::this_thread::get_id());
     if (it == threadId2SmartLuaState.end()) {
@@ -121,6 +329,335 @@ void ContractDataDB::ExecutiveTransactionContract(MCBlock* pBlock, SmartContract
     if (sls == nullptr) {
         throw std::runtime_error(strprintf("%s:%d sls == nullptr\n", __FUNCTION__, __LINE__));
     }
+    return sls;
+}
+
+ContractDataDB::ContractDataShard& ContractDataDB::GetShard(const MCContractID& contractId)
+{
+    return contractData[*contractId.begin() % CONTRACT_DATA_SHARD_NUM];
+}
+
+// 取得缓存中的合约数据，不存在时从磁盘加载，磁盘中也没有时返回空的数据项，需持有shard.cs
+ContractDataDB::ContractDataEntry& ContractDataDB::LoadContractData(ContractDataShard& shard, const MCContractID& contractId)
+{
+    auto it = shard.contracts.find(contractId);
+    if (it != shard.contracts.end())
+        return it->second;
+
+    ContractDataEntry& entry = shard.contracts[contractId];
+    db.Read(contractId, entry.info);
+    shard.lruList.emplace_front(contractId);
+    entry.lruIt = shard.lruList.begin();
+    UpdateContractUsage(shard, entry);
+    TrackContractInfo(shard, contractId, entry.info);
+    return entry;
+}
+
+// 登记合约某高度的数据，该高度进入确认或移除范围时需要处理，需持有shard.cs
+void ContractDataDB::TrackContractHeight(ContractDataShard& shard, const MCContractID& contractId, int height)
+{
+    shard.pendingConfirm[height].insert(contractId);
+    shard.pendingRemove[height].insert(contractId);
+}
+
+// 从磁盘加载的合约可能有上次运行时未处理完的高度，全部重新登记，需持有shard.cs
+void ContractDataDB::TrackContractInfo(ContractDataShard& shard, const MCContractID& contractId, const DBContractInfo& info)
+{
+    for (const auto& item : info.items)
+        TrackContractHeight(shard, contractId, item.first);
+}
+
+// 读取某高度的所有分叉区块哈希，读过之后只在内存中维护，修改前须先读取
+void ContractDataDB::LoadHeightHashes(const MCContractID& contractId, DBContractInfoByHeight& item)
+{
+    if (item.loaded)
+        return;
+
+    MCHashWriter keyHeightHash(SER_GETHASH, 0);
+    keyHeightHash << contractId << item.blockHeight;
+    db.Read(keyHeightHash.GetHash(), item.vecBlockHash);
+    item.vecBlockContractData.resize(item.vecBlockHash.size());
+    item.vecDataDepth.resize(item.vecBlockHash.size(), UNKNOWN_DATA_DEPTH);
+    item.loaded = true;
+}
+
+// 读取合约某版本的数据，差异记录沿差异链读到完整版本后依次还原，不需持有锁
+bool ContractDataDB::ReadContractData(const MCContractID& contractId, const uint256& blockHash, std::string& data, uint16_t& depth)
+{
+    std::vector<ContractDataRecord> records;
+    uint256 hash = blockHash;
+    data.clear();
+    while (true) {
+        ContractDataRecord record;
+        if (!db.Read(ContractRecordKey(contractId, hash), record)) {
+            if (!db.Read(ContractDataKey(contractId, hash), data))
+                return false;
+            break;
+        }
+
+        bool delta = (record.flags & ContractDataRecord::FLAG_DELTA);
+        hash = record.baseBlockHash;
+        records.emplace_back(std::move(record));
+        if (!delta)
+            break;
+        if (records.size() > MAX_CONTRACT_DATA_DELTA_DEPTH)
+            return false;
+    }
+
+    for (auto it = records.rbegin(); it != records.rend(); ++it) {
+        if (!it->Decode(data, data))
+            return false;
+    }
+    depth = (records.empty() ? 0 : records.front().depth);
+    return true;
+}
+
+// 重新估算合约数据的内存占用，touch时移到LRU最前，需持有shard.cs
+void ContractDataDB::UpdateContractUsage(ContractDataShard& shard, ContractDataEntry& entry, bool touch)
+{
+    size_t usage = entry.info.DynamicMemoryUsage();
+    shard.usage = shard.usage - entry.usage + usage;
+    entry.usage = usage;
+    if (touch)
+        shard.lruList.splice(shard.lruList.begin(), shard.lruList, entry.lruIt);
+}
+
+// 超出大小限制时从最久未使用的合约开始淘汰，跳过有未存盘修改的合约，需持有shard.cs
+void ContractDataDB::EvictContractData(ContractDataShard& shard)
+{
+    auto it = shard.lruList.end();
+    while (shard.usage > nMaxShardUsage && it != shard.lruList.begin()) {
+        --it;
+        if (it == shard.lruList.begin())
+            break;  // 保留最近使用的合约，避免刚读入的数据立即被淘汰
+        auto ci = shard.contracts.find(*it);
+        assert(ci != shard.contracts.end());
+        if (ci->second.dirty)
+            continue;
+
+        shard.usage -= ci->second.usage;
+        shard.contracts.erase(ci);
+        it = shard.lruList.erase(it);
+    }
+}
+
+size_t ContractDataDB::ContractDataCount() const
+{
+    size_t count = 0;
+    for (const ContractDataShard& shard : contractData) {
+        LOCK(shard.cs);
+        count += shard.contracts.size();
+    }
+    return count;
+}
+
+size_t ContractDataDB::ContractDataUsage() const
+{
+    size_t usage = 0;
+    for (const ContractDataShard& shard : contractData) {
+        LOCK(shard.cs);
+        usage += shard.usage;
+    }
+    return usage;
+}
+
+ContractFlushStats ContractDataDB::GetFlushStats() const
+{
+    LOCK(cs_cache);
+    return flushStats;
+}
+
+ContractRunStats ContractDataDB::GetRunStats() const
+{
+    LOCK(cs_cache);
+    return runStats;
+}
+
+// 校验合约执行的输出与交易一致
+bool static CheckContractTxOut(const MCTransaction& tx, MCAmount contractOut, const std::vector<MCTxOut>& recipients)
+{
+    if (tx.nVersion == MCTransaction::PUBLISH_CONTRACT_VERSION)
+        return (tx.pContractData->amountOut == 0 && contractOut == 0);
+
+    if (tx.pContractData->amountOut != contractOut) {
+        LogPrintf("%s:%d => amount not match\n", __FUNCTION__, __LINE__);
+        return false;
+    }
+
+    if (tx.pContractData->amountOut > 0 && recipients.size() == 0) {
+        LogPrintf("%s:%d => tx->pContractData->amountOut > 0 && recipients.size() == 0\n", __FUNCTION__, __LINE__);
+        return false;
+    }
+
+    MCAmount total = 0;
+    for (int j = 0; j < recipients.size(); ++j) {
+        if (!tx.IsExistVout(recipients[j])) {
+            LogPrintf("%s:%d => vout not exist\n", __FUNCTION__, __LINE__);
+            return false;
+        }
+        total += recipients[j].nValue;
+    }
+
+    if (total != tx.pContractData->amountOut) {
+        LogPrintf("%s:%d => amount not match\n", __FUNCTION__, __LINE__);
+        return false;
+    }
+    return true;
+}
+
+// 执行单笔合约交易并校验输出，数据写入pContractContext的cache中，不修改合约余额
+bool static ExecuteContractTx(SmartLuaState* sls, const MCTransaction& tx, int txIndex, int blockHeight, MCBlockIndex* pPrevBlockIndex,
+    ContractContext* pContractContext, CoinAmountCache* pCoinAmountCache)
+{
+    MCContractID contractId = tx.pContractData->address;
+    MagnaChainAddress contractAddr(contractId);
+    MagnaChainAddress senderAddr(tx.pContractData->sender.GetID());
+    MCAmount amount = GetTxContractOut(tx);
+
+    UniValue ret(UniValue::VARR);
+    if (tx.nVersion == MCTransaction::PUBLISH_CONTRACT_VERSION) {
+        std::string rawCode = tx.pContractData->codeOrFunc;
+        sls->Initialize(true, pPrevBlockIndex->GetBlockTime(), blockHeight, txIndex, senderAddr,
+            pContractContext, pPrevBlockIndex, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
+        if (!PublishContract(sls, contractAddr, rawCode, ret, true) || !CheckContractTxOut(tx, sls->contractOut, sls->recipients)) {
+            LogPrintf("%s:%d => publish contract fail\n", __FUNCTION__, __LINE__);
+            return false;
+        }
+    }
+    else if (tx.nVersion == MCTransaction::CALL_CONTRACT_VERSION) {
+        const std::string& strFuncName = tx.pContractData->codeOrFunc;
+        UniValue args;
+        args.read(tx.pContractData->args);
+
+        sls->Initialize(false, pPrevBlockIndex->GetBlockTime(), blockHeight, txIndex, senderAddr, pContractContext,
+            pPrevBlockIndex, SmartLuaState::SAVE_TYPE_CACHE, pCoinAmountCache);
+        if (!CallContract(sls, contractAddr, amount, strFuncName, args, ret)) {
+            LogPrintf("%s:%d => call contract fail\n", __FUNCTION__, __LINE__);
+            return false;
+        }
+
+        if (!CheckContractTxOut(tx, sls->contractOut, sls->recipients))
+            return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<const SmartContractTxResult> MakeContractTxResult(SmartLuaState* sls, const CONTRACT_DATA& writeSet)
+{
+    std::shared_ptr<SmartContractTxResult> result = std::make_shared<SmartContractTxResult>();
+    result->success = true;
+    result->readContracts = sls->contractIds;
+    for (auto& item : sls->contractDataFrom)
+        result->readContracts.insert(item.first);
+    result->readContracts.insert(sls->kvKeyIds.begin(), sls->kvKeyIds.end());
+    result->coinAmountFrom = sls->coinAmountFrom;
+    result->contractDataFrom = sls->contractDataFrom;
+    result->writeSet = writeSet;
+    result->timestamp = sls->timestamp;
+    result->blockHeight = sls->blockHeight;
+    result->contractOut = sls->contractOut;
+    result->recipients = sls->recipients;
+    return result;
+}
+
+/**
+ * 内存池中执行的结果在执行环境(区块时间、高度)、读到的合约代码与数据及合约余额都不变时直接采用，不再执行lua。
+ * 读过但不存在的合约(如发布时)在重放时也必须不存在。写集中的txIndex及读到版本的blockHash按当前状态重新填写。
+ */
+bool ContractDataDB::ReplayTransactionContract(const MCTransaction& tx, int txIndex, const SmartContractTxResult& result,
+    SmartContractThreadData* threadData, std::map<MCContractID, ContractInfo>& contractDataFrom)
+{
+    if (!result.success || result.timestamp != threadData->pPrevBlockIndex->GetBlockTime() || result.blockHeight != threadData->blockHeight)
+        return false;
+
+    for (auto& item : result.coinAmountFrom) {
+        if (threadData->pCoinAmountCache == nullptr || threadData->pCoinAmountCache->GetAmount(item.first) != item.second)
+            return false;
+    }
+
+    std::map<MCContractID, ContractInfo> current;
+    for (const MCContractID& contractId : result.readContracts) {
+        ContractInfo contractInfo;
+        bool exist = threadData->contractContext.GetData(contractId, contractInfo) ||
+            GetContractInfo(contractId, contractInfo, threadData->pPrevBlockIndex) >= 0;
+        auto it = result.contractDataFrom.find(contractId);
+        if (it == result.contractDataFrom.end()) {
+            if (exist)
+                return false;
+            continue;
+        }
+        if (!exist || contractInfo.code != it->second.code || contractInfo.data != it->second.data)
+            return false;
+        current[contractId] = std::move(contractInfo);
+    }
+
+    if (!CheckContractTxOut(tx, result.contractOut, result.recipients))
+        return false;
+
+    CONTRACT_DATA writeSet = result.writeSet;
+    for (auto& item : writeSet) {
+        item.second.txIndex = txIndex;
+        auto it = current.find(item.first);
+        if (it != current.end())
+            item.second.blockHash = it->second.blockHash;
+    }
+    threadData->contractContext.cache = std::move(writeSet);
+    contractDataFrom = std::move(current);
+    return true;
+}
+
+// 预执行结果在提交时是否仍然有效
+bool static IsTxResultValid(const SmartContractTxResult& result, const ContractContext& contractContext, CoinAmountCache* pCoinAmountCache)
+{
+    if (!result.success)
+        return false;
+
+    // 组内之前的交易修改过读到的合约
+    for (const MCContractID& contractId : result.readContracts) {
+        if (contractContext.data.count(contractId) > 0)
+            return false;
+    }
+
+    for (auto& item : result.coinAmountFrom) {
+        if (pCoinAmountCache == nullptr || pCoinAmountCache->GetAmount(item.first) != item.second)
+            return false;
+    }
+    return true;
+}
+
+// 以区块开始时的合约状态预执行一笔交易，记录读写集
+void ContractDataDB::SpeculateTransactionContract(MCBlock* pBlock, int txIndex, SmartContractThreadData* threadData)
+{
+    if (interrupt)
+        return;
+
+    SmartContractTxResult& result = (*threadData->pTxResults)[txIndex];
+    ContractContext contractContext;
+    try {
+        SmartLuaState* sls = GetThreadSmartLuaState();
+        result.success = ExecuteContractTx(sls, *pBlock->vtx[txIndex], txIndex, threadData->blockHeight, threadData->pPrevBlockIndex,
+            &contractContext, threadData->pCoinAmountCache);
+        if (result.success) {
+            result.readContracts = sls->contractIds;
+            for (auto& item : sls->contractDataFrom)
+                result.readContracts.insert(item.first);
+            result.readContracts.insert(sls->kvKeyIds.begin(), sls->kvKeyIds.end());
+            result.coinAmountFrom = std::move(sls->coinAmountFrom);
+            result.contractDataFrom = std::move(sls->contractDataFrom);
+            result.writeSet = std::move(contractContext.cache);
+        }
+        sls->Clear();
+    }
+    catch (const std::exception& e) {
+        // 预执行失败的交易在提交时重新执行，由重新执行的结果决定区块是否有效
+        result.success = false;
+    }
+}
+
+void ContractDataDB::ExecutiveTransactionContract(MCBlock* pBlock, SmartContractThreadData* threadData)
+{
+    SmartLuaState* sls = GetThreadSmartLuaState();
 
 #ifndef _DEBUG
     try {
@@ -154,58 +691,31 @@ void ContractDataDB::ExecutiveTransactionContract(MCBlock* pBlock, SmartContract
                 continue;
             }
 
-            MCContractID contractId = tx->pContractData->address;
-            MagnaChainAddress contractAddr(contractId);
-            MagnaChainAddress senderAddr(tx->pContractData->sender.GetID());
-            MCAmount amount = GetTxContractOut(*tx);
-
-            UniValue ret(UniValue::VARR);
-            if (tx->nVersion == MCTransaction::PUBLISH_CONTRACT_VERSION) {
-                std::string rawCode = tx->pContractData->codeOrFunc;
-                sls->Initialize(true, threadData->pPrevBlockIndex->GetBlockTime(), threadData->blockHeight, i, senderAddr,
-                    &threadData->contractContext, threadData->pPrevBlockIndex, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
-                if (!PublishContract(sls, contractAddr, rawCode, ret, true)
-                    || tx->pContractData->amountOut != 0 || tx->pContractData->amountOut != sls->contractOut) {
-                    LogPrintf("%s:%d => publish contract fail\n", __FUNCTION__, __LINE__);
-                    interrupt = true;
-                    return;
-                }
+            // 按交易顺序提交，内存池或预执行的结果仍然有效时直接使用其写集，否则重新执行
+            std::map<MCContractID, ContractInfo> contractDataFrom;
+            if (threadData->pMempoolResults != nullptr && (*threadData->pMempoolResults)[i] != nullptr &&
+                ReplayTransactionContract(*tx, i, *(*threadData->pMempoolResults)[i], threadData, contractDataFrom)) {
+                threadData->replayCount++;
             }
-            else if (tx->nVersion == MCTransaction::CALL_CONTRACT_VERSION) {
-                const std::string& strFuncName = tx->pContractData->codeOrFunc;
-                UniValue args;
-                args.read(tx->pContractData->args);
-
-                sls->Initialize(false, threadData->pPrevBlockIndex->GetBlockTime(), threadData->blockHeight, i, senderAddr, &threadData->contractContext,
-                    threadData->pPrevBlockIndex, SmartLuaState::SAVE_TYPE_CACHE, threadData->pCoinAmountCache);
-                if (!CallContract(sls, contractAddr, amount, strFuncName, args, ret) || tx->pContractData->amountOut != sls->contractOut) {
-                    LogPrintf("%s:%d => call contract fail\n", __FUNCTION__, __LINE__);
-                    interrupt = true;
-                    return;
-                }
-
-                if (tx->pContractData->amountOut > 0 && sls->recipients.size() == 0) {
-                    LogPrintf("%s:%d => tx->pContractData->amountOut > 0 && sls->recipients.size() == 0\n", __FUNCTION__, __LINE__);
-                    interrupt = true;
-                    return;
-                }
-
-                MCAmount total = 0;
-                for (int j = 0; j < sls->recipients.size(); ++j) {
-                    if (!tx->IsExistVout(sls->recipients[j])) {
-                        LogPrintf("%s:%d => vout not exist\n", __FUNCTION__, __LINE__);
-                        interrupt = true;
-                        return;
-                    }
-                    total += sls->recipients[j].nValue;
-                }
-
-                if (total != tx->pContractData->amountOut || tx->pContractData->amountOut != sls->contractOut) {
-                    LogPrintf("%s:%d => amount not match\n", __FUNCTION__, __LINE__);
+            else if (threadData->pTxResults != nullptr &&
+                IsTxResultValid((*threadData->pTxResults)[i], threadData->contractContext, threadData->pCoinAmountCache)) {
+                SmartContractTxResult& result = (*threadData->pTxResults)[i];
+                threadData->contractContext.cache = std::move(result.writeSet);
+                contractDataFrom = std::move(result.contractDataFrom);
+            }
+            else {
+                if (threadData->pTxResults != nullptr || threadData->pMempoolResults != nullptr)
+                    threadData->reexecuteCount++;
+                if (!ExecuteContractTx(sls, *tx, i, threadData->blockHeight, threadData->pPrevBlockIndex,
+                    &threadData->contractContext, threadData->pCoinAmountCache)) {
                     interrupt = true;
                     return;
                 }
+                contractDataFrom = std::move(sls->contractDataFrom);
+            }
 
+            MCContractID contractId = tx->pContractData->address;
+            if (tx->nVersion == MCTransaction::CALL_CONTRACT_VERSION) {
                 if (!mainChain) {
                     threadData->contractContext.txFinalData[i].coins = threadData->pCoinAmountCache->GetAmount(contractId);
                 }
@@ -235,7 +745,7 @@ void ContractDataDB::ExecutiveTransactionContract(MCBlock* pBlock, SmartContract
             }
 
             if (!mainChain) {
-                for (auto it : sls->contractDataFrom) {
+                for (auto it : contractDataFrom) {
                     pBlock->prevContractData[i].items[it.first].blockHash = it.second.blockHash;
                     pBlock->prevContractData[i].items[it.first].txIndex = it.second.txIndex;
                 }
@@ -289,11 +799,67 @@ bool ContractDataDB::RunBlockContract(MCBlock* pBlock, ContractContext* pContrac
         threadData[i].blockHeight = blockHeight;
         threadData[i].pPrevBlockIndex = pPrevBlockIndex;
         threadData[i].pCoinAmountCache = pCoinAmountCache;
-        threadPool.schedule(boost::bind(&ContractDataDB::ExecutiveTransactionContract, this, pBlock, &threadData[i]));
         offset += pBlock->groupSize[i];
     }
+
+    // 取出交易在内存池中的执行结果，须在调度工作线程之前，避免在工作线程中加mempool.cs锁
+    std::vector<std::shared_ptr<const SmartContractTxResult>> mempoolResults;
+    for (int i = 0; i < size; ++i) {
+        if (!pBlock->vtx[i]->IsSmartContract())
+            continue;
+        std::shared_ptr<const SmartContractTxResult> result = mempool.GetContractTxResult(pBlock->vtx[i]->GetHash());
+        if (result == nullptr)
+            continue;
+        if (mempoolResults.empty())
+            mempoolResults.resize(size);
+        mempoolResults[i] = std::move(result);
+    }
+    if (!mempoolResults.empty()) {
+        for (int i = 0; i < threadData.size(); ++i)
+            threadData[i].pMempoolResults = &mempoolResults;
+    }
+
+    // 先以区块开始时的状态在所有线程上预执行组内有多笔合约交易(没有内存池结果)的组，再按组并行、组内按顺序校验提交
+    std::vector<SmartContractTxResult> txResults;
+    if (gArgs.GetBoolArg("-speculativecontract", DEFAULT_SPECULATIVE_CONTRACT)) {
+        for (int i = 0; i < threadData.size(); ++i) {
+            int contractCount = 0;
+            for (int j = threadData[i].offset; j < threadData[i].offset + threadData[i].groupSize; ++j) {
+                if (pBlock->vtx[j]->IsSmartContract() && (mempoolResults.empty() || mempoolResults[j] == nullptr))
+                    contractCount++;
+            }
+            if (contractCount < 2)
+                continue;
+
+            if (txResults.empty())
+                txResults.resize(size);
+            threadData[i].pTxResults = &txResults;
+            for (int j = threadData[i].offset; j < threadData[i].offset + threadData[i].groupSize; ++j) {
+                if (pBlock->vtx[j]->IsSmartContract() && (mempoolResults.empty() || mempoolResults[j] == nullptr))
+                    threadPool.schedule(boost::bind(&ContractDataDB::SpeculateTransactionContract, this, pBlock, j, &threadData[i]));
+            }
+        }
+        threadPool.wait();
+    }
+
+    for (int i = 0; i < threadData.size(); ++i) {
+        threadPool.schedule(boost::bind(&ContractDataDB::ExecutiveTransactionContract, this, pBlock, &threadData[i]));
+    }
     threadPool.wait();
 
+    ContractRunStats stats;
+    for (int i = 0; i < threadData.size(); ++i) {
+        stats.nReexecuted += threadData[i].reexecuteCount;
+        stats.nReplayed += threadData[i].replayCount;
+    }
+    {
+        LOCK(cs_cache);
+        runStats = stats;
+    }
+    if (!txResults.empty() || !mempoolResults.empty()) {
+        LogPrint(BCLog::BENCH, "%s: %u contract txs replayed from mempool, %u executed without a valid earlier result\n", __FUNCTION__, stats.nReplayed, stats.nReexecuted);
+    }
+
     if (interrupt) {
         throw std::runtime_error(strprintf("%s:%d => run contract interrupt", __FUNCTION__, __LINE__));
     }
@@ -356,47 +922,72 @@ bool ContractDataDB::WriteBlockContractInfoToDisk(MCBlockIndex* pBlockIndex, Con
     MCDBBatch writeBatch(db);
     size_t maxBatchSize = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
     for (auto ci : pContractContext->data) {
-        DBContractInfo& contractInfo = contractData[ci.first];
-        if (contractInfo.code.empty())
-            contractInfo.code = ci.second.code;
         ci.second.blockHash = pBlockIndex->GetBlockHash();
-
-        // 将区块插入对应的结点中
-        auto insertPoint = contractInfo.items.end();
-        for (auto it = contractInfo.items.begin(); it != contractInfo.items.end(); ++it) {
-            if (pBlockIndex->nHeight < it->blockHeight) {
-                insertPoint = contractInfo.items.insert(it, DBContractInfoByHeight());
-                insertPoint->blockHeight = pBlockIndex->nHeight;
-                break;
+        ContractDataRecord record;
+        {
+            ContractDataShard& shard = GetShard(ci.first);
+            LOCK(shard.cs);
+            ContractDataEntry& entry = LoadContractData(shard, ci.first);
+            DBContractInfo& contractInfo = entry.info;
+            if (contractInfo.code.empty())
+                contractInfo.code = ci.second.code;
+
+            // 将区块插入对应高度的结点中
+            auto insertPoint = contractInfo.items.find(pBlockIndex->nHeight);
+            if (insertPoint == contractInfo.items.end()) {
+                insertPoint = contractInfo.items.emplace(pBlockIndex->nHeight, DBContractInfoByHeight()).first;
+                insertPoint->second.blockHeight = pBlockIndex->nHeight;
+                insertPoint->second.loaded = true;
             }
-            else if (pBlockIndex->nHeight == it->blockHeight) {
-                insertPoint = it;
-                break;
+            DBContractInfoByHeight& item = insertPoint->second;
+            LoadHeightHashes(ci.first, item);
+
+            for (int i = 0; i < item.vecBlockHash.size(); ++i) {
+                if (item.vecBlockHash[i] == ci.second.blockHash) {
+                    item.vecBlockHash.erase(item.vecBlockHash.begin() + i);
+                    item.vecBlockContractData.erase(item.vecBlockContractData.begin() + i);
+                    item.vecDataDepth.erase(item.vecDataDepth.begin() + i);
+                    break;
+                }
             }
-        }
-
-        if (insertPoint == contractInfo.items.end()) {
-            insertPoint = contractInfo.items.insert(insertPoint, DBContractInfoByHeight());
-            insertPoint->blockHeight = pBlockIndex->nHeight;
-        }
 
-        for (int i = 0; i < insertPoint->vecBlockHash.size(); ++i) {
-            if (insertPoint->vecBlockHash[i] == ci.second.blockHash) {
-                insertPoint->vecBlockHash.erase(insertPoint->vecBlockHash.begin() + i);
-                insertPoint->vecBlockContractData.erase(insertPoint->vecBlockContractData.begin() + i);
-                break;
+            // 上一版本的数据在缓存中时只保存差异
+            const std::string* base = nullptr;
+            uint256 baseBlockHash;
+            uint16_t baseDepth = UNKNOWN_DATA_DEPTH;
+            MCBlockIndex* pPrevBlock = pBlockIndex->pprev;
+            auto it = (pPrevBlock ? contractInfo.items.upper_bound(pPrevBlock->nHeight) : contractInfo.items.begin());
+            while (base == nullptr && it != contractInfo.items.begin()) {
+                --it;
+                DBContractInfoByHeight& prevItem = it->second;
+                if (!prevItem.loaded)
+                    break;
+                const uint256 targetBlockHash = pPrevBlock->GetAncestor(prevItem.blockHeight)->GetBlockHash();
+                auto hi = std::find(prevItem.vecBlockHash.begin(), prevItem.vecBlockHash.end(), targetBlockHash);
+                if (hi != prevItem.vecBlockHash.end()) {
+                    size_t index = hi - prevItem.vecBlockHash.begin();
+                    if (prevItem.vecBlockContractData[index].empty())
+                        break;
+                    base = &prevItem.vecBlockContractData[index];
+                    baseBlockHash = targetBlockHash;
+                    baseDepth = prevItem.vecDataDepth[index];
+                }
             }
+            record = ContractDataRecord::Encode(ci.second.data, base, baseBlockHash, baseDepth, fCompressData);
+
+            // 待存盘的合约数据
+            item.dirty = true;
+            item.vecBlockHash.emplace_back(ci.second.blockHash);
+            item.vecBlockContractData.emplace_back(ci.second.data);
+            item.vecDataDepth.emplace_back(record.depth);
+            entry.dirty = true;
+            UpdateContractUsage(shard, entry);
+            shard.dirtyContracts.insert(ci.first);
+            TrackContractHeight(shard, ci.first, pBlockIndex->nHeight);
         }
 
-        // 待存盘的合约数据
-        insertPoint->dirty = true;
-        insertPoint->vecBlockHash.emplace_back(ci.second.blockHash);
-        insertPoint->vecBlockContractData.emplace_back(ci.second.data);
-
         // 数据存盘
-        MCHashWriter keyHash(SER_GETHASH, 0);
-        keyHash << ci.first << ci.second.blockHash;
-        writeBatch.Write(keyHash.GetHash(), ci.second.data);
+        writeBatch.Write(ContractRecordKey(ci.first, ci.second.blockHash), record);
         if (writeBatch.SizeEstimate() > maxBatchSize) {
             if (!WriteBatch(writeBatch))
                 return false;
@@ -422,77 +1013,115 @@ bool ContractDataDB::UpdateBlockContractToDisk(MCBlockIndex* pBlockIndex)
     int removeBlockHeight = confirmBlockHeight - REDEEM_SAFE_HEIGHT - checkDepth;
     size_t maxBatchSize = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
 
-    // 遍历缓存的合约数据，清理明确是无效分叉的数据
+    // 只遍历有新数据或有高度进入确认/移除范围的合约，清理明确是无效分叉的数据
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nVisited = 0;
     removes.clear();
     removeBatch.Clear();
     MCDBBatch writeBatch(db);
     MCBlockIndex* newConfirmBlock = pBlockIndex->GetAncestor(confirmBlockHeight);
-    for (auto& ci : contractData) {
-        auto& contractInfo = ci.second;
-        auto saveIt = contractInfo.items.end();
-
-        for (auto heightIt = contractInfo.items.begin(); heightIt != contractInfo.items.end();) {
-            // 将小于确认区块以下的不属于该链的区块数据移除掉
-            if (heightIt->blockHeight <= confirmBlockHeight) {
-                for (int i = 0; i < heightIt->vecBlockHash.size();) {
-                    BlockMap::iterator bi = mapBlockIndex.find(heightIt->vecBlockHash[i]);
-                    if (bi == mapBlockIndex.end() || 
-                        newConfirmBlock->GetAncestor(heightIt->blockHeight)->GetBlockHash() != heightIt->vecBlockHash[i]) {
-                        MCHashWriter keyHash(SER_GETHASH, 0);
-                        keyHash << ci.first << heightIt->vecBlockHash[i];
-                        removeBatch.Erase(keyHash.GetHash());
-
-                        heightIt->dirty = true;
-                        heightIt->vecBlockHash.erase(heightIt->vecBlockHash.begin() + i);
-                        heightIt->vecBlockContractData.erase(heightIt->vecBlockContractData.begin() + i);
-                        continue;
-                    }
-                    else {
-                        ++i;
+    for (ContractDataShard& shard : contractData) {
+        LOCK(shard.cs);
+        std::set<MCContractID> visits;
+        visits.swap(shard.dirtyContracts);
+        auto confirmEnd = shard.pendingConfirm.upper_bound(confirmBlockHeight);
+        for (auto pi = shard.pendingConfirm.begin(); pi != confirmEnd; ++pi)
+            visits.insert(pi->second.begin(), pi->second.end());
+        shard.pendingConfirm.erase(shard.pendingConfirm.begin(), confirmEnd);
+        auto removeEnd = shard.pendingRemove.lower_bound(removeBlockHeight);
+        for (auto pi = shard.pendingRemove.begin(); pi != removeEnd; ++pi)
+            visits.insert(pi->second.begin(), pi->second.end());
+        shard.pendingRemove.erase(shard.pendingRemove.begin(), removeEnd);
+
+        for (const MCContractID& contractId : visits) {
+            auto ci = shard.contracts.find(contractId);
+            if (ci == shard.contracts.end())
+                continue;   // 已被淘汰，重新加载时会再次登记
+            ++nVisited;
+            auto& contractInfo = ci->second.info;
+            auto saveIt = contractInfo.items.end();
+
+            for (auto heightIt = contractInfo.items.begin(); heightIt != contractInfo.items.end(); ++heightIt) {
+                DBContractInfoByHeight& item = heightIt->second;
+
+                // 将小于确认区块以下的不属于该链的区块数据移除掉
+                if (item.blockHeight <= confirmBlockHeight) {
+                    LoadHeightHashes(ci->first, item);
+                    for (int i = 0; i < item.vecBlockHash.size();) {
+                        BlockMap::iterator bi = mapBlockIndex.find(item.vecBlockHash[i]);
+                        if (bi == mapBlockIndex.end() ||
+                            newConfirmBlock->GetAncestor(item.blockHeight)->GetBlockHash() != item.vecBlockHash[i]) {
+                            removeBatch.Erase(ContractDataKey(ci->first, item.vecBlockHash[i]));
+                            removeBatch.Erase(ContractRecordKey(ci->first, item.vecBlockHash[i]));
+
+                            item.dirty = true;
+                            item.vecBlockHash.erase(item.vecBlockHash.begin() + i);
+                            item.vecBlockContractData.erase(item.vecBlockContractData.begin() + i);
+                            item.vecDataDepth.erase(item.vecDataDepth.begin() + i);
+                            continue;
+                        }
+                        else {
+                            ++i;
+                        }
                     }
+                    assert(item.vecBlockHash.size() == 1 && item.vecBlockContractData.size() == 1);
                 }
-                assert(heightIt->vecBlockHash.size() == 1 && heightIt->vecBlockContractData.size() == 1);
-            }
 
-            if (heightIt->blockHeight < removeBlockHeight) {
-                // 保留当前即将移除块以下的最近一笔数据，防止程序退出时区块链保存信息不完整导致加载到错误数据
-                if (saveIt != contractInfo.items.end()) {
-                    // 移除存盘数据
-                    assert(saveIt->vecBlockHash.size() == 1);
-                    MCHashWriter keyBlockHash(SER_GETHASH, 0);
-                    keyBlockHash << ci.first << *saveIt->vecBlockHash.begin();
-                    removeBatch.Erase(keyBlockHash.GetHash());
+                if (item.blockHeight < removeBlockHeight) {
+                    // 保留当前即将移除块以下的最近一笔数据，防止程序退出时区块链保存信息不完整导致加载到错误数据
+                    if (saveIt != contractInfo.items.end()) {
+                        // 保留的版本可能是基于被移除版本的差异，先改存为完整数据
+                        if (item.vecDataDepth[0] != 0) {
+                            std::string data = item.vecBlockContractData[0];
+                            uint16_t depth = UNKNOWN_DATA_DEPTH;
+                            if (!data.empty() || ReadContractData(ci->first, item.vecBlockHash[0], data, depth)) {
+                                if (depth != 0)
+                                    writeBatch.Write(ContractRecordKey(ci->first, item.vecBlockHash[0]), ContractDataRecord::Encode(data, nullptr, uint256(), 0, fCompressData));
+                                item.vecDataDepth[0] = 0;
+                            }
+                            else {
+                                LogPrintf("%s: read contract %s data at %d failed\n", __FUNCTION__, ci->first.ToString(), item.blockHeight);
+                            }
+                        }
+
+                        // 移除存盘数据
+                        DBContractInfoByHeight& saveItem = saveIt->second;
+                        assert(saveItem.vecBlockHash.size() == 1);
+                        removeBatch.Erase(ContractDataKey(ci->first, *saveItem.vecBlockHash.begin()));
+                        removeBatch.Erase(ContractRecordKey(ci->first, *saveItem.vecBlockHash.begin()));
+
+                        MCHashWriter keyHeightHash(SER_GETHASH, 0);
+                        keyHeightHash << ci->first << saveItem.blockHeight;
+                        removeBatch.Erase(keyHeightHash.GetHash());
+                        contractInfo.items.erase(saveIt);
+                    }
+                    saveIt = heightIt;
 
-                    MCHashWriter keyHeightHash(SER_GETHASH, 0);
-                    keyHeightHash << ci.first << saveIt->blockHeight;
-                    removeBatch.Erase(keyHeightHash.GetHash());
-                    contractInfo.items.erase(saveIt);
+                    if (contractInfo.items.size() == 1)
+                        removes.emplace_back(ci->first);
                 }
-                saveIt = heightIt;
-
-                if (contractInfo.items.size() == 1)
-                    removes.emplace_back(ci.first);
-            }
 
-            if (heightIt->dirty) {
-                heightIt->dirty = false;
-                MCHashWriter keyHeightHash(SER_GETHASH, 0);
-                keyHeightHash << ci.first << heightIt->blockHeight;
-                writeBatch.Write(keyHeightHash.GetHash(), heightIt->vecBlockHash);
-                if (writeBatch.SizeEstimate() > maxBatchSize) {
-                    if (!WriteBatch(writeBatch))
-                        return false;
+                if (item.dirty) {
+                    item.dirty = false;
+                    MCHashWriter keyHeightHash(SER_GETHASH, 0);
+                    keyHeightHash << ci->first << item.blockHeight;
+                    writeBatch.Write(keyHeightHash.GetHash(), item.vecBlockHash);
+                    if (writeBatch.SizeEstimate() > maxBatchSize) {
+                        if (!WriteBatch(writeBatch))
+                            return false;
+                    }
                 }
             }
 
-            ++heightIt;
-        }
-
-        writeBatch.Write(ci.first, ci.second);
-        if (writeBatch.SizeEstimate() > maxBatchSize) {
-            if (!WriteBatch(writeBatch))
-                return false;
+            writeBatch.Write(ci->first, contractInfo);
+            ci->second.dirty = false;
+            UpdateContractUsage(shard, ci->second, false);
+            if (writeBatch.SizeEstimate() > maxBatchSize) {
+                if (!WriteBatch(writeBatch))
+                    return false;
+            }
         }
+        EvictContractData(shard);
     }
 
     if (writeBatch.SizeEstimate() > 0) {
@@ -500,6 +1129,14 @@ bool ContractDataDB::UpdateBlockContractToDisk(MCBlockIndex* pBlockIndex)
             return false;
     }
 
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    flushStats.nFlushes++;
+    flushStats.nLastContracts = nVisited;
+    flushStats.nLastTime = nTime;
+    flushStats.nTotalTime += nTime;
+    flushStats.nMaxTime = std::max(flushStats.nMaxTime, nTime);
+    LogPrint(BCLog::BENCH, "    - Update contract data: %u contracts, %.2fms [%.2fs]\n", (unsigned)nVisited, nTime * 0.001, flushStats.nTotalTime * 0.000001);
+
     return true;
 }
 
@@ -509,57 +1146,152 @@ void ContractDataDB::PruneContractInfo()
     if (removeBatch.SizeEstimate() > 0)
         WriteBatch(removeBatch);
 
-    for (uint160& contractId : removes)
-        contractData.erase(contractId);
+    for (uint160& id : removes) {
+        MCContractID contractId(id);
+        ContractDataShard& shard = GetShard(contractId);
+        {
+            LOCK(shard.cs);
+            auto it = shard.contracts.find(contractId);
+            if (it != shard.contracts.end()) {
+                shard.usage -= it->second.usage;
+                shard.lruList.erase(it->second.lruIt);
+                shard.contracts.erase(it);
+            }
+        }
+        codeCache.Erase(contractId);
+    }
     removes.clear();
 }
 
+void ContractDataDB::DisconnectBlockContract(const MCBlock& block)
+{
+    // 回滚区块中发布的合约不再有效，移除对应的字节码缓存
+    for (const MCTransactionRef& tx : block.vtx) {
+        if (tx->nVersion == MCTransaction::PUBLISH_CONTRACT_VERSION && tx->pContractData)
+            codeCache.Erase(tx->pContractData->address);
+    }
+}
+
 int ContractDataDB::GetContractInfo(const MCContractID& contractId, ContractInfo& contractInfo, MCBlockIndex* prevBlockIndex)
 {
-    LOCK(cs_cache);
+    ContractDataShard& shard = GetShard(contractId);
+    MCBlockIndex* prevBlock = (prevBlockIndex ? prevBlockIndex : chainActive.Tip());
 
-    // 检查是否在缓存中，不存在则尝试加载
-    auto di = contractData.find(contractId);
-    if (di == contractData.end()) {
-        DBContractInfo contractInfo;
-        if (!db.Read(contractId, contractInfo)) {
-            return -1;
-        }
-        else {
-            contractData[contractId] = contractInfo;
-            di = contractData.find(contractId);
+    // 读磁盘时不持有分片锁，读完后放入缓存再重新查找
+    while (true) {
+        bool cached = false;
+        int readHeight = -1;    // 需要读取区块哈希列表的高度
+        int dataHeight = -1;    // 需要读取数据的区块所在高度
+        uint256 dataBlockHash;
+        std::string code;
+        {
+            LOCK(shard.cs);
+            auto di = shard.contracts.find(contractId);
+            if (di != shard.contracts.end()) {
+                cached = true;
+                ContractDataEntry& entry = di->second;
+                shard.lruList.splice(shard.lruList.begin(), shard.lruList, entry.lruIt);
+
+                // 从不高于prevBlock的最高结点开始向下查找
+                auto it = entry.info.items.upper_bound(prevBlock->nHeight);
+                while (it != entry.info.items.begin() && readHeight < 0 && dataHeight < 0) {
+                    --it;
+                    DBContractInfoByHeight& item = it->second;
+                    if (!item.loaded) {
+                        readHeight = item.blockHeight;
+                        break;
+                    }
+
+                    const uint256 targetBlockHash = prevBlock->GetAncestor(item.blockHeight)->GetBlockHash();
+                    for (int i = 0; i < item.vecBlockHash.size(); ++i) {
+                        if (item.vecBlockHash[i] == targetBlockHash) {
+                            if (item.vecBlockContractData[i].empty()) {
+                                dataHeight = item.blockHeight;
+                                dataBlockHash = targetBlockHash;
+                                code = entry.info.code;
+                                break;
+                            }
+
+                            contractInfo.txIndex = 0;
+                            contractInfo.code = entry.info.code;
+                            contractInfo.blockHash = item.vecBlockHash[i];
+                            contractInfo.data = item.vecBlockContractData[i];
+                            return item.blockHeight;
+                        }
+                    }
+                }
+
+                if (readHeight < 0 && dataHeight < 0)
+                    return -1;
+            }
         }
-    }
 
-    // 遍历获取相应节点的数据
-    MCBlockIndex* prevBlock = (prevBlockIndex ? prevBlockIndex : chainActive.Tip());
-    // 链表最末尾存储最高的区块
-    for (auto it = di->second.items.rbegin(); it != di->second.items.rend(); ++it) {
-        if (prevBlock->nHeight >= it->blockHeight) {
-            MCBlockIndex* targetBlockIndex = prevBlock->GetAncestor(it->blockHeight);
-            if (it->vecBlockHash.size() == 0) {
-                MCHashWriter keyHeightHash(SER_GETHASH, 0);
-                keyHeightHash << contractId << it->blockHeight;
-                db.Read(keyHeightHash.GetHash(), it->vecBlockHash);
-                it->vecBlockContractData.resize(it->vecBlockHash.size());
+        if (!cached) {
+            DBContractInfo dbContractInfo;
+            if (!db.Read(contractId, dbContractInfo))
+                return -1;
+
+            LOCK(shard.cs);
+            if (shard.contracts.count(contractId) == 0) {
+                ContractDataEntry& entry = shard.contracts[contractId];
+                entry.info = std::move(dbContractInfo);
+                shard.lruList.emplace_front(contractId);
+                entry.lruIt = shard.lruList.begin();
+                UpdateContractUsage(shard, entry);
+                TrackContractInfo(shard, contractId, entry.info);
+                EvictContractData(shard);
             }
-            for (int i = 0; i < it->vecBlockHash.size(); ++i) {
-                if (it->vecBlockHash[i] == targetBlockIndex->GetBlockHash()) {
-                    if (it->vecBlockContractData[i].empty()) {
-                        MCHashWriter keyHash(SER_GETHASH, 0);
-                        keyHash << contractId << it->vecBlockHash[i];
-                        db.Read(keyHash.GetHash(), it->vecBlockContractData[i]);
+        }
+        else if (readHeight >= 0) {
+            std::vector<uint256> vecBlockHash;
+            MCHashWriter keyHeightHash(SER_GETHASH, 0);
+            keyHeightHash << contractId << readHeight;
+            db.Read(keyHeightHash.GetHash(), vecBlockHash);
+
+            LOCK(shard.cs);
+            auto di = shard.contracts.find(contractId);
+            if (di != shard.contracts.end()) {
+                auto it = di->second.info.items.find(readHeight);
+                if (it != di->second.info.items.end() && !it->second.loaded) {
+                    it->second.vecBlockHash = std::move(vecBlockHash);
+                    it->second.vecBlockContractData.resize(it->second.vecBlockHash.size());
+                    it->second.vecDataDepth.resize(it->second.vecBlockHash.size(), UNKNOWN_DATA_DEPTH);
+                    it->second.loaded = true;
+                    UpdateContractUsage(shard, di->second);
+                }
+            }
+        }
+        else {
+            std::string data;
+            uint16_t depth = UNKNOWN_DATA_DEPTH;
+            if (!ReadContractData(contractId, dataBlockHash, data, depth))
+                depth = UNKNOWN_DATA_DEPTH;
+
+            {
+                LOCK(shard.cs);
+                auto di = shard.contracts.find(contractId);
+                if (di != shard.contracts.end()) {
+                    auto it = di->second.info.items.find(dataHeight);
+                    if (it != di->second.info.items.end()) {
+                        DBContractInfoByHeight& item = it->second;
+                        for (int i = 0; i < item.vecBlockHash.size(); ++i) {
+                            if (item.vecBlockHash[i] == dataBlockHash && item.vecBlockContractData[i].empty()) {
+                                item.vecBlockContractData[i] = data;
+                                item.vecDataDepth[i] = depth;
+                                UpdateContractUsage(shard, di->second);
+                                EvictContractData(shard);
+                                break;
+                            }
+                        }
                     }
-
-                    contractInfo.txIndex = 0;
-                    contractInfo.code = di->second.code;
-                    contractInfo.blockHash = it->vecBlockHash[i];
-                    contractInfo.data = it->vecBlockContractData[i];
-                    return it->blockHeight;
                 }
             }
+
+            contractInfo.txIndex = 0;
+            contractInfo.code = std::move(code);
+            contractInfo.blockHash = dataBlockHash;
+            contractInfo.data = std::move(data);
+            return dataHeight;
         }
     }
-
-    return -1;
 }
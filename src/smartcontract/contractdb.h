@@ -28,9 +28,11 @@ class DBContractInfoByHeight
 {
 public:
     bool dirty = false;
+    bool loaded = false;    // vecBlockHash是否已在内存中(从磁盘读取或新写入)
     int32_t blockHeight;
     std::vector<uint256> vecBlockHash;
     std::vector<std::string> vecBlockContractData;
+    std::vector<uint16_t> vecDataDepth;     // 各版本存盘记录距完整版本的差异数，未知时为UNKNOWN_DATA_DEPTH
 
     ADD_SERIALIZE_METHODS;
     template <typename Stream, typename Operation>
@@ -39,18 +41,79 @@ public:
     }
 };
 
-// 区块关联的智能合约存盘数据
-class DBContractInfo
+static const uint16_t UNKNOWN_DATA_DEPTH = 0xffff;
+static const uint16_t MAX_CONTRACT_DATA_DELTA_DEPTH = 16;   // 超过后保存完整数据
+static const bool DEFAULT_CONTRACT_DATA_COMPRESS = true;
+
+/**
+ * 合约某版本数据的存盘记录。每隔若干版本保存完整数据，其余版本只保存相对上一版本(祖先区块中的数据)的差异:
+ * 相同前缀、后缀的长度及中间被替换的部分。内容可选压缩。
+ */
+class ContractDataRecord
 {
 public:
-    std::string code;
-    std::list<DBContractInfoByHeight> items;
+    static const uint8_t FLAG_DELTA = 1;
+    static const uint8_t FLAG_COMPRESSED = 2;
+
+    uint8_t flags = 0;
+    uint16_t depth = 0;         // 距完整版本的差异数
+    uint256 baseBlockHash;      // 差异所基于版本的区块
+    uint32_t prefixLen = 0;
+    uint32_t suffixLen = 0;
+    std::string payload;
 
     ADD_SERIALIZE_METHODS;
     template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(code);
-        READWRITE(items);
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(flags);
+        READWRITE(depth);
+        if (flags & FLAG_DELTA) {
+            READWRITE(baseBlockHash);
+            READWRITE(VARINT(prefixLen));
+            READWRITE(VARINT(suffixLen));
+        }
+        READWRITE(payload);
+    }
+
+    // base为空或差异不划算时生成完整记录
+    static ContractDataRecord Encode(const std::string& data, const std::string* base, const uint256& baseBlockHash, uint16_t baseDepth, bool compress);
+    // 完整记录忽略base
+    bool Decode(const std::string& base, std::string& data) const;
+};
+
+// 区块关联的智能合约存盘数据，各高度的数据按高度索引
+class DBContractInfo
+{
+public:
+    typedef std::map<int32_t, DBContractInfoByHeight> HEIGHT_ITEMS;
+
+    std::string code;
+    HEIGHT_ITEMS items;
+
+    size_t DynamicMemoryUsage() const;
+
+    // 存盘格式与按高度从低到高排列的列表相同
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << code;
+        WriteCompactSize(s, items.size());
+        for (const auto& item : items)
+            s << item.second;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> code;
+        items.clear();
+        uint64_t size = ReadCompactSize(s);
+        for (uint64_t i = 0; i < size; ++i) {
+            DBContractInfoByHeight item;
+            s >> item;
+            items[item.blockHeight] = std::move(item);
+        }
     }
 };
 
@@ -87,9 +150,77 @@ public:
     void ClearAll();
 };
 
+// 解压后的合约字节码，创建后不可修改，可在线程间共享
+class ContractCode
+{
+public:
+    size_t rawCodeSize;     // 压缩后代码的长度，用于校验缓存是否命中
+    std::string code;       // 解压后的字节码
+
+    ContractCode(const std::string& rawCodeIn, std::string&& codeIn);
+};
+typedef std::shared_ptr<const ContractCode> ContractCodeRef;
+
+/**
+ * 合约字节码缓存，按合约ID索引，按字节数限制大小(LRU)。
+ * 合约ID由发布时代码的哈希生成，同一ID只对应一份代码，查找时只比较压缩代码的长度。
+ * 只在调用合约时写入，内存池或被回滚区块中的合约也可能留在缓存中，由LRU淘汰。
+ * 区块回滚或合约数据被清理时通过ContractDataDB移除对应项。
+ */
+class ContractCodeCache
+{
+private:
+    typedef std::list<std::pair<MCContractID, ContractCodeRef>> LRU_LIST;
+
+    mutable MCCriticalSection cs;
+    size_t nMaxSize;
+    size_t nSize;
+    LRU_LIST lruList;
+    std::map<MCContractID, LRU_LIST::iterator> mapCode;
+
+    void EraseEntry(std::map<MCContractID, LRU_LIST::iterator>::iterator it);
+
+public:
+    explicit ContractCodeCache(size_t nMaxSizeIn);
+
+    ContractCodeRef Get(const MCContractID& contractId, const std::string& rawCode);
+    ContractCodeRef Insert(const MCContractID& contractId, const std::string& rawCode, std::string&& code);
+    void Erase(const MCContractID& contractId);
+    void Clear();
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+static const size_t DEFAULT_CONTRACT_CODE_CACHE_SIZE = 32 * 1024 * 1024;
+static const int64_t DEFAULT_CONTRACT_DATA_CACHE = 64;     // 合约版本数据缓存(MiB)
+
 class SmartLuaState;
 class MagnaChainAddress;
 
+/**
+ * 合约交易预执行的结果。预执行以区块开始时的状态为准，提交时若读集没有被组内之前的交易修改，
+ * 且读到的合约余额不变，则直接采用预执行的写集，否则按顺序重新执行。
+ */
+struct SmartContractTxResult
+{
+    bool success = false;
+    std::set<MCContractID> readContracts;               // 读取过的合约，包括键值存储模式下访问过的键
+    std::map<MCContractID, MCAmount> coinAmountFrom;    // 读取过的合约余额
+    std::map<MCContractID, ContractInfo> contractDataFrom;
+    CONTRACT_DATA writeSet;
+
+    // 以下用于重放内存池中的执行结果
+    int64_t timestamp = 0;
+    int blockHeight = -1;
+    MCAmount contractOut = 0;
+    std::vector<MCTxOut> recipients;
+};
+
+// 记录一次成功执行的结果，writeSet为该交易写入的合约数据
+std::shared_ptr<const SmartContractTxResult> MakeContractTxResult(SmartLuaState* sls, const CONTRACT_DATA& writeSet);
+
+static const bool DEFAULT_SPECULATIVE_CONTRACT = true;
+
 struct SmartContractThreadData
 {
     int offset;
@@ -99,7 +230,28 @@ struct SmartContractThreadData
     ContractContext contractContext;
     MCBlockIndex* pPrevBlockIndex;
     CoinAmountCache* pCoinAmountCache;
+    std::vector<SmartContractTxResult>* pTxResults = nullptr;
+    std::vector<std::shared_ptr<const SmartContractTxResult>>* pMempoolResults = nullptr;
     std::set<uint256> associationTransactions;
+    uint32_t reexecuteCount = 0;
+    uint32_t replayCount = 0;
+};
+
+// 每个区块更新合约存盘数据的耗时统计(微秒)
+struct ContractFlushStats
+{
+    uint64_t nFlushes = 0;
+    size_t nLastContracts = 0;  // 上次处理的合约数
+    int64_t nLastTime = 0;
+    int64_t nMaxTime = 0;
+    int64_t nTotalTime = 0;
+};
+
+// 最近一次RunBlockContract中合约交易的执行统计
+struct ContractRunStats
+{
+    uint32_t nReplayed = 0;     // 直接采用内存池中执行结果的交易数
+    uint32_t nReexecuted = 0;   // 内存池及预执行结果都无效、提交时重新执行的交易数
 };
 
 typedef std::map<uint256, std::vector<std::map<MCContractID, ContractInfo>>> BLOCK_CONTRACT_DATA;
@@ -115,13 +267,51 @@ private:
     std::map<boost::thread::id, SmartLuaState*> threadId2SmartLuaState;
     mutable MCCriticalSection cs_cache;
 
+    struct ContractDataEntry
+    {
+        DBContractInfo info;
+        bool dirty = false;     // 有未存盘的修改，不能被淘汰
+        size_t usage = 0;
+        std::list<MCContractID>::iterator lruIt;
+    };
+
+    // 合约缓存分片，各自加锁，按字节数限制大小(LRU)
+    struct ContractDataShard
+    {
+        mutable MCCriticalSection cs;
+        std::map<MCContractID, ContractDataEntry> contracts;
+        std::list<MCContractID> lruList;
+        size_t usage = 0;
+        // UpdateBlockContractToDisk只需处理的合约：有新写入数据的，以及有高度进入确认/移除范围的
+        std::set<MCContractID> dirtyContracts;
+        std::map<int, std::set<MCContractID>> pendingConfirm;
+        std::map<int, std::set<MCContractID>> pendingRemove;
+    };
+
+    static const int CONTRACT_DATA_SHARD_NUM = 16;
+
     // 合约缓存，同时包含多个合约对应的多个块合约数据快照
-    std::map<MCContractID, DBContractInfo> contractData;
+    ContractDataShard contractData[CONTRACT_DATA_SHARD_NUM];
+    size_t nMaxShardUsage;
+    bool fCompressData;
+    ContractFlushStats flushStats;
+    ContractRunStats runStats;
     BLOCK_CONTRACT_DATA blockContractData;
     std::map<int, std::vector<std::pair<uint256, bool>>> mapHeightHash;
 
+    SmartLuaState* GetThreadSmartLuaState();
+    ContractDataShard& GetShard(const MCContractID& contractId);
+    ContractDataEntry& LoadContractData(ContractDataShard& shard, const MCContractID& contractId);
+    void LoadHeightHashes(const MCContractID& contractId, DBContractInfoByHeight& item);
+    bool ReadContractData(const MCContractID& contractId, const uint256& blockHash, std::string& data, uint16_t& depth);
+    void TrackContractHeight(ContractDataShard& shard, const MCContractID& contractId, int height);
+    void TrackContractInfo(ContractDataShard& shard, const MCContractID& contractId, const DBContractInfo& info);
+    void UpdateContractUsage(ContractDataShard& shard, ContractDataEntry& entry, bool touch = true);
+    void EvictContractData(ContractDataShard& shard);
+
 public:
     ContractContext contractContext;
+    ContractCodeCache codeCache;
 
 public:
     ContractDataDB() = delete;
@@ -133,12 +323,21 @@ public:
     int GetContractInfo(const MCContractID& contractId, ContractInfo& contractInfo, MCBlockIndex* currentPrevBlockIndex);
 
     bool RunBlockContract(MCBlock* pBlock, ContractContext* pContractContext, CoinAmountCache* pCoinAmountCache);
+    void SpeculateTransactionContract(MCBlock* pBlock, int txIndex, SmartContractThreadData* threadData);
     void ExecutiveTransactionContract(MCBlock* pBlock, SmartContractThreadData* threadData);
+    bool ReplayTransactionContract(const MCTransaction& tx, int txIndex, const SmartContractTxResult& result,
+        SmartContractThreadData* threadData, std::map<MCContractID, ContractInfo>& contractDataFrom);
 
     bool WriteBatch(MCDBBatch& batch);
     bool WriteBlockContractInfoToDisk(MCBlockIndex* pBlockIndex, ContractContext* contractContext);
     bool UpdateBlockContractToDisk(MCBlockIndex* pBlockIndex);
     void PruneContractInfo();
+    void DisconnectBlockContract(const MCBlock& block);
+
+    size_t ContractDataCount() const;
+    size_t ContractDataUsage() const;
+    ContractFlushStats GetFlushStats() const;
+    ContractRunStats GetRunStats() const;
 };
 extern ContractDataDB* mpContractDb;
 
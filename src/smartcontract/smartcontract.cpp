@@ -18,6 +18,10 @@
 #include "mining/miner.h"
 #include "consensus/merkle.h"
 #include "policy/policy.h"
+#include "io/streams.h"
+#include "chain/chainparams.h"
+
+#include <algorithm>
 
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/device/back_inserter.hpp>
@@ -82,6 +86,64 @@ local function createSafeEnv()
 	return env                                                                  \n\
 end                                                                             \n\
                                                                                 \n\
+local function createKVData()                                                   \n\
+    local values = {}                                                           \n\
+    local loaded = {}                                                           \n\
+    local mt = {}                                                               \n\
+    mt.__metatable = false                                                      \n\
+    mt.__index = function(t, k)                                                 \n\
+        if not loaded[k] then                                                   \n\
+            loaded[k] = true                                                    \n\
+            local v = getkvdata(cmsgpack.pack(k))                               \n\
+            if v then                                                           \n\
+                values[k] = cmsgpack.unpack(v)                                  \n\
+            end                                                                 \n\
+        end                                                                     \n\
+        return values[k]                                                        \n\
+    end                                                                         \n\
+    mt.__newindex = function(t, k, v)                                           \n\
+        if type(k) ~= 'string' and type(k) ~= 'number' then                     \n\
+            error('PersistentData key must be string or number')                \n\
+        end                                                                     \n\
+        loaded[k] = true                                                        \n\
+        values[k] = v                                                           \n\
+    end                                                                         \n\
+    return setmetatable({}, mt), values, loaded                                 \n\
+end                                                                             \n\
+                                                                                \n\
+local function saveKVData(values, loaded)                                       \n\
+    for k in pairs(loaded) do                                                   \n\
+        local v = values[k]                                                     \n\
+        if v == nil then                                                        \n\
+            setkvdata(cmsgpack.pack(k))                                         \n\
+        else                                                                    \n\
+            setkvdata(cmsgpack.pack(k), cmsgpack.pack(v))                       \n\
+        end                                                                     \n\
+    end                                                                         \n\
+end                                                                             \n\
+                                                                                \n\
+-- 键值存储模式的PersistentData为代理表，遍历只能看到已访问的键，遍历时报错                                  \n\
+local function guardKVData(env, data)                                           \n\
+    local function guard(f)                                                     \n\
+        return function(t, ...)                                                 \n\
+            if rawequal(t, data) then                                           \n\
+                error('PersistentData in kv storage mode can not be iterated')  \n\
+            end                                                                 \n\
+            return f(t, ...)                                                    \n\
+        end                                                                     \n\
+    end                                                                         \n\
+    env.pairs = guard(pairs)                                                    \n\
+    env.ipairs = guard(ipairs)                                                  \n\
+    env.next = guard(next)                                                      \n\
+    env.unpack = guard(unpack)                                                  \n\
+    env.unpacktable = guard(unpacktable)                                        \n\
+    local tbl = {}                                                              \n\
+    for k, f in pairs(table) do                                                 \n\
+        tbl[k] = guard(f)                                                       \n\
+    end                                                                         \n\
+    env.table = tbl                                                             \n\
+end                                                                             \n\
+                                                                                \n\
 function regContract(maxDataLen, _strScript)						            \n\
 	local contract, err = loadstring(_strScript)                                \n\
 	if err then                                                                 \n\
@@ -161,6 +223,54 @@ function callContract(maxDataLen, code, data, funcname, ...)	                \n\
 		end																		\n\
 	end                                                                         \n\
 	return true, strPackData, unpack(ret)				                        \n\
+end                                                                             \n\
+                                                                                \n\
+function callContractKV(maxDataLen, code, data, funcname, ...)                  \n\
+    local myenv = createSafeEnv()                                               \n\
+    if myenv[funcname] ~= nil then                                              \n\
+        return false, 'can not call lua internal function directly'             \n\
+    end                                                                         \n\
+                                                                                \n\
+    local contract = loadstring(code)                                           \n\
+    local values, loaded                                                        \n\
+    data, values, loaded = createKVData()                                       \n\
+    guardKVData(myenv, data)                                                    \n\
+    myenv.PersistentData = data                                                 \n\
+    setfenv(contract, myenv)                                                    \n\
+    local success, err = pcall(contract)                                        \n\
+    if not success then                                                         \n\
+        return false, err                                                       \n\
+    end                                                                         \n\
+                                                                                \n\
+    local ret                                                                   \n\
+    local func = myenv[funcname]                                                \n\
+    if type(func) == 'function' and funcname ~= 'init' then                     \n\
+        ret = { pcall(func, ...) }                                              \n\
+        if not ret[1] then                                                      \n\
+            return false, ret[2]                                                \n\
+        end                                                                     \n\
+        table.remove(ret, 1)                                                    \n\
+    else                                                                        \n\
+        return false, string.format('can not find function %s.', funcname)      \n\
+    end                                                                         \n\
+                                                                                \n\
+    if not rawequal(myenv.PersistentData, data) then                            \n\
+        return false, 'Lua:callContractKV PersistentData can not be replaced'   \n\
+    end                                                                         \n\
+    saveKVData(values, loaded)                                                  \n\
+    return true, nil, unpack(ret)                                               \n\
+end                                                                             \n\
+                                                                                \n\
+function packKVData(data)                                                       \n\
+    local tbl = cmsgpack.unpack(data)                                           \n\
+    if type(tbl) ~= 'table' or tbl.__storage ~= 'kv' then                       \n\
+        return nil                                                              \n\
+    end                                                                         \n\
+    local items = {}                                                            \n\
+    for k, v in pairs(tbl) do                                                   \n\
+        items[cmsgpack.pack(k)] = cmsgpack.pack(v)                              \n\
+    end                                                                         \n\
+    return items                                                                \n\
 end                                                                             \n";
 
 bool GetPubKey(const MCWallet* pWallet, const MagnaChainAddress& addr, MCPubKey& pubKey)
@@ -402,7 +512,280 @@ std::string static DecompressCode(const std::string& buffer)
     return unzipData;
 }
 
-bool static PublishContract(lua_State* L, std::string& rawCode, long& maxCallNum, std::string& dataout, UniValue& ret)
+static const char* CONTRACT_KV_DATA = "_contractkvdata";
+
+// 获取解压后的合约字节码，优先从ContractDataDB的缓存中读取
+static ContractCodeRef GetContractCode(const MCContractID& contractId, const std::string& rawCode)
+{
+    if (mpContractDb == nullptr)
+        return std::make_shared<const ContractCode>(rawCode, DecompressCode(rawCode));
+
+    ContractCodeRef contractCode = mpContractDb->codeCache.Get(contractId, rawCode);
+    if (contractCode == nullptr)
+        contractCode = mpContractDb->codeCache.Insert(contractId, rawCode, DecompressCode(rawCode));
+    return contractCode;
+}
+
+bool ContractKVData::IsKVData(const std::string& data)
+{
+    return data.size() > 0 && (unsigned char)data[0] == KV_DATA_MARKER;
+}
+
+// 键的数据ID，与合约ID使用相同的20字节空间，由合约ID和msgpack编码的键生成
+MCContractID ContractKVData::GetKeyId(const MCContractID& contractId, const std::string& key)
+{
+    MCHashWriter ss(SER_GETHASH, 0);
+    ss << contractId << key;
+    uint256 hash = ss.GetHash();
+    return MCContractID(Hash160(hash.begin(), hash.end()));
+}
+
+ContractAllocator::ContractAllocator()
+{
+    memset(freeLists, 0, sizeof(freeLists));
+}
+
+ContractAllocator::~ContractAllocator()
+{
+    for (Page& page : pages)
+        free(page.base);
+}
+
+void* ContractAllocator::Alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    ContractAllocator* allocator = (ContractAllocator*)ud;
+    if (nsize == 0) {
+        if (ptr != nullptr)
+            allocator->Free(ptr, osize);
+        return nullptr;
+    }
+
+    void* block;
+    if (ptr == nullptr) {
+        block = allocator->Malloc(nsize);
+    }
+    else if (osize > MAX_SLAB_SIZE && nsize > MAX_SLAB_SIZE) {
+        block = realloc(ptr, nsize);
+    }
+    else if (osize <= MAX_SLAB_SIZE && nsize <= MAX_SLAB_SIZE && (osize - 1) / SLAB_ALIGN == (nsize - 1) / SLAB_ALIGN) {
+        block = ptr;
+    }
+    else {
+        block = allocator->Malloc(nsize);
+        if (block != nullptr) {
+            memcpy(block, ptr, std::min(osize, nsize));
+            allocator->Free(ptr, osize);
+        }
+    }
+    return block;
+}
+
+void* ContractAllocator::Malloc(size_t size)
+{
+    if (size > MAX_SLAB_SIZE)
+        return malloc(size);
+
+    size_t index = (size - 1) / SLAB_ALIGN;
+    FreeBlock* block = freeLists[index];
+    if (block != nullptr) {
+        freeLists[index] = block->next;
+        return block;
+    }
+
+    size_t slabSize = (index + 1) * SLAB_ALIGN;
+    if (pageCur == nullptr || pageCur + slabSize > pageEnd) {
+        char* page = (char*)malloc(PAGE_SIZE);
+        if (page == nullptr)
+            return nullptr;
+        if (pageCur != nullptr)
+            pages.back().used = pageCur - pages.back().base;
+        pages.push_back({ page, 0 });
+        pageMemory += PAGE_SIZE;
+        pageCur = page;
+        pageEnd = page + PAGE_SIZE;
+    }
+    void* ptr = pageCur;
+    pageCur += slabSize;
+    return ptr;
+}
+
+void ContractAllocator::Free(void* ptr, size_t size)
+{
+    if (size > MAX_SLAB_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    size_t index = (size - 1) / SLAB_ALIGN;
+    FreeBlock* block = (FreeBlock*)ptr;
+    block->next = freeLists[index];
+    freeLists[index] = block;
+}
+
+size_t ContractAllocator::Trim()
+{
+    if (pages.empty())
+        return 0;
+
+    // 当前页总在最后，按地址排序后用于查找空闲块所在的页，结束时再放回最后
+    char* current = (pageCur != nullptr ? pages.back().base : nullptr);
+    if (current != nullptr)
+        pages.back().used = pageCur - current;
+    std::sort(pages.begin(), pages.end(), [](const Page& a, const Page& b) { return a.base < b.base; });
+    auto findPage = [this](const char* ptr) -> size_t {
+        auto it = std::upper_bound(pages.begin(), pages.end(), ptr, [](const char* p, const Page& page) { return p < page.base; });
+        return (it - pages.begin()) - 1;
+    };
+
+    std::vector<size_t> freeBytes(pages.size(), 0);
+    for (size_t i = 0; i < MAX_SLAB_SIZE / SLAB_ALIGN; ++i) {
+        for (FreeBlock* block = freeLists[i]; block != nullptr; block = block->next)
+            freeBytes[findPage((char*)block)] += (i + 1) * SLAB_ALIGN;
+    }
+
+    // 切分出的块都在空闲链表中的页可以释放，先把这些块从链表中摘除
+    std::vector<bool> release(pages.size());
+    for (size_t i = 0; i < pages.size(); ++i)
+        release[i] = (freeBytes[i] == pages[i].used);
+    for (size_t i = 0; i < MAX_SLAB_SIZE / SLAB_ALIGN; ++i) {
+        FreeBlock** link = &freeLists[i];
+        while (*link != nullptr) {
+            if (release[findPage((char*)*link)])
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+    }
+
+    size_t released = 0;
+    std::vector<Page> keep;
+    for (size_t i = 0; i < pages.size(); ++i) {
+        if (!release[i]) {
+            keep.push_back(pages[i]);
+            continue;
+        }
+        if (pages[i].base == current) {
+            current = nullptr;
+            pageCur = pageEnd = nullptr;
+        }
+        free(pages[i].base);
+        released += PAGE_SIZE;
+    }
+    pages.swap(keep);
+    if (current != nullptr) {
+        auto it = std::find_if(pages.begin(), pages.end(), [current](const Page& page) { return page.base == current; });
+        std::rotate(it, it + 1, pages.end());
+    }
+
+    pageMemory -= released;
+    return released;
+}
+
+static ContractKVData* GetContractKVData(lua_State* L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, CONTRACT_KV_DATA);
+    ContractKVData* pKVData = (ContractKVData*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (pKVData == nullptr)
+        throw std::runtime_error(strprintf("%s => contract is not in kv storage mode", __FUNCTION__));
+    return pKVData;
+}
+
+// 键值存储模式下读取一个键的数据，参数和返回值都是msgpack编码，首次访问时才从ContractDataDB读取
+int static GetKVData(lua_State* L)
+{
+    ContractKVData* pKVData = GetContractKVData(L);
+    SmartLuaState* sls = (SmartLuaState*)L->userData;
+    size_t len = 0;
+    const char* key = luaL_checklstring(L, 1, &len);
+    MCContractID keyId = ContractKVData::GetKeyId(pKVData->contractId, std::string(key, len));
+    sls->kvKeyIds.insert(keyId);
+
+    ContractInfo keyInfo;
+    if (!sls->GetContractInfo(keyId, keyInfo) || keyInfo.data.empty())
+        lua_pushnil(L);
+    else
+        lua_pushlstring(L, keyInfo.data.c_str(), keyInfo.data.size());
+    return 1;
+}
+
+// 键值存储模式下写回一个键的数据，值为nil时删除该键，值不变时不写
+int static SetKVData(lua_State* L)
+{
+    ContractKVData* pKVData = GetContractKVData(L);
+    SmartLuaState* sls = (SmartLuaState*)L->userData;
+    size_t len = 0;
+    const char* key = luaL_checklstring(L, 1, &len);
+    std::string value(1, (char)ContractKVData::KV_NIL_VALUE);
+    if (!lua_isnoneornil(L, 2)) {
+        size_t vl = 0;
+        const char* temp = luaL_checklstring(L, 2, &vl);
+        value.assign(temp, vl);
+    }
+    if (value.size() > MAX_DATA_LEN)
+        return luaL_error(L, "Lua:setkvdata dataLen > maxDataLen");
+
+    MCContractID keyId = ContractKVData::GetKeyId(pKVData->contractId, std::string(key, len));
+    sls->kvKeyIds.insert(keyId);
+
+    ContractInfo keyInfo;
+    bool exist = sls->GetContractInfo(keyId, keyInfo) && !keyInfo.data.empty();
+    bool isNil = (value.size() == 1 && value[0] == (char)ContractKVData::KV_NIL_VALUE);
+    if (exist ? keyInfo.data == value : isNil)
+        return 0;
+
+    if (exist)
+        sls->deltaDataLen += std::max(0, (int32_t)(value.size() - keyInfo.data.size()));
+    else
+        sls->deltaDataLen += len + value.size();
+
+    if (sls->saveType > 0) {
+        keyInfo.txIndex = sls->txIndex;
+        keyInfo.code.clear();
+        keyInfo.data = value;
+        sls->SetContractInfo(keyId, keyInfo, sls->saveType == SmartLuaState::SAVE_TYPE_CACHE);
+    }
+    return 0;
+}
+
+// 发布时若init中声明了键值存储模式，将整块的PersistentData拆分为按键存储，合约自身的数据只保留标记
+// 只做msgpack的解包和打包，每个值的大小受MAX_DATA_LEN限制，不计入指令数
+bool static PackKVData(lua_State* L, std::string& data, std::map<std::string, std::string>& items)
+{
+    if (data.empty())
+        return true;
+
+    int top = lua_gettop(L);
+    lua_getglobal(L, "packKVData");
+    lua_pushlstring(L, data.c_str(), data.size());
+    lu_byte limitOn = L->limit_on;
+    L->limit_on = 0;
+    int result = lua_pcall(L, 1, 1, 0);
+    L->limit_on = limitOn;
+    if (result != 0) {
+        lua_settop(L, top);
+        return false;
+    }
+
+    bool success = true;
+    if (lua_istable(L, -1)) {
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0) {
+            size_t kl = 0, vl = 0;
+            const char* key = lua_tolstring(L, -2, &kl);
+            const char* value = lua_tolstring(L, -1, &vl);
+            items[std::string(key, kl)] = std::string(value, vl);
+            success = success && vl <= MAX_DATA_LEN;
+            lua_pop(L, 1);
+        }
+        data.assign(1, (char)ContractKVData::KV_DATA_MARKER);
+    }
+    lua_settop(L, top);
+    return success;
+}
+
+bool static PublishContract(lua_State* L, std::string& rawCode, long& maxCallNum, std::string& dataout,
+    std::map<std::string, std::string>& kvItems, UniValue& ret)
 {
     int top = lua_gettop(L);
 
@@ -421,6 +804,13 @@ bool static PublishContract(lua_State* L, std::string& rawCode, long& maxCallNum
         size_t cl = 0;
         temp = lua_tolstring(L, top + 3, &cl);
         rawCode.assign(temp, cl);
+
+        // 键值存储模式按发布高度启用，之前发布的合约始终按整块存储执行
+        SmartLuaState* sls = (SmartLuaState*)L->userData;
+        if (sls->blockHeight >= Params().GetConsensus().ContractKVStorageHeight && !PackKVData(L, dataout, kvItems)) {
+            ret.push_back(strprintf("%s error: pack kv data fail", __FUNCTION__));
+            success = false;
+        }
     }
     else {
         const char* err = lua_tostring(L, -1);
@@ -455,23 +845,33 @@ bool PublishContract(SmartLuaState* sls, MagnaChainAddress& contractAddr, std::s
     }
 
     std::string data;
+    std::map<std::string, std::string> kvItems;
     long maxCallNum = MAX_CONTRACT_CALL;
     lua_State* L = sls->GetLuaState(contractAddr);
     L->limit_instruction = maxCallNum;
     SetContractMsg(L, contractAddr.ToString(), sls->originAddr.ToString(), sls->originAddr.ToString(), 0, sls->timestamp, sls->blockHeight);
-    bool success = PublishContract(L, rawCode, maxCallNum, data, ret);
+    bool success = PublishContract(L, rawCode, maxCallNum, data, kvItems, ret);
     maxCallNum = L->limit_instruction;
     if (success) {
         rawCode = CompressCode(rawCode);
         sls->runningTimes = MAX_CONTRACT_CALL - maxCallNum;
         sls->codeLen = rawCode.size();
         sls->deltaDataLen = data.size();
+        for (auto& item : kvItems)
+            sls->deltaDataLen += item.first.size() + item.second.size();
 
         if (sls->saveType > 0) {
             contractInfo.txIndex = sls->txIndex;
             contractInfo.data = data;
             contractInfo.code = rawCode;
             sls->SetContractInfo(contractId, contractInfo, sls->saveType == SmartLuaState::SAVE_TYPE_CACHE);
+
+            for (auto& item : kvItems) {
+                ContractInfo keyInfo;
+                keyInfo.txIndex = sls->txIndex;
+                keyInfo.data = item.second;
+                sls->SetContractInfo(ContractKVData::GetKeyId(contractId, item.first), keyInfo, sls->saveType == SmartLuaState::SAVE_TYPE_CACHE);
+            }
         }
     }
     sls->ReleaseLuaState(L);
@@ -524,18 +924,28 @@ bool PublishContract(SmartLuaState* sls, MCWallet* pWallet, const std::string& s
     return success;
 }
 
-bool static CallContract(lua_State* L, const std::string& rawCode, const std::string& data, 
+bool static CallContract(lua_State* L, const MCContractID& contractId, const std::string& rawCode, const std::string& data, 
     const std::string& strFuncName, const UniValue& args, long& maxCallNum, std::string& dataout, UniValue& ret)
 {
-    const std::string& code = DecompressCode(rawCode);
+    ContractCodeRef contractCode = GetContractCode(contractId, rawCode);
+
+    // 键值存储模式下各键的数据由代理表在访问时读取，调用结束时写回有变化的键
+    ContractKVData kvData;
+    kvData.contractId = contractId;
+    bool kvStorage = ContractKVData::IsKVData(data);
 
     maxCallNum -= GAS_CONTRACT_BYTE;
     int top = lua_gettop(L);
 
-    lua_getglobal(L, "callContract");
+    lua_pushlightuserdata(L, kvStorage ? &kvData : nullptr);
+    lua_setfield(L, LUA_REGISTRYINDEX, CONTRACT_KV_DATA);
+    lua_getglobal(L, kvStorage ? "callContractKV" : "callContract");
     lua_pushnumber(L, MAX_DATA_LEN);
-    lua_pushlstring(L, code.c_str(), code.size());
-    if (data.size() > 0) {
+    lua_pushlstring(L, contractCode->code.c_str(), contractCode->code.size());
+    if (kvStorage) {
+        lua_pushnil(L);
+    }
+    else if (data.size() > 0) {
         lua_pushlstring(L, data.c_str(), data.size());
     }
     else {
@@ -566,11 +976,16 @@ bool static CallContract(lua_State* L, const std::string& rawCode, const std::st
     
     int result = lua_pcall(L, argc, LUA_MULTRET, 0);
     bool success = ((result == 0) && (lua_toboolean(L, top + 1) != 0));
-    if (success) {
+    if (success && kvStorage) {
+        dataout = data;
+    }
+    else if (success) {
         size_t dl = 0;
         const char* temp = lua_tolstring(L, top + 2, &dl);
         dataout.assign(temp, dl);
+    }
 
+    if (success) {
         int newTop = lua_gettop(L);
         for (int i = top + 3; i <= newTop; ++i) {
             int t = lua_type(L, i);
@@ -602,6 +1017,8 @@ bool static CallContract(lua_State* L, const std::string& rawCode, const std::st
         }
     }
 
+    lua_pushlightuserdata(L, nullptr);
+    lua_setfield(L, LUA_REGISTRYINDEX, CONTRACT_KV_DATA);
     lua_settop(L, top);
     return success;
 }
@@ -638,12 +1055,13 @@ bool static CallContractReal(SmartLuaState* sls, MagnaChainAddress& contractAddr
     lua_State* L = sls->GetLuaState(contractAddr);
     L->limit_instruction = maxCallNum;
     SetContractMsg(L, contractAddr.ToString(), sls->originAddr.ToString(), senderAddr, amount, sls->timestamp, sls->blockHeight);
-    bool success = CallContract(L, contractInfo.code, contractInfo.data, strFuncName, args, maxCallNum, data, ret);
+    bool success = CallContract(L, contractId, contractInfo.code, contractInfo.data, strFuncName, args, maxCallNum, data, ret);
     maxCallNum = L->limit_instruction;
     if (success) {
         sls->deltaDataLen += std::max(0, (int32_t)(data.size() - contractInfo.data.size()));
 
-        if (sls->saveType > 0) {
+        // 键值存储模式的合约自身数据不变，只写入有变化的键
+        if (sls->saveType > 0 && !ContractKVData::IsKVData(contractInfo.data)) {
             contractInfo.txIndex = sls->txIndex;
             contractInfo.data = data;
             sls->SetContractInfo(contractId, contractInfo, sls->saveType == SmartLuaState::SAVE_TYPE_CACHE);
@@ -775,6 +1193,8 @@ int static SendCoins(lua_State* L)
     MCContractID contractID;
     sls->contractAddrs[0].GetContractID(contractID);
     MCAmount totalAmount = sls->pCoinAmountCache->GetAmount(contractID);
+    if (sls->coinAmountFrom.count(contractID) == 0)
+        sls->coinAmountFrom[contractID] = totalAmount;
     if (sls->contractOut + amount > totalAmount)
         throw std::runtime_error(strprintf("%s => Contract %s has not enough amount", __FUNCTION__, sls->contractAddrs[0].ToString()));
 
@@ -808,6 +1228,14 @@ void SmartLuaState::Initialize(bool isPublish, int64_t timestamp, int blockHeigh
     }
 }
 
+SmartLuaState::~SmartLuaState()
+{
+    while (!luaStates.empty()) {
+        lua_close(luaStates.front());
+        luaStates.pop();
+    }
+}
+
 lua_State* SmartLuaState::GetLuaState(MagnaChainAddress& contractAddr)
 {
     lua_State* L = nullptr;
@@ -817,7 +1245,7 @@ lua_State* SmartLuaState::GetLuaState(MagnaChainAddress& contractAddr)
         lua_settop(L, 0);
     }
     else {
-        L = lua_open();
+        L = lua_newstate(ContractAllocator::Alloc, &allocator);
         if (L == nullptr) {
             error("cannot create state: not enough memory\n");
             return nullptr;
@@ -828,6 +1256,7 @@ lua_State* SmartLuaState::GetLuaState(MagnaChainAddress& contractAddr)
 
         if (luaL_dostring(L, initscript)) {
             error("%s\n", lua_tostring(L, -1));
+            lua_close(L);
             return nullptr;
         }
 
@@ -835,6 +1264,10 @@ lua_State* SmartLuaState::GetLuaState(MagnaChainAddress& contractAddr)
         lua_setglobal(L, "callcontract");
         lua_pushcfunction(L, SendCoins);
         lua_setglobal(L, "send");
+        lua_pushcfunction(L, GetKVData);
+        lua_setglobal(L, "getkvdata");
+        lua_pushcfunction(L, SetKVData);
+        lua_setglobal(L, "setkvdata");
 
         L->userData = this;
         L->limit_on = 1;
@@ -853,6 +1286,10 @@ void SmartLuaState::ReleaseLuaState(lua_State* L)
     contractAddrs.resize(contractAddrs.size() - 1);
     lua_gc(L, LUA_GCCOLLECT, 0); /* stop collector during initialization */
     luaStates.push(L);
+
+    // 顶层调用结束后归还超出保留上限的空闲页
+    if (contractAddrs.empty() && allocator.pageMemory > ContractAllocator::MAX_RETAINED_MEMORY)
+        allocator.Trim();
 }
 
 void SmartLuaState::Clear()
@@ -873,6 +1310,8 @@ void SmartLuaState::Clear()
     contractIds.clear();
     contractAddrs.clear();
     contractDataFrom.clear();
+    kvKeyIds.clear();
+    coinAmountFrom.clear();
 }
 
 void SmartLuaState::SetContractInfo(const MCContractID& contractId, ContractInfo& contractInfo, bool cache)
@@ -977,6 +1416,7 @@ uint256 GetTxHashWithData(const uint256& txHash, const CONTRACT_DATA& contractDa
 {
     MCHashWriter ss(SER_GETHASH, 0);
     ss << txHash;
+    // 键值存储模式的data按键排序编码，与代理表中键的访问顺序无关
     for (auto item : contractData) {
         ss << item.first << item.second.txIndex << item.second.code << item.second.data;
     }
@@ -25,6 +25,70 @@ const int MAX_CONTRACT_FILE_LEN = 65536;
 const int MAX_CONTRACT_CALL = 15000;
 const int MAX_DATA_LEN = 1024 * 1024;
 
+/**
+ * 键值存储模式的合约数据。发布高度不低于ContractKVStorageHeight的合约在init中设置PersistentData.__storage = 'kv'后启用，
+ * 之后合约自身的数据只有KV_DATA_MARKER，PersistentData的每个键作为一条独立的合约数据保存，ID由GetKeyId生成，
+ * 与普通合约数据一样按区块保存版本、随回滚撤销，并计入读写集和区块的数据哈希。
+ * 调用时PersistentData为代理表，只从ContractDataDB读取访问到的键，只写回值有变化的键，代理表不能遍历。
+ */
+class ContractKVData
+{
+public:
+    static const unsigned char KV_DATA_MARKER = 0xc1; // msgpack中不使用的字节，用于与整块存储的数据区分
+    static const unsigned char KV_NIL_VALUE = 0xc0;   // msgpack的nil，表示键已删除，空数据在ContractDataDB中表示未加载
+
+    MCContractID contractId;    // 当前调用的合约
+
+    static bool IsKVData(const std::string& data);
+    static MCContractID GetKeyId(const MCContractID& contractId, const std::string& key);
+};
+
+/**
+ * 合约lua_State的内存分配器，由SmartLuaState持有，只在所属线程内使用，不需要加锁。
+ * 不超过MAX_SLAB_SIZE的小块按16字节分级，从整页中切分，释放后挂回对应级别的空闲链表复用；大块直接使用系统分配。
+ * 顶层调用结束后页内存超过MAX_RETAINED_MEMORY时由Trim归还没有在用小块的页，限制调用之间保留的内存。
+ * 只改变内存的来源，每次调用的内存上限仍由lmem.c按totalbytes(请求大小之和)确定性地检查，合约可见的行为不变。
+ */
+class ContractAllocator
+{
+public:
+    ContractAllocator();
+    ~ContractAllocator();
+    ContractAllocator(const ContractAllocator&) = delete;
+    ContractAllocator& operator=(const ContractAllocator&) = delete;
+
+    // lua_Alloc，ud为ContractAllocator指针
+    static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    // 释放所有小块都已归还的页，返回释放的字节数
+    size_t Trim();
+
+    static const size_t MAX_RETAINED_MEMORY = 4 * 1024 * 1024;    // 顶层调用结束后保留的页内存上限
+    size_t pageMemory = 0;      // 已申请的页内存
+
+private:
+    static const size_t SLAB_ALIGN = 16;
+    static const size_t MAX_SLAB_SIZE = 512;
+    static const size_t PAGE_SIZE = 64 * 1024;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Page {
+        char* base;
+        size_t used;    // 已切分的字节数，当前页以pageCur为准
+    };
+
+    FreeBlock* freeLists[MAX_SLAB_SIZE / SLAB_ALIGN];
+    std::vector<Page> pages;
+    char* pageCur = nullptr;
+    char* pageEnd = nullptr;
+
+    void* Malloc(size_t size);
+    void Free(void* ptr, size_t size);
+};
+
 class Coin;
 class MCWallet;
 class MCWalletTx;
@@ -56,6 +120,9 @@ public:
     int internalCallNum = 0;
     CoinAmountCache* pCoinAmountCache;
     std::map<MCContractID, ContractInfo> contractDataFrom;
+    std::set<MCContractID> kvKeyIds;    // 键值存储模式下访问过的键，包括读到时不存在的键
+    std::map<MCContractID, MCAmount> coinAmountFrom;    // 执行期间读取过的合约余额
+    ContractAllocator allocator;    // 须在luaStates之前声明，保证析构时lua_State先关闭
 
 private:
     mutable MCCriticalSection contractCS;
@@ -65,6 +132,8 @@ private:
     MCTransactionRef tx;
 
 public:
+    ~SmartLuaState();
+
     void SetContractInfo(const MCContractID& contractId, ContractInfo& contractInfo, bool cache);
     bool GetContractInfo(const MCContractID& contractId, ContractInfo& contractInfo);
 
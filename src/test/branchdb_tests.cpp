@@ -3,7 +3,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain/branchchain.h"
 #include "chain/branchdb.h"
+#include "chain/branchsendqueue.h"
+#include "consensus/merkle.h"
+#include "rpc/protocol.h"
 #include "primitives/transaction.h"
 #include "coding/uint256.h"
 #include "coding/arith_uint256.h"
@@ -13,6 +17,8 @@
 
 #include <vector>
 
+#include <univalue.h>
+
 #include <boost/test/unit_test.hpp>
 #include "validation/validation.h"
 
@@ -24,6 +30,10 @@ public:
     {
         BranchDb::AddBlockInfoTxData(transaction, mainBlockHash, iTxVtxIndex, modifyBranch);
     }
+    BranchData& GetBranchDataRef(const uint256& branchId)
+    {
+        return *FindBranchData(branchId);
+    }
 };
 
 void AddBlockInfoTx(MCMutableTransaction &mtx, const uint256 &branchid, MCBlockHeader &header, const uint32_t &nbits, uint32_t &preblockH, uint32_t &t, MCBranchBlockInfo &firstBlock, BranchDbTest &branchdb, uint256 &temphash, const size_t &txindex, std::set<uint256> &modifyBranch)
@@ -549,4 +559,454 @@ BOOST_AUTO_TEST_CASE(branchdb_flushreportprove)
     }
 }
 
+BOOST_AUTO_TEST_CASE(branchdb_reload)
+{
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+    uint256 branchid = uint256S("8af97c9b85ebf8b0f16b4c50cd1fa72c50dfa5d1bec93625c1dde7a4f211b65e");
+    const MCBlock& genesisblock = BranchParams(branchid).GenesisBlock();
+    uint32_t nbits = genesisblock.nBits;
+
+    std::vector<unsigned char> vchStakeTxData;
+    MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, vchStakeTxData, 0, MakeTransactionRef() };
+
+    uint32_t mainblocktime = 0;
+    uint32_t branchblocktime = 0;
+    uint256 mainpreblockhash;
+    int mainblockheight = 1;
+    MCBlockIndex* pprev = nullptr;
+
+    std::shared_ptr<MCBlock> pblock1 = std::make_shared<MCBlock>();
+    std::shared_ptr<MCBlock> pblock2 = std::make_shared<MCBlock>();
+    VBRANCH_CHAIN vecChainBefore;
+    VBRANCH_CHAIN vecChainAfter;
+    {
+        BranchDbTest branchdb(path, 8 << 20, false, false);
+
+        // main block 1: branch blocks 1-3
+        NewMainBlockHead(pblock1, nbits, mainblocktime, mainpreblockhash, mainblockheight, pprev);
+        MCBlockHeader preHeader = genesisblock;
+        uint32_t preblockH = 0;
+        CreateTestTxToBlock(pblock1, branchid, preHeader, nbits, preblockH, branchblocktime, vchStakeTxData);
+        pblock1->vtx.back()->pBranchBlockData->GetBlockHeader(preHeader);
+        MCBlockHeader forkHeader = preHeader;
+        for (int i = 0; i < 2; i++) {
+            CreateTestTxToBlock(pblock1, branchid, preHeader, nbits, preblockH, branchblocktime, vchStakeTxData);
+            pblock1->vtx.back()->pBranchBlockData->GetBlockHeader(preHeader);
+        }
+        branchdb.Flush(pblock1, true);
+        vecChainBefore = branchdb.GetActiveChain(branchid);
+        BOOST_CHECK(vecChainBefore.size() == 4);
+
+        // main block 2: longer fork from branch block 1
+        NewMainBlockHead(pblock2, nbits, mainblocktime, mainpreblockhash, mainblockheight, pprev);
+        preHeader = forkHeader;
+        preblockH = 1;
+        for (int i = 0; i < 3; i++) {
+            CreateTestTxToBlock(pblock2, branchid, preHeader, nbits, preblockH, branchblocktime, vchStakeTxData);
+            pblock2->vtx.back()->pBranchBlockData->GetBlockHeader(preHeader);
+        }
+        branchdb.Flush(pblock2, true);
+        vecChainAfter = branchdb.GetActiveChain(branchid);
+        BOOST_CHECK(vecChainAfter.size() == 5);
+        BOOST_CHECK(vecChainAfter.back() == preHeader.GetHash());
+    }
+
+    {
+        BranchDbTest branchdb(path, 8 << 20, false, false);
+        branchdb.LoadData();
+        BOOST_CHECK(branchdb.HasBranchData(branchid));
+        BOOST_CHECK(branchdb.GetActiveChain(branchid) == vecChainAfter);
+        BOOST_CHECK(branchdb.IsBlockInActiveChain(branchid, vecChainAfter[2]));
+        BOOST_CHECK(!branchdb.IsBlockInActiveChain(branchid, vecChainBefore[2]));
+
+        // the tip snapshot of main block 1 is reloaded too
+        branchdb.Flush(pblock2, false);
+        BOOST_CHECK(branchdb.GetActiveChain(branchid) == vecChainBefore);
+    }
+
+    {
+        BranchDbTest branchdb(path, 8 << 20, false, false);
+        branchdb.LoadData();
+        BOOST_CHECK(branchdb.GetActiveChain(branchid) == vecChainBefore);
+        BOOST_CHECK(branchdb.GetBranchHeight(branchid) == 3);
+        BranchData data = branchdb.GetBranchData(branchid);
+        BOOST_CHECK(data.mapHeads.size() == 4);
+    }
+    fs::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(branchdb_ancestor)
+{
+    BranchDbTest branchdb(fs::temp_directory_path() / fs::unique_path(), 8 << 20, false, false);
+    uint256 branchid = uint256S("8af97c9b85ebf8b0f16b4c50cd1fa72c50dfa5d1bec93625c1dde7a4f211b65e");
+    const MCBlock& genesisblock = BranchParams(branchid).GenesisBlock();
+
+    MCBranchBlockInfo firstBlock;
+    MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, firstBlock.vchStakeTxData, 0, MakeTransactionRef() };
+    MCMutableTransaction mtx;
+    uint256 temphash;
+    uint32_t t = 0;
+    std::set<uint256> modifyBranch;
+
+    // main chain of 600 blocks and a fork of 300 blocks from height 200
+    std::vector<uint256> vecMain;
+    std::vector<uint256> vecFork;
+    MCBlockHeader header = genesisblock;
+    uint32_t preblockH = 0;
+    MCBlockHeader forkHeader;
+    for (int i = 1; i <= 600; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecMain.push_back(header.GetHash());
+        if (i == 200)
+            forkHeader = header;
+    }
+    header = forkHeader;
+    preblockH = 200;
+    for (int i = 0; i < 300; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecFork.push_back(header.GetHash());
+    }
+    BOOST_CHECK(branchdb.GetBranchTipHash(branchid) == vecMain.back());
+
+    // a copy has no links and falls back to walking hashPrevBlock
+    BranchData copydata = branchdb.GetBranchData(branchid);
+    for (BranchData* pData : {&branchdb.GetBranchDataRef(branchid), &copydata}) {
+        BranchBlockData* pTip = pData->GetBranchBlockData(vecMain.back());
+        BranchBlockData* pForkTip = pData->GetBranchBlockData(vecFork.back());
+        BOOST_CHECK(pData->GetAncestor(pTip, 0)->header.GetHash() == genesisblock.GetHash());
+        BOOST_CHECK(pData->GetAncestor(pTip, -1) == nullptr);
+        BOOST_CHECK(pData->GetAncestor(pTip, 700) == pTip);
+        for (int h = 1; h <= 600; h += 7) {
+            BOOST_CHECK(pData->GetAncestor(pTip, h)->header.GetHash() == vecMain[h - 1]);
+            BOOST_CHECK(pData->GetAncestor(pForkTip, std::min(h, 500))->header.GetHash() ==
+                        (h <= 200 ? vecMain[h - 1] : vecFork[std::min(h, 500) - 201]));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(branchdb_besttip)
+{
+    BranchDbTest branchdb(fs::temp_directory_path() / fs::unique_path(), 8 << 20, false, false);
+    uint256 branchid = uint256S("8af97c9b85ebf8b0f16b4c50cd1fa72c50dfa5d1bec93625c1dde7a4f211b65e");
+    const MCBlock& genesisblock = BranchParams(branchid).GenesisBlock();
+
+    MCBranchBlockInfo firstBlock;
+    MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, firstBlock.vchStakeTxData, 0, MakeTransactionRef() };
+    MCMutableTransaction mtx;
+    uint256 temphash;
+    uint32_t t = 0;
+    std::set<uint256> modifyBranch;
+
+    // main chain of 20 blocks and a fork of 10 blocks from height 5
+    std::vector<uint256> vecMain;
+    std::vector<uint256> vecFork;
+    MCBlockHeader header = genesisblock;
+    uint32_t preblockH = 0;
+    MCBlockHeader forkHeader;
+    for (int i = 1; i <= 20; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecMain.push_back(header.GetHash());
+        if (i == 5)
+            forkHeader = header;
+    }
+    header = forkHeader;
+    preblockH = 5;
+    for (int i = 0; i < 10; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecFork.push_back(header.GetHash());
+    }
+
+    BranchData& data = branchdb.GetBranchDataRef(branchid);
+    BOOST_CHECK(data.setTipCandidates.size() == 2);
+    BOOST_CHECK(data.FindBestTipBlock() == vecMain.back());
+
+    // report main chain block 10, the fork becomes the best
+    bool fStatusChange = false;
+    data.mapHeads[vecMain[9]].mapReportStatus[uint256S("1")] = RP_FLAG_REPORTED;
+    data.UpdateDeadStatus(vecMain[9], fStatusChange);
+    BOOST_CHECK(fStatusChange);
+    BOOST_CHECK(data.FindBestTipBlock() == vecFork.back());
+
+    // report the fork below the fork tip, main chain block 9 is the best live block
+    data.mapHeads[vecFork[2]].mapReportStatus[uint256S("2")] = RP_FLAG_REPORTED;
+    data.UpdateDeadStatus(vecFork[2], fStatusChange);
+    BOOST_CHECK(data.FindBestTipBlock() == vecMain[8]);
+
+    // prove main chain block 10, main tip is back
+    fStatusChange = false;
+    data.mapHeads[vecMain[9]].mapReportStatus[uint256S("1")] = RP_FLAG_PROVED;
+    data.UpdateRebornStatus(vecMain[9], fStatusChange);
+    BOOST_CHECK(fStatusChange);
+    BOOST_CHECK(data.FindBestTipBlock() == vecMain.back());
+
+    BranchData rebuilt = data;
+    rebuilt.BuildTipCandidates();
+    BOOST_CHECK(rebuilt.setTipCandidates == data.setTipCandidates);
+}
+
+BOOST_AUTO_TEST_CASE(branchdb_besttip_equal_work)
+{
+    BranchDbTest branchdb(fs::temp_directory_path() / fs::unique_path(), 8 << 20, false, false);
+    uint256 branchid = uint256S("8af97c9b85ebf8b0f16b4c50cd1fa72c50dfa5d1bec93625c1dde7a4f211b65e");
+    const MCBlock& genesisblock = BranchParams(branchid).GenesisBlock();
+
+    MCBranchBlockInfo firstBlock;
+    MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, firstBlock.vchStakeTxData, 0, MakeTransactionRef() };
+    MCMutableTransaction mtx;
+    uint256 temphash;
+    uint32_t t = 0;
+    std::set<uint256> modifyBranch;
+
+    // main chain of 3 blocks, then a fork of 2 blocks from block 1 with the same work
+    std::vector<uint256> vecMain;
+    std::vector<uint256> vecFork;
+    MCBlockHeader header = genesisblock;
+    uint32_t preblockH = 0;
+    MCBlockHeader forkHeader;
+    for (int i = 1; i <= 3; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecMain.push_back(header.GetHash());
+        if (i == 1)
+            forkHeader = header;
+    }
+    MCBlockHeader mainHeader = header;
+    header = forkHeader;
+    preblockH = 1;
+    for (int i = 0; i < 2; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+        vecFork.push_back(header.GetHash());
+    }
+
+    // equal work: the first tip in depth-first order from genesis wins, like the old tree walk
+    BranchData& data = branchdb.GetBranchDataRef(branchid);
+    BOOST_CHECK(data.setTipCandidates.size() == 2);
+    BOOST_CHECK(data.mapHeads[vecMain.back()].nChainWork == data.mapHeads[vecFork.back()].nChainWork);
+    BOOST_CHECK(data.FindBestTipBlock() == vecMain.back());
+
+    // extend the fork first, then the main chain to the same work.
+    // the main chain is still first in depth-first order, although its tip was seen last
+    AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+    mtx.pBranchBlockData->GetBlockHeader(header);
+    vecFork.push_back(header.GetHash());
+    BOOST_CHECK(data.FindBestTipBlock() == vecFork.back());
+    BOOST_CHECK(data.TipHash() == vecFork.back());
+
+    header = mainHeader;
+    preblockH = 3;
+    AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+    mtx.pBranchBlockData->GetBlockHeader(header);
+    vecMain.push_back(header.GetHash());
+    BOOST_CHECK(data.TipHash() == vecFork.back());
+    BOOST_CHECK(data.FindBestTipBlock() == vecMain.back());
+
+    // a dead main chain tip leaves the fork as the only best tip
+    bool fStatusChange = false;
+    data.mapHeads[vecMain.back()].mapReportStatus[uint256S("1")] = RP_FLAG_REPORTED;
+    data.UpdateDeadStatus(vecMain.back(), fStatusChange);
+    BOOST_CHECK(data.FindBestTipBlock() == vecFork.back());
+}
+
+BOOST_AUTO_TEST_CASE(branchcache_view)
+{
+    BranchDbTest branchdb(fs::temp_directory_path() / fs::unique_path(), 8 << 20, false, false);
+    uint256 branchid = uint256S("8af97c9b85ebf8b0f16b4c50cd1fa72c50dfa5d1bec93625c1dde7a4f211b65e");
+    const MCBlock& genesisblock = BranchParams(branchid).GenesisBlock();
+
+    MCBranchBlockInfo firstBlock;
+    MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, firstBlock.vchStakeTxData, 0, MakeTransactionRef() };
+    MCMutableTransaction mtx;
+    uint256 temphash;
+    uint32_t t = 0;
+    std::set<uint256> modifyBranch;
+    MCBlockHeader header = genesisblock;
+    uint32_t preblockH = 0;
+    for (int i = 0; i < 3; i++) {
+        AddBlockInfoTx(mtx, branchid, header, genesisblock.nBits, preblockH, t, firstBlock, branchdb, temphash, 0, modifyBranch);
+        mtx.pBranchBlockData->GetBlockHeader(header);
+    }
+
+    // reading through the cache does not copy the db data
+    BranchCache branchcache(&branchdb);
+    const BranchData& dbView = branchdb.GetBranchDataView(branchid);
+    BOOST_CHECK(&branchcache.GetBranchDataView(branchid) == &dbView);
+    BOOST_CHECK(branchcache.GetBranchBlockData(branchid, header.GetHash()) == nullptr);
+    BOOST_CHECK(&branchcache.GetBranchDataView(branchid) == &dbView);
+    BOOST_CHECK(dbView.GetBranchBlockData(header.GetHash()) != nullptr);
+    BOOST_CHECK(branchcache.GetBranchTipHash(branchid) == header.GetHash());
+
+    // a new block in the cache goes to its own copy
+    mtx.nVersion = MCTransaction::SYNC_BRANCH_INFO;
+    mtx.pBranchBlockData->hashPrevBlock = header.GetHash();
+    mtx.pBranchBlockData->blockHeight = ++preblockH;
+    mtx.pBranchBlockData->nTime = t++;
+    branchcache.AddToCache(MCTransaction(mtx));
+    MCBlockHeader newHeader;
+    mtx.pBranchBlockData->GetBlockHeader(newHeader);
+    BOOST_CHECK(&branchcache.GetBranchDataView(branchid) != &dbView);
+    BOOST_CHECK(branchcache.GetBranchBlockData(branchid, newHeader.GetHash()) != nullptr);
+    BOOST_CHECK(dbView.GetBranchBlockData(newHeader.GetHash()) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(spvproof_cache)
+{
+    MCBlock block;
+    for (uint32_t i = 0; i < 5; i++) {
+        MCMutableTransaction mtx;
+        mtx.nLockTime = i;
+        block.vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    const uint256 txid = block.vtx[2]->GetHash();
+
+    std::unique_ptr<MCSpvProof> spv(NewSpvProof(block, {txid}));
+    BOOST_CHECK(CheckSpvProofWithCache(block.hashMerkleRoot, spv->pmt, txid));
+    // cached result
+    BOOST_CHECK(CheckSpvProofWithCache(block.hashMerkleRoot, spv->pmt, txid));
+    BOOST_CHECK(!CheckSpvProofWithCache(block.hashMerkleRoot, spv->pmt, block.vtx[3]->GetHash()));
+    BOOST_CHECK(!CheckSpvProofWithCache(uint256S("1234"), spv->pmt, txid));
+
+    // a different proof of the same tx is checked on its own, not taken from the cache
+    std::unique_ptr<MCSpvProof> spvMulti(NewSpvProof(block, {txid, block.vtx[3]->GetHash()}));
+    BOOST_CHECK(!CheckSpvProofWithCache(block.hashMerkleRoot, spvMulti->pmt, txid));
+}
+
+class BranchSendQueueTest : public BranchSendQueue
+{
+public:
+    BranchSendQueueTest(const fs::path& path, size_t nCacheSize) : BranchSendQueue(path, nCacheSize) {}
+    int64_t CollectBatches(int64_t nNow, std::map<std::string, std::vector<BranchSendItem>>& mapBatches)
+    {
+        return BranchSendQueue::CollectBatches(nNow, mapBatches);
+    }
+    void ProcessReplies(const std::string& strChainId, const std::vector<BranchSendItem>& vItems, const UniValue& replies)
+    {
+        BranchSendQueue::ProcessReplies(strChainId, vItems, replies);
+    }
+};
+
+static UniValue SendReply(const BranchSendItem& item, const UniValue& result, const std::string& strError)
+{
+    UniValue error(UniValue::VNULL);
+    if (!strError.empty()) {
+        error = UniValue(UniValue::VOBJ);
+        error.push_back(Pair("code", -4));
+        error.push_back(Pair("message", strError));
+    }
+    return JSONRPCReplyObj(result, error, UniValue(item.nSeq));
+}
+
+BOOST_AUTO_TEST_CASE(branch_send_queue_persist)
+{
+    fs::path path = fs::temp_directory_path() / strprintf("branchsendqueue_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    UniValue params(UniValue::VARR);
+    params.push_back("00");
+    {
+        BranchSendQueue queue(path, 1 << 20);
+        queue.Push("main", "submitbranchblockinfo", params);
+        queue.Push("main", "redeemmortgagecoin", params);
+        queue.Push("branch", "makebranchtransaction", params);
+        UniValue info = queue.GetInfo();
+        BOOST_CHECK_EQUAL(find_value(info, "size").get_int(), 3);
+        BOOST_CHECK_EQUAL(find_value(find_value(info, "chains"), "main").get_int(), 2);
+    }
+
+    // pending requests are reloaded on restart
+    {
+        BranchSendQueue queue(path, 1 << 20);
+        queue.Push("main", "submitbranchblockinfo", params);
+        UniValue info = queue.GetInfo();
+        BOOST_CHECK_EQUAL(find_value(info, "size").get_int(), 4);
+        BOOST_CHECK_EQUAL(find_value(find_value(info, "chains"), "main").get_int(), 3);
+        BOOST_CHECK_EQUAL(find_value(find_value(info, "chains"), "branch").get_int(), 1);
+        BOOST_CHECK_EQUAL(find_value(info, "sent").get_int(), 0);
+    }
+    fs::remove_all(path);
+
+    // a rejected request moves behind later ones, duplicates count as sent
+    path = fs::temp_directory_path() / strprintf("branchsendqueue_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    const int64_t nNow = GetTime();
+    {
+        BranchSendQueueTest queue(path, 1 << 20);
+        queue.Push("main", "submitbranchblockinfo", params);
+        queue.Push("main", "makebranchtransaction", params);
+        queue.Push("main", "redeemmortgagecoin", params);
+        queue.Push("main", "submitprovetx", params);
+
+        std::map<std::string, std::vector<BranchSendItem>> mapBatches;
+        queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 4);
+        std::vector<BranchSendItem> vSent(mapBatches["main"].begin(), mapBatches["main"].begin() + 3);
+
+        UniValue replies(UniValue::VARR);
+        replies.push_back(SendReply(vSent[0], NullUniValue, "Error: accept to memory pool fail: txn-already-in-mempool"));
+        replies.push_back(SendReply(vSent[1], NullUniValue, "Error: accept to memory pool fail: bad-txns-inputs-missingorspent"));
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("txid", uint256().GetHex()));
+        replies.push_back(SendReply(vSent[2], result, ""));
+        queue.ProcessReplies("main", vSent, replies);
+
+        UniValue info = queue.GetInfo();
+        BOOST_CHECK_EQUAL(find_value(info, "size").get_int(), 2);
+        BOOST_CHECK_EQUAL(find_value(info, "sent").get_int(), 2);
+        BOOST_CHECK_EQUAL(find_value(info, "failed").get_int(), 1);
+
+        // the rejected request backs off alone and does not hold up the chain
+        mapBatches.clear();
+        int64_t nWake = queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 1);
+        BOOST_CHECK_EQUAL(mapBatches["main"][0].strMethod, "submitprovetx");
+        BOOST_CHECK(nWake > nNow);
+    }
+
+    // after a restart the rejected request is still queued, after the later one
+    {
+        BranchSendQueueTest queue(path, 1 << 20);
+        std::map<std::string, std::vector<BranchSendItem>> mapBatches;
+        queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 2);
+        BOOST_CHECK_EQUAL(mapBatches["main"][0].strMethod, "submitprovetx");
+        BOOST_CHECK_EQUAL(mapBatches["main"][1].strMethod, "makebranchtransaction");
+        BOOST_CHECK_EQUAL(mapBatches["main"][1].nTries, 1);
+    }
+    fs::remove_all(path);
+
+    // a rejected branch block info keeps its place and holds up later block infos of the same chain only
+    path = fs::temp_directory_path() / strprintf("branchsendqueue_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    {
+        BranchSendQueueTest queue(path, 1 << 20);
+        queue.Push("main", "submitbranchblockinfo", params);
+        queue.Push("main", "submitbranchblockinfo", params);
+        queue.Push("main", "redeemmortgagecoin", params);
+
+        std::map<std::string, std::vector<BranchSendItem>> mapBatches;
+        queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 3);
+        std::vector<BranchSendItem> vSent(1, mapBatches["main"][0]);
+        UniValue replies(UniValue::VARR);
+        replies.push_back(SendReply(vSent[0], NullUniValue, "prev block not found"));
+        queue.ProcessReplies("main", vSent, replies);
+
+        mapBatches.clear();
+        queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 1);
+        BOOST_CHECK_EQUAL(mapBatches["main"][0].strMethod, "redeemmortgagecoin");
+    }
+    {
+        BranchSendQueueTest queue(path, 1 << 20);
+        std::map<std::string, std::vector<BranchSendItem>> mapBatches;
+        queue.CollectBatches(nNow, mapBatches);
+        BOOST_CHECK_EQUAL(mapBatches["main"].size(), 3);
+        BOOST_CHECK_EQUAL(mapBatches["main"][0].strMethod, "submitbranchblockinfo");
+        BOOST_CHECK_EQUAL(mapBatches["main"][0].nTries, 1);
+        BOOST_CHECK_EQUAL(mapBatches["main"][1].nTries, 0);
+    }
+    fs::remove_all(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -541,4 +541,135 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity_need_rewrite)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(stake_kernel)
+{
+    // 一段不在主链上的区块索引，高度已过大爆炸阶段
+    const int nBlocks = 40;
+    std::vector<uint256> hashes(nBlocks);
+    std::vector<MCBlockIndex> indexes(nBlocks);
+    for (int i = 0; i < nBlocks; ++i) {
+        hashes[i] = InsecureRand256();
+        indexes[i].phashBlock = &hashes[i];
+        indexes[i].nHeight = 2000 + i;
+        indexes[i].nNonce = 1000 + i;
+        indexes[i].pprev = i > 0 ? &indexes[i - 1] : nullptr;
+    }
+    StakeKernel kernel(&indexes.back());
+    BOOST_CHECK(!kernel.IsBigBoom());
+    BOOST_CHECK(!kernel.IsBranchFirstBlock());
+
+    // 不持有cs_main时按已取出的抵押币计算币龄
+    Coin coin(MCTxOut(50 * COIN, MCScript()), 1000, false);
+    BOOST_CHECK_EQUAL(kernel.GetStakeAmount(coin), 50 * (2039 - (1000 + COINBASE_MATURITY - 1)));
+    BOOST_CHECK(kernel.IsComplete());
+    // 同一个上一块共用缓存的上下文
+    BOOST_CHECK(GetStakeKernel(&indexes.back()) == GetStakeKernel(&indexes.back()));
+    BOOST_CHECK(GetStakeKernel(&indexes.back()) != GetStakeKernel(&indexes[nBlocks - 2]));
+
+    MCKey key;
+    key.MakeNewKey(true);
+    MCKeyID keyid = key.GetPubKey().GetID();
+    MCOutPoint outpoint(InsecureRand256(), 1);
+
+    // 按GetBlockWork的算法直接计算
+    MCHashWriter sheader(SER_GETHASH, PROTOCOL_VERSION);
+    MCHashWriter snum(SER_GETHASH, PROTOCOL_VERSION);
+    for (int i = 2; i < nBlocks; i *= 2)
+        sheader << hashes[nBlocks - 1 - i];
+    for (int i = 3; i < nBlocks; i *= 3)
+        snum << hashes[nBlocks - 1 - i];
+    sheader << (uint160)keyid << outpoint.hash << outpoint.n;
+    snum << (uint160)keyid;
+    const uint256 hash = sheader.GetHash();
+    const uint64_t nPercent = snum.GetHash().GetCheapHash() % 100;
+    const MCAmount nAvgNonce = 1019;
+
+    for (MCAmount total : {MCAmount(1000), MCAmount(100000)}) {
+        MCAmount nLimited = std::min(total, nAvgNonce + nAvgNonce / 20);
+        MCAmount nMount = nLimited * nPercent / 100;
+        arith_uint256 expected = UintToArith256(hash);
+        if (nMount > 1)
+            expected /= nMount;
+        expected.SetCompact(expected.GetCompact());
+
+        uint256 work;
+        uint32_t nWork = kernel.GetWork(keyid, outpoint, total, work);
+        if (nMount == 0) {
+            BOOST_CHECK_EQUAL(nWork, 0);
+            BOOST_CHECK(work == uint256S("0xffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
+        }
+        else {
+            BOOST_CHECK_EQUAL(nWork, nLimited);
+            BOOST_CHECK(work == ArithToUint256(expected));
+        }
+    }
+
+    // GetBlockWork使用同样的计算，抵押币不存在时工作量为最大值
+    MCMutableTransaction coinbase;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = GetScriptForDestination(keyid);
+    MCBlock block;
+    block.hashPrevBlock = hashes.back();
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    uint256 blockWork, kernelWork;
+    mapBlockIndex[hashes.back()] = &indexes.back();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(GetBlockWork(block, outpoint, blockWork), kernel.GetWork(keyid, outpoint, kernel.GetStakeAmount(outpoint), kernelWork));
+    }
+    mapBlockIndex.erase(hashes.back());
+    BOOST_CHECK(blockWork == kernelWork);
+    BOOST_CHECK(blockWork == uint256S("0xffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
+}
+
+static MCTransactionRef MakeGroupTestTx(const MCOutPoint& prevout, size_t nScriptSize)
+{
+    MCMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vin[0].scriptSig = MCScript() << std::vector<unsigned char>(nScriptSize, 0x01);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 1 * COIN;
+    tx.vout[1].nValue = 1 * COIN;
+    return MakeTransactionRef(tx);
+}
+
+BOOST_AUTO_TEST_CASE(group_block_transactions)
+{
+    const uint256 hashOut = InsecureRand256();
+    std::vector<MCTransactionRef> vtx;
+    vtx.push_back(nullptr); // coinbase is not init when grouping
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(hashOut, 0), 10));             // 1
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(vtx[1]->GetHash(), 0), 10));   // 2 spends 1
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(hashOut, 1), 10));             // 3 spends the same tx as 1
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(InsecureRand256(), 0), 1000)); // 4
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(InsecureRand256(), 0), 1000)); // 5
+    vtx.push_back(MakeGroupTestTx(MCOutPoint(InsecureRand256(), 0), 10));   // 6
+    std::vector<const MCTxMemPoolEntry*> entries(vtx.size(), nullptr);
+
+    std::vector<std::vector<int>> groups = BlockAssembler::GroupBlockTransactions(vtx, 1, entries, MAX_GROUP_NUM);
+    // 空的coinbase代价为0，第一组也会分到其他交易
+    BOOST_CHECK_EQUAL(groups.size(), 4);
+    BOOST_CHECK_EQUAL(groups[0].front(), 0);
+    std::set<int> seen;
+    for (const std::vector<int>& group : groups) {
+        BOOST_CHECK(std::is_sorted(group.begin(), group.end()));
+        seen.insert(group.begin(), group.end());
+        if (std::find(group.begin(), group.end(), 1) != group.end())
+            BOOST_CHECK(group == std::vector<int>({1, 2, 3}));
+    }
+    BOOST_CHECK_EQUAL(seen.size(), vtx.size());
+
+    // 组数不够时按代价分配，两笔大交易分到不同的组
+    groups = BlockAssembler::GroupBlockTransactions(vtx, 1, entries, 3);
+    BOOST_CHECK_EQUAL(groups.size(), 3);
+    BOOST_CHECK_EQUAL(groups[0].front(), 0);
+    for (const std::vector<int>& group : groups) {
+        bool has4 = std::find(group.begin(), group.end(), 4) != group.end();
+        bool has5 = std::find(group.begin(), group.end(), 5) != group.end();
+        BOOST_CHECK(!(has4 && has5));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
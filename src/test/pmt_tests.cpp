@@ -107,6 +107,37 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(pmt_single_from_levels)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 7, 17, 56, 127, 256, 513};
+
+    for (unsigned int nTx : nTxCounts) {
+        std::vector<uint256> vTxid(nTx);
+        for (unsigned int j = 0; j < nTx; j++)
+            vTxid[j] = ArithToUint256(j + 1);
+        std::vector<std::vector<uint256> > vLevels;
+        MCPartialMerkleTree::CalcTreeLevels(vTxid, vLevels);
+
+        for (unsigned int j = 0; j < nTx; j++) {
+            std::vector<bool> vMatch(nTx, false);
+            vMatch[j] = true;
+            MCPartialMerkleTree pmt1(vTxid, vMatch);
+            MCPartialMerkleTree pmt2(vLevels, j);
+
+            // both constructors must produce the same encoding
+            MCDataStream ss1(SER_NETWORK, PROTOCOL_VERSION), ss2(SER_NETWORK, PROTOCOL_VERSION);
+            ss1 << pmt1;
+            ss2 << pmt2;
+            BOOST_CHECK(ss1.str() == ss2.str());
+
+            std::vector<uint256> vMatchTxid;
+            std::vector<unsigned int> vIndex;
+            BOOST_CHECK(pmt2.ExtractMatches(vMatchTxid, vIndex) == vLevels.back()[0]);
+            BOOST_CHECK(vIndex.size() == 1 && vIndex[0] == j);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(pmt_malleability)
 {
     std::vector<uint256> vTxid = {
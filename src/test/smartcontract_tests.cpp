@@ -0,0 +1,735 @@
+// Copyright (c) 2016-2019 The MagnaChain Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartcontract/smartcontract.h"
+#include "smartcontract/contractdb.h"
+#include "validation/validation.h"
+#include "chain/chainparams.h"
+#include "transaction/txmempool.h"
+
+#include "test/test_magnachain.h"
+
+#include <boost/test/unit_test.hpp>
+
+static const char* counterContract =
+    "function init()\n"
+    "    PersistentData = {}\n"
+    "    PersistentData.count = 0\n"
+    "end\n"
+    "function inc(n)\n"
+    "    PersistentData.count = PersistentData.count + n\n"
+    "    return PersistentData.count\n"
+    "end\n";
+
+static const char* kvContract =
+    "function init()\n"
+    "    PersistentData = {}\n"
+    "    PersistentData.__storage = 'kv'\n"
+    "    PersistentData.total = 0\n"
+    "    PersistentData.owner = { name = 'test' }\n"
+    "end\n"
+    "function set(k, v)\n"
+    "    PersistentData[k] = v\n"
+    "    PersistentData.total = PersistentData.total + v\n"
+    "    return PersistentData.total\n"
+    "end\n"
+    "function get(k)\n"
+    "    return PersistentData[k]\n"
+    "end\n"
+    "function remove(k)\n"
+    "    PersistentData[k] = nil\n"
+    "end\n"
+    "function rename(n)\n"
+    "    PersistentData.owner.name = n\n"
+    "    return PersistentData.owner.name\n"
+    "end\n"
+    "function replace()\n"
+    "    PersistentData = {}\n"
+    "end\n"
+    "function count()\n"
+    "    local n = 0\n"
+    "    for k in pairs(PersistentData) do n = n + 1 end\n"
+    "    return n\n"
+    "end\n";
+
+static const char* blockContract =
+    "function init()\n"
+    "    PersistentData = {}\n"
+    "    PersistentData.count = 0\n"
+    "    PersistentData.last = 0\n"
+    "end\n"
+    "function inc(n)\n"
+    "    PersistentData.count = PersistentData.count + n\n"
+    "end\n"
+    "function get()\n"
+    "    return PersistentData.count, PersistentData.last\n"
+    "end\n"
+    "function mirror(addr)\n"
+    "    local ok, n = callcontract(addr, 'get')\n"
+    "    PersistentData.last = n\n"
+    "end\n"
+    "function pay(addr, n)\n"
+    "    send(addr, n)\n"
+    "end\n";
+
+static MCContractID ContractIdFromHex(const std::string& hex)
+{
+    MCContractID contractId;
+    contractId.SetHex(hex);
+    return contractId;
+}
+
+static bool PublishTestContract(SmartLuaState& sls, ContractContext& context, MagnaChainAddress& contractAddr, const std::string& code, int blockHeight = -1)
+{
+    MCKey key;
+    key.MakeNewKey(true);
+    MagnaChainAddress senderAddr(key.GetPubKey().GetID());
+
+    std::string rawCode = code;
+    UniValue ret(UniValue::VARR);
+    if (blockHeight < 0)
+        blockHeight = chainActive.Height() + 1;
+    sls.Initialize(true, chainActive.Tip()->GetBlockTime(), blockHeight, 0, senderAddr, &context, nullptr, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
+    bool success = PublishContract(&sls, contractAddr, rawCode, ret, false);
+    context.Commit();
+    return success;
+}
+
+static bool CallTestContract(SmartLuaState& sls, ContractContext& context, MagnaChainAddress& contractAddr, const std::string& func, const UniValue& args, UniValue& ret,
+    int blockHeight = -1, CONTRACT_DATA* pWriteSet = nullptr)
+{
+    MCKey key;
+    key.MakeNewKey(true);
+    MagnaChainAddress senderAddr(key.GetPubKey().GetID());
+
+    if (blockHeight < 0)
+        blockHeight = chainActive.Height() + 1;
+    sls.Initialize(false, chainActive.Tip()->GetBlockTime(), blockHeight, 1, senderAddr, &context, nullptr, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
+    bool success = CallContract(&sls, contractAddr, 0, func, args, ret);
+    if (pWriteSet != nullptr)
+        *pWriteSet = context.cache;
+    context.Commit();
+    return success;
+}
+
+// msgpack编码的短字符串键
+static std::string KVKey(const std::string& key)
+{
+    return std::string(1, (char)(0xa0 | key.size())) + key;
+}
+
+static MCTransactionRef MakeCallContractTx(const MCContractID& contractId, const std::string& func, const UniValue& args,
+    MCAmount amountOut = 0, const std::vector<MCTxOut>& vout = std::vector<MCTxOut>())
+{
+    MCKey key;
+    key.MakeNewKey(true);
+
+    MCMutableTransaction mtx;
+    mtx.nVersion = MCTransaction::CALL_CONTRACT_VERSION;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = MCOutPoint(GetRandHash(), 0);
+    mtx.vout = vout;
+    mtx.pContractData.reset(new ContractData);
+    mtx.pContractData->address = contractId;
+    mtx.pContractData->sender = key.GetPubKey();
+    mtx.pContractData->codeOrFunc = func;
+    mtx.pContractData->args = args.write();
+    mtx.pContractData->amountOut = amountOut;
+    return MakeTransactionRef(std::move(mtx));
+}
+
+// 分别在关闭(0)和开启(1)预执行时执行区块中的合约，返回每次执行后的合约数据、统计与指定合约的余额
+static void RunTestBlockContract(const MCBlock& block, CoinAmountCacheBase& amountBase, const MCContractID& balanceId,
+    ContractContext results[2], ContractRunStats stats[2], MCAmount balances[2])
+{
+    for (int i = 0; i < 2; ++i) {
+        gArgs.ForceSetArg("-speculativecontract", i == 0 ? "0" : "1");
+        MCBlock runBlock(block);
+        CoinAmountCache amountCache(&amountBase);
+        BOOST_CHECK(mpContractDb->RunBlockContract(&runBlock, &results[i], &amountCache));
+        stats[i] = mpContractDb->GetRunStats();
+        balances[i] = amountCache.GetAmount(balanceId);
+    }
+}
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(MCBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(smartcontract_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(contract_code_cache)
+{
+    ContractCodeCache cache(100);
+    MCContractID id1 = ContractIdFromHex("01");
+    MCContractID id2 = ContractIdFromHex("02");
+    MCContractID id3 = ContractIdFromHex("03");
+
+    BOOST_CHECK(cache.Get(id1, "raw1") == nullptr);
+    ContractCodeRef code1 = cache.Insert(id1, "raw1", std::string(20, 'a'));
+    BOOST_CHECK(code1->code == std::string(20, 'a'));
+    BOOST_CHECK(cache.Get(id1, "raw1") == code1);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 20);
+
+    // 同一合约ID下代码长度不同则不命中，并移除旧数据
+    BOOST_CHECK(cache.Get(id1, "raw1x") == nullptr);
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+
+    // 按字节数限制大小，淘汰最久未使用的项
+    cache.Insert(id1, "raw1", std::string(36, 'a'));
+    cache.Insert(id2, "raw2", std::string(36, 'b'));
+    BOOST_CHECK(cache.Get(id1, "raw1") != nullptr);
+    cache.Insert(id3, "raw3", std::string(36, 'c'));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+    BOOST_CHECK(cache.Get(id1, "raw1") != nullptr);
+    BOOST_CHECK(cache.Get(id2, "raw2") == nullptr);
+    BOOST_CHECK(cache.Get(id3, "raw3") != nullptr);
+
+    // 超出上限的代码不进入缓存
+    ContractCodeRef big = cache.Insert(id2, "raw2", std::string(200, 'b'));
+    BOOST_CHECK(big != nullptr);
+    BOOST_CHECK(cache.Get(id2, "raw2") == nullptr);
+
+    cache.Erase(id1);
+    BOOST_CHECK(cache.Get(id1, "raw1") == nullptr);
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(call_contract_cached_code)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MCContractID contractId = ContractIdFromHex("a1b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+
+    // 发布时不写入缓存，首次调用时解压并缓存
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, counterContract));
+    BOOST_CHECK(mpContractDb->codeCache.Get(contractId, context.data[contractId].code) == nullptr);
+
+    UniValue args(UniValue::VARR);
+    args.push_back(2);
+    uint32_t runningTimes = 0;
+    for (int i = 1; i <= 3; ++i) {
+        // 第二次调用从缓存读取，清空后重新解压并再次缓存
+        if (i == 3)
+            mpContractDb->codeCache.Clear();
+
+        UniValue ret(UniValue::VARR);
+        BOOST_CHECK(CallTestContract(sls, context, contractAddr, "inc", args, ret));
+        BOOST_CHECK(mpContractDb->codeCache.Get(contractId, context.data[contractId].code) != nullptr);
+        BOOST_CHECK_EQUAL(ret.size(), 1);
+        BOOST_CHECK_EQUAL(ret[0].get_int64(), 2 * i);
+        if (i == 1)
+            runningTimes = sls.runningTimes;
+        BOOST_CHECK_EQUAL(sls.runningTimes, runningTimes);
+    }
+
+    // 回滚发布合约的区块时移除缓存
+    MCMutableTransaction mtx;
+    mtx.nVersion = MCTransaction::PUBLISH_CONTRACT_VERSION;
+    mtx.pContractData.reset(new ContractData);
+    mtx.pContractData->address = contractId;
+    MCBlock block;
+    block.vtx.push_back(MakeTransactionRef(mtx));
+    BOOST_CHECK(mpContractDb->codeCache.Get(contractId, context.data[contractId].code) != nullptr);
+    mpContractDb->DisconnectBlockContract(block);
+    BOOST_CHECK(mpContractDb->codeCache.Get(contractId, context.data[contractId].code) == nullptr);
+
+    UniValue ret(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "inc", args, ret));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 8);
+    BOOST_CHECK_EQUAL(sls.runningTimes, runningTimes);
+}
+
+BOOST_FIXTURE_TEST_CASE(call_contract_kv_storage, RegtestingSetup)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MCContractID contractId = ContractIdFromHex("b1b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+    const int height = Params().GetConsensus().ContractKVStorageHeight;
+    const MCContractID totalId = ContractKVData::GetKeyId(contractId, KVKey("total"));
+    const MCContractID ownerId = ContractKVData::GetKeyId(contractId, KVKey("owner"));
+    const MCContractID aId = ContractKVData::GetKeyId(contractId, KVKey("a"));
+
+    // 合约自身只保存标记，每个键单独保存
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, kvContract, height));
+    BOOST_CHECK(context.data[contractId].data == std::string(1, (char)ContractKVData::KV_DATA_MARKER));
+    BOOST_CHECK(context.data[totalId].data == std::string(1, '\0'));
+    BOOST_CHECK(context.data.count(ownerId) == 1);
+    BOOST_CHECK(context.data.count(ContractKVData::GetKeyId(contractId, KVKey("__storage"))) == 1);
+
+    // 只写入有变化的键
+    UniValue args(UniValue::VARR);
+    args.push_back("a");
+    args.push_back(5);
+    UniValue ret(UniValue::VARR);
+    CONTRACT_DATA writeSet;
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "set", args, ret, height, &writeSet));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 5);
+    BOOST_CHECK_EQUAL(writeSet.size(), 2);
+    BOOST_CHECK(writeSet.at(aId).data == "\x05");
+    BOOST_CHECK(writeSet.at(totalId).data == "\x05");
+
+    args = UniValue(UniValue::VARR);
+    args.push_back("b");
+    args.push_back(7);
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "set", args, ret, height));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 12);
+
+    // 只读调用不写数据，只读取访问到的键
+    args = UniValue(UniValue::VARR);
+    args.push_back("a");
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "get", args, ret, height, &writeSet));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 5);
+    BOOST_CHECK(writeSet.empty());
+    BOOST_CHECK(sls.contractDataFrom.count(aId) == 1);
+    BOOST_CHECK(sls.contractDataFrom.count(totalId) == 0);
+    BOOST_CHECK(sls.contractDataFrom.count(ownerId) == 0);
+
+    // 读到不存在的键也计入读集
+    const MCContractID missingId = ContractKVData::GetKeyId(contractId, KVKey("zz"));
+    args = UniValue(UniValue::VARR);
+    args.push_back("zz");
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "get", args, ret, height));
+    BOOST_CHECK(ret[0].isNull());
+    BOOST_CHECK(sls.contractDataFrom.count(missingId) == 0);
+    BOOST_CHECK(MakeContractTxResult(&sls, CONTRACT_DATA())->readContracts.count(missingId) == 1);
+
+    // 修改读取到的表也会写回，值不变时不写
+    args = UniValue(UniValue::VARR);
+    args.push_back("new");
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "rename", args, ret, height, &writeSet));
+    BOOST_CHECK_EQUAL(writeSet.size(), 1);
+    BOOST_CHECK(writeSet.count(ownerId) == 1);
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "rename", args, ret, height, &writeSet));
+    BOOST_CHECK_EQUAL(ret[0].get_str(), "new");
+    BOOST_CHECK(writeSet.empty());
+
+    // 删除的键保存为msgpack的nil
+    args = UniValue(UniValue::VARR);
+    args.push_back("a");
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "remove", args, ret, height));
+    BOOST_CHECK(context.data[aId].data == std::string(1, (char)ContractKVData::KV_NIL_VALUE));
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "get", args, ret, height));
+    BOOST_CHECK(ret[0].isNull());
+
+    // 代理表不能遍历，也不允许替换
+    std::string before = context.data[totalId].data;
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(!CallTestContract(sls, context, contractAddr, "count", UniValue(UniValue::VARR), ret, height));
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(!CallTestContract(sls, context, contractAddr, "replace", UniValue(UniValue::VARR), ret, height));
+    BOOST_CHECK(context.data[totalId].data == before);
+
+    // 存盘后按键从ContractDataDB读取
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+    ContractContext diskContext;
+    args = UniValue(UniValue::VARR);
+    args.push_back("b");
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, diskContext, contractAddr, "get", args, ret, height));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 7);
+    BOOST_CHECK(sls.contractDataFrom.count(ContractKVData::GetKeyId(contractId, KVKey("b"))) == 1);
+    BOOST_CHECK(sls.contractDataFrom.count(totalId) == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(call_contract_kv_storage_activation, RegtestingSetup)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MCContractID contractId = ContractIdFromHex("b2b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+    const int height = Params().GetConsensus().ContractKVStorageHeight;
+
+    // 启用高度之前发布的合约即使声明了键值存储，仍按整块存储
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, kvContract, height - 1));
+    const std::string data = context.data[contractId].data;
+    BOOST_CHECK(!data.empty());
+    BOOST_CHECK(!ContractKVData::IsKVData(data));
+
+    // 跨过启用高度前后调用，结果、指令数和存储的数据都不变
+    UniValue args(UniValue::VARR);
+    args.push_back("a");
+    args.push_back(5);
+    UniValue ret(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "set", args, ret, height - 1));
+    uint32_t runningTimes = sls.runningTimes;
+    std::string after = context.data[contractId].data;
+
+    context.data[contractId].data = data;
+    UniValue forkRet(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "set", args, forkRet, height));
+    BOOST_CHECK_EQUAL(ret.write(), forkRet.write());
+    BOOST_CHECK_EQUAL(sls.runningTimes, runningTimes);
+    BOOST_CHECK(context.data[contractId].data == after);
+    BOOST_CHECK(!ContractKVData::IsKVData(after));
+
+    // 替换PersistentData在整块存储下仍然允许
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "replace", UniValue(UniValue::VARR), ret, height));
+
+    // 启用高度及之后发布的合约使用键值存储
+    MCContractID kvContractId = ContractIdFromHex("b3b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress kvContractAddr(kvContractId);
+    BOOST_CHECK(PublishTestContract(sls, context, kvContractAddr, kvContract, height));
+    BOOST_CHECK(ContractKVData::IsKVData(context.data[kvContractId].data));
+    BOOST_CHECK(context.data.count(ContractKVData::GetKeyId(kvContractId, KVKey("total"))) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(contract_allocator)
+{
+    ContractAllocator allocator;
+    void* small = ContractAllocator::Alloc(&allocator, nullptr, 0, 24);
+    memset(small, 'a', 24);
+    small = ContractAllocator::Alloc(&allocator, small, 24, 30);
+    BOOST_CHECK_EQUAL(((char*)small)[23], 'a');
+    small = ContractAllocator::Alloc(&allocator, small, 30, 1000);
+    BOOST_CHECK_EQUAL(((char*)small)[23], 'a');
+    small = ContractAllocator::Alloc(&allocator, small, 1000, 24);
+    BOOST_CHECK_EQUAL(((char*)small)[23], 'a');
+
+    // 释放的小块被同级别的分配复用
+    ContractAllocator::Alloc(&allocator, small, 24, 0);
+    BOOST_CHECK(ContractAllocator::Alloc(&allocator, nullptr, 0, 32) == small);
+    ContractAllocator::Alloc(&allocator, small, 32, 0);
+
+    // 大块直接使用系统分配，分配器本身不限制大小
+    void* block = ContractAllocator::Alloc(&allocator, nullptr, 0, 2000);
+    BOOST_CHECK(block != nullptr);
+    memset(block, 'b', 2000);
+    block = ContractAllocator::Alloc(&allocator, block, 2000, 8000);
+    BOOST_CHECK(block != nullptr);
+    BOOST_CHECK_EQUAL(((char*)block)[1999], 'b');
+    ContractAllocator::Alloc(&allocator, block, 8000, 0);
+
+    // 只释放所有小块都已归还的页，仍有在用小块的页保留
+    std::vector<void*> blocks;
+    for (int i = 0; i < 5000; ++i)
+        blocks.push_back(ContractAllocator::Alloc(&allocator, nullptr, 0, 64));
+    size_t pageMemory = allocator.pageMemory;
+    BOOST_CHECK(pageMemory >= 5000 * 64);
+    for (size_t i = 1; i < blocks.size(); ++i)
+        ContractAllocator::Alloc(&allocator, blocks[i], 64, 0);
+    size_t released = allocator.Trim();
+    BOOST_CHECK(released > 0);
+    BOOST_CHECK_EQUAL(allocator.pageMemory, pageMemory - released);
+    BOOST_CHECK(allocator.pageMemory > 0);
+    memset(blocks[0], 'c', 64);
+
+    void* again = ContractAllocator::Alloc(&allocator, nullptr, 0, 64);
+    BOOST_CHECK(again != nullptr);
+    ContractAllocator::Alloc(&allocator, again, 64, 0);
+    ContractAllocator::Alloc(&allocator, blocks[0], 64, 0);
+    allocator.Trim();
+    BOOST_CHECK_EQUAL(allocator.pageMemory, 0);
+}
+
+BOOST_AUTO_TEST_CASE(call_contract_memory_limit)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MCContractID contractId = ContractIdFromHex("d1b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, counterContract));
+
+    // 数据在调用期间解包，20万个元素的数组超过lua_State的内存上限
+    std::string data = context.data[contractId].data;
+    const uint32_t count = 200000;
+    std::string bigData = "\xdd";
+    for (int i = 3; i >= 0; --i)
+        bigData.push_back((char)((count >> (i * 8)) & 0xff));
+    bigData.append(count, '\x01');
+    BOOST_CHECK(bigData.size() < MAX_DATA_LEN);
+    context.data[contractId].data = bigData;
+    UniValue args(UniValue::VARR);
+    args.push_back(1);
+    UniValue ret(UniValue::VARR);
+    BOOST_CHECK(!CallTestContract(sls, context, contractAddr, "inc", args, ret));
+
+    // 调用结束后完整回收，之后的调用不受影响
+    context.data[contractId].data = data;
+    ret = UniValue(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "inc", args, ret));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(contract_tx_result)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    MCContractID contractId = ContractIdFromHex("f1b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, counterContract));
+    std::string data = context.data[contractId].data;
+
+    // 记录执行环境、读到的数据和写集，写集只在cache中，提交前取出
+    MCKey key;
+    key.MakeNewKey(true);
+    MagnaChainAddress senderAddr(key.GetPubKey().GetID());
+    UniValue args(UniValue::VARR);
+    args.push_back(3);
+    UniValue ret(UniValue::VARR);
+    sls.Initialize(false, chainActive.Tip()->GetBlockTime(), chainActive.Height() + 1, -1, senderAddr, &context, nullptr, SmartLuaState::SAVE_TYPE_CACHE, nullptr);
+    BOOST_CHECK(CallContract(&sls, contractAddr, 0, "inc", args, ret));
+    std::shared_ptr<const SmartContractTxResult> result = MakeContractTxResult(&sls, context.cache);
+    context.Commit();
+
+    BOOST_CHECK(result->success);
+    BOOST_CHECK_EQUAL(result->timestamp, chainActive.Tip()->GetBlockTime());
+    BOOST_CHECK_EQUAL(result->blockHeight, chainActive.Height() + 1);
+    BOOST_CHECK_EQUAL(result->contractOut, 0);
+    BOOST_CHECK(result->readContracts.count(contractId) == 1);
+    BOOST_CHECK(result->contractDataFrom.at(contractId).data == data);
+    BOOST_CHECK(result->writeSet.at(contractId).data == context.data[contractId].data);
+    BOOST_CHECK(result->writeSet.at(contractId).data != data);
+}
+
+BOOST_AUTO_TEST_CASE(reaccept_contract_tx_result)
+{
+    MCContractID contractId = ContractIdFromHex("f2b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    MagnaChainAddress contractAddr(contractId);
+    SmartLuaState sls;
+    ContractContext context;
+    BOOST_CHECK(PublishTestContract(sls, context, contractAddr, counterContract));
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+
+    // 按进入内存池时的流程执行并记录结果
+    UniValue args(UniValue::VARR);
+    args.push_back(3);
+    MCTransactionRef tx = MakeCallContractTx(contractId, "inc", args);
+    MCTxMemPoolEntry entry = TestMemPoolEntryHelper().FromTx(*tx);
+    BOOST_CHECK(CheckSmartContract(&sls, entry, SmartLuaState::SAVE_TYPE_CACHE, pCoinAmountCache));
+    entry.UpdateContract(&sls, MakeContractTxResult(&sls, mpContractDb->contractContext.cache));
+    mpContractDb->contractContext.ClearAll();
+    mempool.AddUnchecked(tx->GetHash(), entry);
+    std::shared_ptr<const SmartContractTxResult> oldResult = mempool.GetContractTxResult(tx->GetHash());
+    BOOST_REQUIRE(oldResult != nullptr);
+
+    // 回滚后合约数据变化，模拟为同一区块写入新的数据
+    UniValue ret(UniValue::VARR);
+    args = UniValue(UniValue::VARR);
+    args.push_back(10);
+    BOOST_CHECK(CallTestContract(sls, context, contractAddr, "inc", args, ret));
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+
+    // 重新接受时按新的数据重新执行，不保留旧的结果
+    mempool.ReacceptTransactions();
+    std::shared_ptr<const SmartContractTxResult> newResult = mempool.GetContractTxResult(tx->GetHash());
+    BOOST_REQUIRE(newResult != nullptr && newResult != oldResult);
+    BOOST_CHECK(newResult->contractDataFrom.at(contractId).data == context.data[contractId].data);
+    BOOST_CHECK(oldResult->contractDataFrom.at(contractId).data != context.data[contractId].data);
+    BOOST_CHECK(newResult->writeSet.at(contractId).data != oldResult->writeSet.at(contractId).data);
+    mempool.Clear();
+}
+
+BOOST_AUTO_TEST_CASE(contract_info_serialize)
+{
+    // 按高度索引的合约信息与原先按高度排列的列表存盘格式一致
+    DBContractInfo info;
+    info.code = "code";
+    for (int32_t height : {30, 10, 20}) {
+        DBContractInfoByHeight item;
+        item.blockHeight = height;
+        info.items[height] = item;
+    }
+
+    MCDataStream ss(SER_DISK, 0);
+    ss << info;
+    MCDataStream expected(SER_DISK, 0);
+    expected << std::string("code") << std::vector<int32_t>{10, 20, 30};
+    BOOST_CHECK(ss.str() == expected.str());
+
+    DBContractInfo info2;
+    ss >> info2;
+    BOOST_CHECK_EQUAL(info2.code, "code");
+    BOOST_CHECK_EQUAL(info2.items.size(), 3);
+    BOOST_CHECK_EQUAL(info2.items.begin()->second.blockHeight, 10);
+    BOOST_CHECK(!info2.items.begin()->second.loaded);
+}
+
+BOOST_AUTO_TEST_CASE(contract_data_record)
+{
+    std::string base(1000, 'a');
+    for (int i = 0; i < base.size(); ++i)
+        base[i] = (char)(i % 251);
+    std::string data = base;
+    data[500] = 'x';
+    data.append("tail");
+    uint256 baseBlockHash = GetRandHash();
+
+    // 只改动少量字节时保存差异
+    ContractDataRecord record = ContractDataRecord::Encode(data, &base, baseBlockHash, 3, false);
+    BOOST_CHECK(record.flags & ContractDataRecord::FLAG_DELTA);
+    BOOST_CHECK_EQUAL(record.depth, 4);
+    BOOST_CHECK(record.baseBlockHash == baseBlockHash);
+    BOOST_CHECK(record.payload.size() < 100);
+
+    MCDataStream ss(SER_DISK, 0);
+    ss << record;
+    ContractDataRecord record2;
+    ss >> record2;
+    std::string result;
+    BOOST_CHECK(record2.Decode(base, result));
+    BOOST_CHECK(result == data);
+
+    // 差异链过长或没有基准时保存完整数据
+    record = ContractDataRecord::Encode(data, &base, baseBlockHash, MAX_CONTRACT_DATA_DELTA_DEPTH, false);
+    BOOST_CHECK(!(record.flags & ContractDataRecord::FLAG_DELTA));
+    BOOST_CHECK_EQUAL(record.depth, 0);
+    BOOST_CHECK(record.payload == data);
+
+    // 可压缩的数据压缩存储
+    std::string repeated(4096, 'z');
+    record = ContractDataRecord::Encode(repeated, nullptr, uint256(), 0, true);
+    BOOST_CHECK(record.flags & ContractDataRecord::FLAG_COMPRESSED);
+    BOOST_CHECK(record.payload.size() < repeated.size());
+    BOOST_CHECK(record.Decode(std::string(), result));
+    BOOST_CHECK(result == repeated);
+
+    // 差异超出基准长度时解码失败
+    record = ContractDataRecord::Encode(data, &base, baseBlockHash, 0, false);
+    BOOST_CHECK(!record.Decode(std::string(10, 'a'), result));
+}
+
+BOOST_AUTO_TEST_CASE(run_block_contract_speculative)
+{
+    SmartLuaState sls;
+    ContractContext context;
+    std::vector<MCContractID> ids;
+    for (int i = 0; i < 7; ++i) {
+        MCContractID contractId = ContractIdFromHex(strprintf("b1b2c3d4e5f60718293a4b5c6d7e8f90112233%02x", i));
+        MagnaChainAddress contractAddr(contractId);
+        BOOST_CHECK(PublishTestContract(sls, context, contractAddr, blockContract));
+        ids.push_back(contractId);
+    }
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+
+    MCKey key;
+    key.MakeNewKey(true);
+    MCTxOut payOut(20, GetScriptForDestination(key.GetPubKey().GetID()));
+    UniValue incArgs(UniValue::VARR);
+    incArgs.push_back(1);
+    UniValue mirrorArgs(UniValue::VARR);
+    mirrorArgs.push_back(MagnaChainAddress(ids[2]).ToString());
+    UniValue payArgs(UniValue::VARR);
+    payArgs.push_back(MagnaChainAddress(key.GetPubKey().GetID()).ToString());
+    payArgs.push_back(20);
+
+    MCBlock block;
+    block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    // 组内连续调用同一合约，后两笔的预执行结果已被之前的交易改写
+    for (int i = 0; i < 3; ++i)
+        block.vtx.push_back(MakeCallContractTx(ids[0], "inc", incArgs));
+    block.groupSize.push_back(3);
+    // 读到组内之前交易修改过的合约数据
+    block.vtx.push_back(MakeCallContractTx(ids[2], "inc", incArgs));
+    block.vtx.push_back(MakeCallContractTx(ids[3], "mirror", mirrorArgs));
+    block.groupSize.push_back(2);
+    // 之前的交易向合约转入代币，预执行时读到的合约余额已变化
+    block.vtx.push_back(MakeCallContractTx(ids[4], "inc", incArgs, 0, { MCTxOut(5, GetScriptForDestination(ids[5])) }));
+    block.vtx.push_back(MakeCallContractTx(ids[5], "pay", payArgs, 20, { payOut }));
+    block.groupSize.push_back(2);
+    // 互不相关的交易直接采用预执行结果
+    block.vtx.push_back(MakeCallContractTx(ids[6], "inc", incArgs));
+    block.vtx.push_back(MakeCallContractTx(ids[1], "inc", incArgs));
+    block.groupSize.push_back(2);
+
+    CoinAmountTemp amountBase;
+    amountBase.IncAmount(ids[5], 100);
+    ContractContext results[2];
+    ContractRunStats stats[2];
+    MCAmount balances[2];
+    RunTestBlockContract(block, amountBase, ids[5], results, stats, balances);
+    BOOST_CHECK_EQUAL(stats[0].nReexecuted, 0);
+    BOOST_CHECK_EQUAL(stats[1].nReexecuted, 4);
+
+    // 预执行与否，最终的合约数据与余额都相同
+    BOOST_CHECK_EQUAL(balances[0], 85);
+    BOOST_CHECK_EQUAL(balances[1], 85);
+    BOOST_CHECK_EQUAL(results[0].data.size(), ids.size());
+    BOOST_CHECK_EQUAL(results[1].data.size(), ids.size());
+    for (auto& item : results[0].data) {
+        const ContractInfo& info = results[1].data[item.first];
+        BOOST_CHECK(info.code == item.second.code);
+        BOOST_CHECK(info.data == item.second.data);
+        BOOST_CHECK_EQUAL(info.txIndex, item.second.txIndex);
+    }
+
+    UniValue ret(UniValue::VARR);
+    MagnaChainAddress counterAddr(ids[0]);
+    BOOST_CHECK(CallTestContract(sls, results[1], counterAddr, "get", UniValue(UniValue::VARR), ret));
+    BOOST_CHECK_EQUAL(ret[0].get_int64(), 3);
+    MagnaChainAddress mirrorAddr(ids[3]);
+    UniValue mirrorRet(UniValue::VARR);
+    BOOST_CHECK(CallTestContract(sls, results[1], mirrorAddr, "get", UniValue(UniValue::VARR), mirrorRet));
+    BOOST_CHECK_EQUAL(mirrorRet[1].get_int64(), 1);
+
+    // 组内第二笔转出在预执行时余额足够，重新执行后余额不足，两种方式都判定区块无效
+    MCTxOut bigOut(60, payOut.scriptPubKey);
+    payArgs.setArray();
+    payArgs.push_back(MagnaChainAddress(key.GetPubKey().GetID()).ToString());
+    payArgs.push_back(60);
+    MCBlock overdraw;
+    overdraw.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    overdraw.vtx.push_back(MakeCallContractTx(ids[5], "pay", payArgs, 60, { bigOut }));
+    overdraw.vtx.push_back(MakeCallContractTx(ids[5], "pay", payArgs, 60, { bigOut }));
+    overdraw.groupSize.push_back(2);
+    for (int i = 0; i < 2; ++i) {
+        gArgs.ForceSetArg("-speculativecontract", i == 0 ? "0" : "1");
+        CoinAmountCache amountCache(&amountBase);
+        ContractContext overdrawContext;
+        BOOST_CHECK_THROW(mpContractDb->RunBlockContract(&overdraw, &overdrawContext, &amountCache), std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(contract_data_cache)
+{
+    MCContractID contractId = ContractIdFromHex("e1b2c3d4e5f60718293a4b5c6d7e8f9011223344");
+    ContractInfo contractInfo;
+    BOOST_CHECK_EQUAL(mpContractDb->GetContractInfo(contractId, contractInfo, nullptr), -1);
+
+    ContractContext context;
+    ContractInfo& newInfo = context.data[contractId];
+    newInfo.code = "code";
+    newInfo.data = "data";
+    size_t count = mpContractDb->ContractDataCount();
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+    BOOST_CHECK_EQUAL(mpContractDb->ContractDataCount(), count + 1);
+    BOOST_CHECK(mpContractDb->ContractDataUsage() > 0);
+
+    BOOST_CHECK_EQUAL(mpContractDb->GetContractInfo(contractId, contractInfo, chainActive.Tip()), chainActive.Height());
+    BOOST_CHECK_EQUAL(contractInfo.code, "code");
+    BOOST_CHECK_EQUAL(contractInfo.data, "data");
+    BOOST_CHECK(contractInfo.blockHash == chainActive.Tip()->GetBlockHash());
+
+    // 同一区块重复写入时替换原有数据
+    newInfo.data = "data2";
+    BOOST_CHECK(mpContractDb->WriteBlockContractInfoToDisk(chainActive.Tip(), &context));
+    BOOST_CHECK_EQUAL(mpContractDb->GetContractInfo(contractId, contractInfo, chainActive.Tip()), chainActive.Height());
+    BOOST_CHECK_EQUAL(contractInfo.data, "data2");
+
+    // 存盘时只处理有新数据的合约
+    BOOST_CHECK(mpContractDb->UpdateBlockContractToDisk(chainActive.Tip()));
+    ContractFlushStats stats = mpContractDb->GetFlushStats();
+    BOOST_CHECK_EQUAL(stats.nLastContracts, 1);
+    BOOST_CHECK(mpContractDb->UpdateBlockContractToDisk(chainActive.Tip()));
+    stats = mpContractDb->GetFlushStats();
+    BOOST_CHECK_EQUAL(stats.nLastContracts, 0);
+    BOOST_CHECK(stats.nFlushes >= 2);
+    BOOST_CHECK_EQUAL(mpContractDb->GetContractInfo(contractId, contractInfo, chainActive.Tip()), chainActive.Height());
+    BOOST_CHECK_EQUAL(contractInfo.data, "data2");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -100,8 +100,50 @@ MCPartialMerkleTree::MCPartialMerkleTree(const std::vector<uint256> &vTxid, cons
     TraverseAndBuild(nHeight, 0, vTxid, vMatch);
 }
 
+MCPartialMerkleTree::MCPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, unsigned int nIndex) : nTransactions(vLevels[0].size()), fBad(false) {
+    assert(nIndex < nTransactions);
+
+    // calculate height of tree
+    int nHeight = 0;
+    while (CalcTreeWidth(nHeight) > 1)
+        nHeight++;
+    assert(vLevels.size() == (size_t)nHeight + 1);
+
+    TraverseAndBuildSingle(nHeight, 0, vLevels, nIndex);
+}
+
 MCPartialMerkleTree::MCPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
+void MCPartialMerkleTree::TraverseAndBuildSingle(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, unsigned int nIndex) {
+    // the only matched txid is below this node iff their positions agree above this height
+    bool fParentOfMatch = (nIndex >> height) == pos;
+    vBits.push_back(fParentOfMatch);
+    if (height==0 || !fParentOfMatch) {
+        vHash.push_back(vLevels[height][pos]);
+    } else {
+        TraverseAndBuildSingle(height-1, pos*2, vLevels, nIndex);
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            TraverseAndBuildSingle(height-1, pos*2+1, vLevels, nIndex);
+    }
+}
+
+void MCPartialMerkleTree::CalcTreeLevels(const std::vector<uint256> &vTxid, std::vector<std::vector<uint256> > &vLevels) {
+    assert(vTxid.size() != 0);
+    vLevels.clear();
+    vLevels.push_back(vTxid);
+    while (vLevels.back().size() > 1) {
+        const std::vector<uint256> &vBelow = vLevels.back();
+        std::vector<uint256> vLevel((vBelow.size()+1)/2);
+        for (unsigned int pos = 0; pos < vLevel.size(); pos++) {
+            const uint256 &left = vBelow[pos*2];
+            // copy left hash if the right one is beyond the end of the level, as CalcHash does
+            const uint256 &right = pos*2+1 < vBelow.size() ? vBelow[pos*2+1] : left;
+            vLevel[pos] = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        }
+        vLevels.push_back(std::move(vLevel));
+    }
+}
+
 uint256 MCPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     vMatch.clear();
     // An empty set will not work
@@ -80,6 +80,9 @@ protected:
      */
     uint256 TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex);
 
+    /** same as TraverseAndBuild for a single matched txid, taking the node hashes from precomputed tree levels */
+    void TraverseAndBuildSingle(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, unsigned int nIndex);
+
 public:
 
     /** serialization implementation */
@@ -108,8 +111,17 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     MCPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /**
+     * Construct a partial merkle tree matching only the txid at nIndex, from the tree levels computed by CalcTreeLevels.
+     * Gives the same tree as the constructor above, without rehashing the whole block for every txid.
+     */
+    MCPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, unsigned int nIndex);
+
     MCPartialMerkleTree();
 
+    /** calculate the hashes of all levels of the merkle tree, from the txids (vLevels[0]) up to the root */
+    static void CalcTreeLevels(const std::vector<uint256> &vTxid, std::vector<std::vector<uint256> > &vLevels);
+
     /**
      * extract the matching txid's represented by this partial merkle tree
      * and their respective indices within the partial tree.
@@ -62,7 +62,7 @@ void MCTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
-void MCTxMemPoolEntry::UpdateContract(SmartLuaState* sls)
+void MCTxMemPoolEntry::UpdateContract(SmartLuaState* sls, std::shared_ptr<const SmartContractTxResult> txResult)
 {
     // 该接口仅在第一次加到txmempool中调用
     if (contractData == nullptr) {
@@ -72,6 +72,7 @@ void MCTxMemPoolEntry::UpdateContract(SmartLuaState* sls)
     contractData->contractAddrs.insert(sls->contractIds.begin(), sls->contractIds.end());
     contractData->runningTimes = sls->runningTimes;
     contractData->deltaDataLen = sls->deltaDataLen;
+    contractData->txResult = std::move(txResult);
     nSizeWithDescendants = GetTxSize();
     nSizeWithAncestors = nSizeWithDescendants;
 }
@@ -1469,6 +1470,15 @@ MCTransactionRef MCTxMemPool::Get(const uint256& hash) const
     return i->GetSharedTx();
 }
 
+std::shared_ptr<const SmartContractTxResult> MCTxMemPool::GetContractTxResult(const uint256& hash) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end() || i->contractData == nullptr)
+        return nullptr;
+    return i->contractData->txResult;
+}
+
 TxMempoolInfo MCTxMemPool::Info(const uint256& hash) const
 {
     LOCK(cs);
@@ -1598,10 +1608,14 @@ void MCTxMemPool::ReacceptTransactions()
         if (pTx->IsSmartContract()) {
             try
             {
-                if (!CheckSmartContract(&sls, *entries[i], SmartLuaState::SAVE_TYPE_DATA, pCoinAmountCache)) {
+                // 按交易暂存写入的数据，以便记录执行结果
+                if (!CheckSmartContract(&sls, *entries[i], SmartLuaState::SAVE_TYPE_CACHE, pCoinAmountCache)) {
+                    mpContractDb->contractContext.ClearCache();
                     vecRemoves.emplace_back(pTx);
                 }
                 else {
+                    entries[i]->contractData->txResult = MakeContractTxResult(&sls, mpContractDb->contractContext.cache);
+                    mpContractDb->contractContext.Commit();
                     CheckContract(entries[i], &sls);
                     if (pTx->pContractData != nullptr && pTx->pContractData->amountOut > 0) {
                         pCoinAmountCache->DecAmount(pTx->pContractData->address, pTx->pContractData->amountOut);
@@ -1629,11 +1643,13 @@ void MCTxMemPool::ReacceptTransactions()
             catch (const std::exception& e)
             {
                 LogPrintf("ReacceptTransactions contract tx exception %s\n", e.what());
+                mpContractDb->contractContext.ClearCache();
                 vecRemoves.emplace_back(pTx);
             }
             catch (...)
             {
                 LogPrintf("ReacceptTransactions contract tx unknow exception\n");
+                mpContractDb->contractContext.ClearCache();
                 vecRemoves.emplace_back(pTx);
             }
         }
@@ -63,6 +63,7 @@ public:
     std::set<MCContractID> contractAddrs;
     uint32_t runningTimes;
     uint32_t deltaDataLen;
+    std::shared_ptr<const SmartContractTxResult> txResult;  // 最近一次执行的结果，区块中执行时可直接重放
 };
 
 /** \class MCTxMemPoolEntry
@@ -139,7 +140,7 @@ public:
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
     // Update contract data
-    void UpdateContract(SmartLuaState* sls);
+    void UpdateContract(SmartLuaState* sls, std::shared_ptr<const SmartContractTxResult> txResult);
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -658,6 +659,7 @@ public:
     }
 
     MCTransactionRef Get(const uint256& hash) const;
+    std::shared_ptr<const SmartContractTxResult> GetContractTxResult(const uint256& hash) const;
     TxMempoolInfo Info(const uint256& hash) const;
     std::vector<TxMempoolInfo> InfoAll();
 
@@ -730,7 +730,7 @@ static bool AcceptToMemoryPoolWorker(const MCChainParams& chainparams, MCTxMemPo
                     mpContractDb->contractContext.ClearCache();
                     return state.DoS(0, false, REJECT_INVALID, "Invalid smart contract");
                 }
-                entry.UpdateContract(&sls);
+                entry.UpdateContract(&sls, MakeContractTxResult(&sls, mpContractDb->contractContext.cache));
             }
         }
 
@@ -1861,6 +1861,21 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+bool RunScriptChecks(std::vector<CScriptCheck>& vChecks)
+{
+    if (nScriptCheckThreads == 0 || vChecks.size() < 2) {
+        for (CScriptCheck& check : vChecks) {
+            if (!check())
+                return false;
+        }
+        vChecks.clear();
+        return true;
+    }
+    MCCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2504,6 +2519,8 @@ bool static DisconnectTip(MCValidationState& state, const MCChainParams& chainpa
         pBranchChainTxRecordsDb->Flush(bccache);
         if (g_pBranchDb)
             g_pBranchDb->Flush(pblock, false);
+        if (mpContractDb)
+            mpContractDb->DisconnectBlockContract(block);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -3857,7 +3874,7 @@ bool ProcessNewBlock(const MCChainParams& chainparams, std::shared_ptr<MCBlock>
     // check and remove invalid contract transaction
     std::string strErr;
     if (!Params().IsMainChain() && ismining)
-        SendBranchBlockHeader(pblock, &strErr, false);// when is ismining, that identify this block is mining by myself, so send it's block header unconditionally
+        SendBranchBlockHeader(pblock, &strErr, false, true);// when is ismining, that identify this block is mining by myself, so send it's block header unconditionally
     if (!strErr.empty())
         LogPrint(BCLog::BRANCH, "SendBranchBlockHeader fail when ProcessNewBlock: %s", strErr.c_str());
     
@@ -5259,15 +5276,18 @@ std::string GetBranchTxProof(const MCBlock& block,  const std::set<uint256>& set
 //    return true;
 //}
 
-bool GetTxVinBlockData(const MCBlock& block, const MCTransactionRef& ptx, std::vector<ProveDataItem>& vectProveData)
+// 为block.vtx[vTxIndex[k]]的每个输入生成证明数据，依次追加到vProveData[k]。
+// 区块的undo数据只读一次；输入按来源区块分组，每个来源区块只读一次、只计算一次merkle树，
+// 同一笔来源交易只序列化一次
+static bool GetTxsVinBlockData(const MCBlock& block, const std::vector<size_t>& vTxIndex, const std::vector<std::vector<ProveDataItem>*>& vProveData)
 {
-    if (ptx->IsCoinBase())
-        return false;
+    assert(vTxIndex.size() == vProveData.size());
 
-    if (mapBlockIndex.count(block.GetHash()) == 0)
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+    if (mi == mapBlockIndex.end())
         return false;
 
-    const MCBlockIndex* pindex = mapBlockIndex[block.GetHash()];
+    const MCBlockIndex* pindex = mi->second;
     MCBlockUndo blockUndo;
     MCDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -5281,53 +5301,78 @@ bool GetTxVinBlockData(const MCBlock& block, const MCTransactionRef& ptx, std::v
         return false;
     }
 
-    MCTxUndo txundo;
-    for (size_t i=1; i<block.vtx.size(); i++) {
-        if (block.vtx[i]->GetHash() == ptx->GetHash()) {
-            txundo = blockUndo.vtxundo[i-1];
-            break;
-        }
-    }
+    // 来源区块高度 -> (来源交易id, 要填写的证明数据)
+    std::map<int, std::vector<std::pair<uint256, ProveDataItem*>>> mapInputs;
+    for (size_t k = 0; k < vTxIndex.size(); k++) {
+        const size_t i = vTxIndex[k];
+        if (i == 0 || i >= block.vtx.size() || block.vtx[i]->IsCoinBase())
+            return false;
+        const MCTransaction& tx = *block.vtx[i];
+        const MCTxUndo& txundo = blockUndo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size())
+            return false;
 
-    const MCChainParams& params = Params();
-    const Consensus::Params& consensusParams = params.GetConsensus();
-    for (size_t i=0; i< ptx->vin.size(); i++) {
-        const Coin &coin = txundo.vprevout[i];
-        const MCBlockIndex *pinblockindex = chainActive[coin.nHeight];
-        MCBlock inblock;
-        if (ReadBlockFromDisk(inblock, pinblockindex, consensusParams)) {
-            if (coin.out.scriptPubKey.IsContract()) {
-                MCContractID contractId;
-                coin.out.scriptPubKey.GetContractAddr(contractId);
-            }
+        std::vector<ProveDataItem>& vectProveData = *vProveData[k];
+        const size_t nBase = vectProveData.size();
+        vectProveData.resize(nBase + tx.vin.size());
+        for (size_t j = 0; j < tx.vin.size(); j++)
+            mapInputs[txundo.vprevout[j].nHeight].emplace_back(tx.vin[j].prevout.hash, &vectProveData[nBase + j]);
+    }
 
-            MCTransactionRef tmpTx;
-            for (size_t j = 0; j < inblock.vtx.size(); j++) {
-                if (inblock.vtx[j]->GetHash() == ptx->vin[i].prevout.hash) {
-                    tmpTx = inblock.vtx[j];
-                    break;
-                }
-            }
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (const auto& item : mapInputs) {
+        const MCBlockIndex* pinblockindex = chainActive[item.first];
+        if (pinblockindex == nullptr)
+            return false;
+        MCBlock inblockRead;
+        if (pinblockindex->GetBlockHash() != block.GetHash() && !ReadBlockFromDisk(inblockRead, pinblockindex, consensusParams))
+            return false;
+        const MCBlock& inblock = pinblockindex->GetBlockHash() == block.GetHash() ? block : inblockRead;
 
-            std::set<uint256> setTxids;
-            setTxids.insert(tmpTx->GetHash());
+        std::vector<uint256> vTxid(inblock.vtx.size());
+        std::map<uint256, unsigned int> mapTxPos;
+        for (unsigned int j = 0; j < inblock.vtx.size(); j++) {
+            vTxid[j] = inblock.vtx[j]->GetHash();
+            mapTxPos[vTxid[j]] = j;
+        }
+        std::vector<std::vector<uint256>> vLevels;
+        MCPartialMerkleTree::CalcTreeLevels(vTxid, vLevels);
 
-            std::shared_ptr<MCSpvProof> pSpvPf(NewSpvProof(inblock, setTxids));
+        std::map<unsigned int, const ProveDataItem*> mapBuilt;
+        for (const auto& input : item.second) {
+            auto itPos = mapTxPos.find(input.first);
+            if (itPos == mapTxPos.end())
+                return false;
 
-            ProveDataItem pData;
-            MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, pData.tx, 0, *tmpTx };
-            pData.pCSP = *pSpvPf;
+            ProveDataItem& pData = *input.second;
             pData.blockHash = block.GetHash();
-
-            vectProveData.emplace_back(pData);
-
+            auto itBuilt = mapBuilt.find(itPos->second);
+            if (itBuilt != mapBuilt.end()) {
+                pData.tx = itBuilt->second->tx;
+                pData.pCSP = itBuilt->second->pCSP;
+                continue;
+            }
+            MCVectorWriter cvw{ SER_NETWORK, INIT_PROTO_VERSION, pData.tx, 0, *inblock.vtx[itPos->second] };
+            pData.pCSP.blockhash = inblock.GetHash();
+            pData.pCSP.pmt = MCPartialMerkleTree(vLevels, itPos->second);
+            mapBuilt[itPos->second] = &pData;
         }
-        else
-            return false;
     }
     return true;
 }
 
+bool GetTxVinBlockData(const MCBlock& block, const MCTransactionRef& ptx, std::vector<ProveDataItem>& vectProveData)
+{
+    if (ptx->IsCoinBase())
+        return false;
+
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (block.vtx[i]->GetHash() == ptx->GetHash())
+            return GetTxsVinBlockData(block, {i}, {&vectProveData});
+    }
+    return false;
+}
+
 bool GetProveInfo(const MCBlock& block, int blockHeight, MCBlockIndex* pPrevBlockIndex, const int txIndex, std::shared_ptr<ProveData> pProveData)
 {
     MCTransactionRef tx = block.vtx[txIndex];
@@ -5366,13 +5411,15 @@ bool GetProveOfCoinbase(std::shared_ptr<ProveData>& pProveData, MCBlock& block)
 
     //create vtx transaction's prove data
     //exclude coinbase, stake transaction
-    for (int i = 2; i < block.vtx.size(); i++) {
-        const MCTransactionRef& ptx = block.vtx[i];
-        pProveData->vecBlockTxProve.emplace_back();
-        std::vector<ProveDataItem>& vectProveData = pProveData->vecBlockTxProve.back();
-        if (!GetTxVinBlockData(block, ptx, vectProveData)){
-            return false;
-        }
-    }
-    return true;
+    if (block.vtx.size() <= 2)
+        return true;
+    const size_t nBase = pProveData->vecBlockTxProve.size();
+    pProveData->vecBlockTxProve.resize(nBase + block.vtx.size() - 2);
+    std::vector<size_t> vTxIndex;
+    std::vector<std::vector<ProveDataItem>*> vProveData;
+    for (size_t i = 2; i < block.vtx.size(); i++) {
+        vTxIndex.push_back(i);
+        vProveData.push_back(&pProveData->vecBlockTxProve[nBase + i - 2]);
+    }
+    return GetTxsVinBlockData(block, vTxIndex, vProveData);
 }
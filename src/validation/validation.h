@@ -283,6 +283,12 @@ bool LoadChainTip(const MCChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/**
+ * Run a batch of script checks on the script checking threads (inline when there are none).
+ * The checks are consumed. Must not be called while this thread holds a MCCheckQueueControl
+ * on the script check queue (e.g. from inside ConnectBlock's input loop).
+ */
+bool RunScriptChecks(std::vector<CScriptCheck>& vChecks);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload(int * downloadno = nullptr);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -698,4 +698,62 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 260 * 2);
 }
 
+BOOST_FIXTURE_TEST_CASE(AvailableStakeCoins, ListCoinsTestingSetup)
+{
+    std::vector<MCOutput> available;
+    std::vector<MCOutput> stake;
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        wallet->AvailableCoins(available, nullptr, false);
+    }
+    wallet->AvailableStakeCoins(stake);
+    BOOST_CHECK_EQUAL(stake.size(), available.size());
+    BOOST_CHECK(!stake.empty());
+
+    // The snapshot is reused while nothing changes.
+    wallet->AvailableStakeCoins(stake);
+    BOOST_CHECK_EQUAL(stake.size(), available.size());
+
+    // Locking a coin invalidates the snapshot.
+    {
+        LOCK(wallet->cs_wallet);
+        wallet->LockCoin(MCOutPoint(stake[0].tx->GetHash(), stake[0].i));
+    }
+    wallet->AvailableStakeCoins(stake);
+    BOOST_CHECK_EQUAL(stake.size(), available.size() - 1);
+
+    // So does a new wallet transaction.
+    SetMockTime(GetTime() + Params().GetConsensus().nPowTargetSpacing + 10000);
+    AddTx(MCRecipient{GetScriptForRawPubKey({}), 1 * COIN, false /* subtract fee */});
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        wallet->AvailableCoins(available, nullptr, false);
+    }
+    wallet->AvailableStakeCoins(stake);
+    BOOST_CHECK_EQUAL(stake.size(), available.size());
+
+    // Disconnecting a block moves the stake tip back too, so the depths in a
+    // snapshot rebuilt afterwards are not overstated.
+    SetMockTime(GetTime() + Params().GetConsensus().nPowTargetSpacing + 10000);
+    std::shared_ptr<const MCBlock> block = std::make_shared<const MCBlock>(CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey())));
+    {
+        LOCK(cs_main);
+        wallet->BlockConnected(block, chainActive.Tip(), {});
+        MCValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    wallet->BlockDisconnected(block);
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        wallet->AvailableCoins(available, nullptr, false);
+    }
+    wallet->AvailableStakeCoins(stake);
+    BOOST_CHECK_EQUAL(stake.size(), available.size());
+    std::map<MCOutPoint, int> depths;
+    for (const MCOutput& out : available)
+        depths[MCOutPoint(out.tx->GetHash(), out.i)] = out.nDepth;
+    for (const MCOutput& out : stake)
+        BOOST_CHECK_EQUAL(out.nDepth, depths[MCOutPoint(out.tx->GetHash(), out.i)]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
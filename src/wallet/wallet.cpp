@@ -62,6 +62,7 @@ bool IsMineForAllWallets(const MCKeyID& keyid)
 }
 
 #include "chain/branchchain.h"
+#include "chain/branchtxdb.h"
 
 /**
  * Fees smaller than this (in satoshi) are considered zero fee (for transaction creation)
@@ -911,6 +912,7 @@ void MCWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, MCWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        MarkStakeCandidatesDirty();
     }
 }
 
@@ -1012,6 +1014,8 @@ bool MCWallet::AddToWallet(const MCWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    if (fInsertedNew || fUpdated)
+        MarkStakeCandidatesDirty();
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1139,6 +1143,7 @@ bool MCWallet::TransactionCanBeAbandoned(const uint256& hashTx) const
 bool MCWallet::AbandonTransaction(const uint256& hashTx)
 {
     LOCK2(cs_main, cs_wallet);
+    MarkStakeCandidatesDirty();
 
     CWalletDB walletdb(*dbw, "r+");
 
@@ -1213,6 +1218,7 @@ void MCWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
 
     // Do not flush the wallet here for performance reasons
     CWalletDB walletdb(*dbw, "r+", false);
+    MarkStakeCandidatesDirty();
 
     std::set<uint256> todo;
     std::set<uint256> done;
@@ -1293,10 +1299,20 @@ void MCWallet::BlockConnected(const std::shared_ptr<const MCBlock>& pblock, cons
     for (size_t i = 0; i < pblock->vtx.size(); i++) {
         SyncTransaction(pblock->vtx[i], pindex, i);
     }
+
+    // 支链抵押币的锁定状态随块变化；主链只在有币成熟时需要重建候选币
+    nStakeTipHeight = pindex->nHeight;
+    if (!Params().IsMainChain() || pindex->nHeight >= nNextStakeMatureHeight)
+        MarkStakeCandidatesDirty();
 }
 
 void MCWallet::BlockDisconnected(const std::shared_ptr<const MCBlock>& pblock) {
     LOCK2(cs_main, cs_wallet);
+    // 断开后tip回到上一块，否则快照之后的深度会被多加
+    BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
+    if (mi != mapBlockIndex.end())
+        nStakeTipHeight = mi->second->nHeight;
+    MarkStakeCandidatesDirty();
 
     for (const MCTransactionRef& ptx : pblock->vtx) {
         SyncTransaction(ptx);
@@ -2422,6 +2438,61 @@ void MCWallet::AvailableMortgageCoins(std::vector<MCOutput>& vCoins, bool fOnlyS
     }
 }
 
+void MCWallet::AvailableStakeCoins(std::vector<MCOutput>& vCoins)
+{
+    if (fStakeCandidatesDirty) {
+        LOCK2(cs_main, cs_wallet);
+        if (fStakeCandidatesDirty) {
+            // 标记变化的通知都持有cs_wallet，重建期间不会丢失
+            fStakeCandidatesDirty = false;
+
+            std::vector<MCOutput> vCandidates;
+            if (Params().IsMainChain()) {
+                AvailableCoins(vCandidates, nullptr, false);
+            }
+            else {
+                AvailableMortgageCoins(vCandidates, false);
+                vCandidates.erase(std::remove_if(vCandidates.begin(), vCandidates.end(), [](const MCOutput& out) {
+                    uint256 coinpreouthash;
+                    if (!GetMortgageCoinData(out.tx->tx->vout[out.i].scriptPubKey, &coinpreouthash))
+                        return true;
+                    return pBranchChainTxRecordsDb->IsMineCoinLock(coinpreouthash);
+                }), vCandidates.end());
+            }
+
+            // 记录未成熟的coinbase和支链创建币最早成熟的高度，到达该高度的块连接时重建
+            const int nHeight = chainActive.Height();
+            int nNextMature = std::numeric_limits<int>::max();
+            for (const std::pair<const uint256, MCWalletTx>& item : mapWallet) {
+                const MCWalletTx& wtx = item.second;
+                if (!wtx.IsCoinBase() && !wtx.tx->IsBranchCreate())
+                    continue;
+                if (wtx.GetDepthInMainChain() <= 0)
+                    continue;
+                int nBlocks = std::max(wtx.GetBlocksToMaturity(), wtx.GetBlocksToMaturityForCoinCreateBranch());
+                if (nBlocks > 0)
+                    nNextMature = std::min(nNextMature, nHeight + nBlocks);
+            }
+            nNextStakeMatureHeight = nNextMature;
+
+            LOCK(cs_stakeCandidates);
+            vStakeCandidates.swap(vCandidates);
+            nStakeCandidatesHeight = nHeight;
+        }
+    }
+
+    LOCK(cs_stakeCandidates);
+    vCoins = vStakeCandidates;
+    // 快照之后连接的块只增加已确认币的深度
+    int nDelta = nStakeTipHeight - nStakeCandidatesHeight;
+    if (nDelta > 0) {
+        for (MCOutput& out : vCoins) {
+            if (out.nDepth > 0)
+                out.nDepth += nDelta;
+        }
+    }
+}
+
 std::map<MCTxDestination, std::vector<MCOutput>> MCWallet::ListCoins() const
 {
     // TODO: Add AssertLockHeld(cs_wallet) here.
@@ -4024,18 +4095,21 @@ void MCWallet::LockCoin(const MCOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkStakeCandidatesDirty();
 }
 
 void MCWallet::UnlockCoin(const MCOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkStakeCandidatesDirty();
 }
 
 void MCWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkStakeCandidatesDirty();
 }
 
 bool MCWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <limits>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -345,7 +346,7 @@ public:
     mutable MCAmount nAvailableWatchCreditCached;
     mutable MCAmount nChangeCached;
 	// temp data for contract
-	int32_t nVersion = MCTransaction::CURRENT_VERSION;//special version
+	int32_t nVersion = MCTransaction::CURRENT_VERSION;//special version
 
 	// temp data for branch
 	std::string branchVSeeds;
@@ -408,7 +409,7 @@ public:
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
-        isDataTransaction = false;
+        isDataTransaction = false;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -437,7 +438,7 @@ public:
         READWRITE(fTimeReceivedIsTxTime);
         READWRITE(nTimeReceived);
         READWRITE(fFromMe);
-        READWRITE(fSpent);
+        READWRITE(fSpent);
 
         if (ser_action.ForRead())
         {
@@ -730,6 +731,18 @@ private:
      * Should be called with pindexBlock and posInBlock if this is for a transaction that is included in a block. */
     void SyncTransaction(const MCTransactionRef& tx, const MCBlockIndex *pindex = nullptr, int posInBlock = 0);
 
+    /**
+     * 内置挖矿使用的候选币快照，钱包交易、锁定币、抵押币锁定状态或币成熟高度变化时标记为脏，
+     * 下次读取时重建，其余时间矿工只需复制快照，不需要持有cs_main和cs_wallet。
+     */
+    mutable MCCriticalSection cs_stakeCandidates;
+    std::vector<MCOutput> vStakeCandidates;             // guarded by cs_stakeCandidates
+    int nStakeCandidatesHeight = 0;                     // 快照建立时的链高度，guarded by cs_stakeCandidates
+    std::atomic<bool> fStakeCandidatesDirty{true};
+    std::atomic<int> nStakeTipHeight{0};                // 最近一次连接或断开块后的tip高度
+    int nNextStakeMatureHeight = std::numeric_limits<int>::max(); // 快照中未成熟币最早成熟的高度，guarded by cs_wallet
+    void MarkStakeCandidatesDirty() { fStakeCandidatesDirty = true; }
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
@@ -862,6 +875,11 @@ public:
      */
 	void AvailableCoins(std::vector<MCOutput>& vCoins, const MCTxDestination* dest = nullptr, bool fOnlySafe = true, const MCCoinControl *coinControl = nullptr, const MCAmount& nMinimumAmount = 1, const MCAmount& nMaximumAmount = MAX_MONEY, const MCAmount& nMinimumSumAmount = MAX_MONEY, const uint64_t& nMaximumCount = 0, const int& nMinDepth = 0, const int& nMaxDepth = 9999999) const;
     void AvailableMortgageCoins(std::vector<MCOutput>& vCoins, bool fOnlySafe = true, branch_script_type bsptype = BST_MORTGAGE_COIN, const MCCoinControl *coinControl = nullptr, const MCAmount& nMinimumAmount = 1, const MCAmount& nMaximumAmount = MAX_MONEY, const MCAmount& nMinimumSumAmount = MAX_MONEY, const uint64_t& nMaximumCount = 0, const int& nMinDepth = 0, const int& nMaxDepth = 9999999);
+    /**
+     * 内置挖矿的候选币，等同于主链的AvailableCoins(fOnlySafe=false)或支链的AvailableMortgageCoins(fOnlySafe=false)，
+     * 支链已排除被锁定的抵押币。快照有效时不获取cs_main。
+     */
+    void AvailableStakeCoins(std::vector<MCOutput>& vCoins);
 
     /**
      * Return list of available coins and locked coins grouped by non-change output address.